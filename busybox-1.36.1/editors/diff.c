@@ -94,6 +94,14 @@
 //config:	help
 //config:	This option enables support for directory and subdirectory
 //config:	comparison.
+//config:
+//config:config FEATURE_DIFF_MYERS
+//config:	bool "Enable --algorithm=myers"
+//config:	default y
+//config:	depends on FEATURE_DIFF_LONG_OPTIONS
+//config:	help
+//config:	Myers' O(ND) algorithm. Much faster than the default one
+//config:	on big files with many repeated lines.
 
 //applet:IF_DIFF(APPLET(diff, BB_DIR_USR_BIN, BB_SUID_DROP))
 
@@ -105,6 +113,10 @@
 //usage:       "Compare files line by line and output the differences between them.\n"
 //usage:       "This implementation supports unified diffs only.\n"
 //usage:     "\n	-a	Treat all files as text"
+//usage:	IF_FEATURE_DIFF_MYERS(
+//usage:     "\n	--algorithm=myers|minimal|stone"
+//usage:     "\n		Diff algorithm (default stone)"
+//usage:	)
 //usage:     "\n	-b	Ignore changes in the amount of whitespace"
 //usage:     "\n	-B	Ignore changes whose lines are all blank"
 //usage:     "\n	-d	Try hard to find a smaller set of changes"
@@ -154,6 +166,7 @@ enum {                  /* Commandline flags */
 	FLAG_p,         /* not implemented */
 	FLAG_B,
 	FLAG_E,         /* not implemented */
+	FLAG_myers,     /* --algorithm=myers|minimal */
 };
 #define FLAG(x) (1 << FLAG_##x)
 
@@ -161,6 +174,9 @@ enum {                  /* Commandline flags */
 typedef struct FILE_and_pos_t {
 	FILE *ft_fp;
 	off_t ft_pos;
+	/* If the file could be mmapped, it is read from here, not ft_fp */
+	const unsigned char *ft_map;
+	off_t ft_size;
 } FILE_and_pos_t;
 
 struct globals {
@@ -202,10 +218,30 @@ static void seek_ft(FILE_and_pos_t *ft, off_t pos)
 {
 	if (ft->ft_pos != pos) {
 		ft->ft_pos = pos;
-		fseeko(ft->ft_fp, pos, SEEK_SET);
+		if (!ft->ft_map)
+			fseeko(ft->ft_fp, pos, SEEK_SET);
 	}
 }
 
+static int getc_ft(FILE_and_pos_t *ft)
+{
+	int c;
+
+	if (ft->ft_map)
+		return ft->ft_pos < ft->ft_size ? ft->ft_map[ft->ft_pos++] : EOF;
+	c = fgetc(ft->ft_fp);
+	if (c != EOF)
+		ft->ft_pos++;
+	return c;
+}
+
+/* Without -b/-i/-w, lines of mapped files can be hashed
+ * and compared as plain bytes */
+static bool can_use_map(FILE_and_pos_t *ft)
+{
+	return ft->ft_map && !(option_mask32 & (FLAG(b) | FLAG(i) | FLAG(w)));
+}
+
 /* Reads tokens from given fp, handling -b and -w flags
  * The user must reset tok every line start
  */
@@ -216,9 +252,7 @@ static int read_token(FILE_and_pos_t *ft, token_t tok)
 		bool is_space;
 		int t;
 
-		t = fgetc(ft->ft_fp);
-		if (t != EOF)
-			ft->ft_pos++;
+		t = getc_ft(ft);
 		is_space = (t == EOF || isspace(t));
 
 		/* If t == EOF (-1), set both TOK_EOF and TOK_EOL */
@@ -417,12 +451,11 @@ static void fetch(FILE_and_pos_t *ft, const off_t *ix, int a, int b, int ch)
 		if (option_mask32 & FLAG(T))
 			putchar('\t');
 		for (j = 0, col = 0; j < ix[i] - ix[i - 1]; j++) {
-			int c = fgetc(ft->ft_fp);
+			int c = getc_ft(ft);
 			if (c == EOF) {
 				puts("\n\\ No newline at end of file");
 				return;
 			}
-			ft->ft_pos++;
 			if (c == '\t' && (option_mask32 & FLAG(t)))
 				do putchar(' '); while (++col & 7);
 			else {
@@ -433,6 +466,174 @@ static void fetch(FILE_and_pos_t *ft, const off_t *ix, int a, int b, int ch)
 	}
 }
 
+#if ENABLE_FEATURE_DIFF_MYERS
+/* Myers' "An O(ND) Difference Algorithm and Its Variations",
+ * linear space version: find the middle snake of the edit graph,
+ * recurse on both halves.
+ */
+struct myers {
+	const int *a, *b;  /* line hashes */
+	int *J;            /* J[x] = y + base if a[x] matches b[y] */
+	int base;
+	int *fd, *bd;      /* furthest x reached on each diagonal x-y */
+	int too_expensive;
+};
+
+/* Find a point (*xmid,*ymid) on an optimal (or, if it gets too expensive,
+ * a good enough) path from (xoff,yoff) to (xlim,ylim) */
+static void myers_split(struct myers *m, int xoff, int xlim, int yoff, int ylim,
+		int *xmid, int *ymid)
+{
+	const int *a = m->a, *b = m->b;
+	int *fd = m->fd, *bd = m->bd;
+	const int dmin = xoff - ylim, dmax = xlim - yoff;
+	const int fmid = xoff - yoff, bmid = xlim - ylim;
+	const int odd = (fmid - bmid) & 1;
+	int fmin = fmid, fmax = fmid;
+	int bmin = bmid, bmax = bmid;
+	int c, d, x, y;
+
+	fd[fmid] = xoff;
+	bd[bmid] = xlim;
+	for (c = 1;; c++) {
+		/* Extend the forward search by one edit */
+		if (fmin > dmin)
+			fd[--fmin - 1] = -1;
+		else
+			fmin++;
+		if (fmax < dmax)
+			fd[++fmax + 1] = -1;
+		else
+			fmax--;
+		for (d = fmax; d >= fmin; d -= 2) {
+			x = fd[d - 1] >= fd[d + 1] ? fd[d - 1] + 1 : fd[d + 1];
+			y = x - d;
+			while (x < xlim && y < ylim && a[x] == b[y])
+				x++, y++;
+			fd[d] = x;
+			if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+				*xmid = x;
+				*ymid = y;
+				return;
+			}
+		}
+		/* Extend the backward search by one edit */
+		if (bmin > dmin)
+			bd[--bmin - 1] = INT_MAX;
+		else
+			bmin++;
+		if (bmax < dmax)
+			bd[++bmax + 1] = INT_MAX;
+		else
+			bmax--;
+		for (d = bmax; d >= bmin; d -= 2) {
+			x = bd[d - 1] < bd[d + 1] ? bd[d - 1] : bd[d + 1] - 1;
+			y = x - d;
+			while (x > xoff && y > yoff && a[x - 1] == b[y - 1])
+				x--, y--;
+			bd[d] = x;
+			if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+				*xmid = x;
+				*ymid = y;
+				return;
+			}
+		}
+		if (c >= m->too_expensive) {
+			/* Give up on the optimal path, split at the point
+			 * which got furthest from its end */
+			int fxy = -1, fx = xoff, bxy = INT_MAX, bx = xlim;
+
+			for (d = fmax; d >= fmin; d -= 2) {
+				x = MIN(fd[d], xlim);
+				y = x - d;
+				if (y > ylim)
+					x = ylim + d, y = ylim;
+				if (x + y > fxy)
+					fxy = x + y, fx = x;
+			}
+			for (d = bmax; d >= bmin; d -= 2) {
+				x = MAX(xoff, bd[d]);
+				y = x - d;
+				if (y < yoff)
+					x = yoff + d, y = yoff;
+				if (x + y < bxy)
+					bxy = x + y, bx = x;
+			}
+			if ((xlim + ylim) - bxy < fxy - (xoff + yoff)) {
+				*xmid = fx;
+				*ymid = fxy - fx;
+			} else {
+				*xmid = bx;
+				*ymid = bxy - bx;
+			}
+			return;
+		}
+	}
+}
+
+static void myers_compare(struct myers *m, int xoff, int xlim, int yoff, int ylim)
+{
+	while (1) {
+		int xmid, ymid;
+
+		/* Matching head and tail lines need no search */
+		while (xoff < xlim && yoff < ylim && m->a[xoff] == m->b[yoff])
+			m->J[xoff++] = m->base + yoff++;
+		while (xoff < xlim && yoff < ylim && m->a[xlim - 1] == m->b[ylim - 1])
+			m->J[--xlim] = m->base + --ylim;
+		/* Only deletions or only insertions left? */
+		if (xoff == xlim || yoff == ylim)
+			return;
+		myers_split(m, xoff, xlim, yoff, ylim, &xmid, &ymid);
+		myers_compare(m, xoff, xmid, yoff, ymid);
+		xoff = xmid;
+		yoff = ymid;
+	}
+}
+
+/* Same as create_J() below, but using myers_compare() instead of stone() */
+static NOINLINE int *myers_J(struct line *nfile[2], int nlen[2], int pref, int suff)
+{
+	struct myers m;
+	int *J, *a, *v, i, delta;
+	int n = nlen[0] - pref - suff;
+	int k = nlen[1] - pref - suff;
+
+	J = xmalloc((nlen[0] + 2) * sizeof(J[0]));
+	for (i = 0, delta = nlen[1] - nlen[0]; i <= nlen[0]; i++)
+		J[i] = i <= pref            ?  i :
+		       i > (nlen[0] - suff) ? (i + delta) : 0;
+	J[nlen[0] + 1] = nlen[1] + 1;
+
+	a = xmalloc((n + k) * sizeof(a[0]));
+	for (i = 0; i < n; i++)
+		a[i] = nfile[0][pref + 1 + i].value;
+	for (i = 0; i < k; i++)
+		a[n + i] = nfile[1][pref + 1 + i].value;
+	m.a = a;
+	m.b = a + n;
+	m.J = J + pref + 1;
+	m.base = pref + 1;
+	/* Diagonals range from -k-1 to n+1 */
+	v = xmalloc(2 * (n + k + 3) * sizeof(v[0]));
+	m.fd = v + k + 1;
+	m.bd = v + (n + k + 3) + k + 1;
+	/* Cost limit grows as sqrt(n+k) */
+	m.too_expensive = 1;
+	for (i = n + k + 3; i; i >>= 2)
+		m.too_expensive <<= 1;
+	m.too_expensive = MAX(4096, m.too_expensive);
+	if (option_mask32 & FLAG(d))
+		m.too_expensive = INT_MAX;
+
+	myers_compare(&m, 0, n, 0, k);
+
+	free(v);
+	free(a);
+	return J;
+}
+#endif
+
 /* Creates the match vector J, where J[i] is the index
  * of the line in the new file corresponding to the line i
  * in the old file. Lines start at 1 instead of 0, that value
@@ -459,8 +660,6 @@ static NOINLINE int *create_J(FILE_and_pos_t ft[2], int nlen[2], off_t *ix[2])
 	 * fileno == 1 points to the new one.
 	 */
 	for (i = 0; i < 2; i++) {
-		unsigned hash;
-		token_t tok;
 		size_t sz = 100;
 		nfile[i] = xmalloc((sz + 3) * sizeof(nfile[i][0]));
 		/* ft gets here without the correct position, cant use seek_ft */
@@ -470,17 +669,40 @@ static NOINLINE int *create_J(FILE_and_pos_t ft[2], int nlen[2], off_t *ix[2])
 		nlen[i] = 0;
 		/* We could zalloc nfile, but then zalloc starts showing in gprof at ~1% */
 		nfile[i][0].offset = 0;
-		goto start; /* saves code */
 		while (1) {
-			tok = read_token(&ft[i], tok);
-			if (!(tok & TOK_EMPTY)) {
-				/* Hash algorithm taken from Robert Sedgewick, Algorithms in C, 3d ed., p 578. */
-				/*hash = hash * 128 - hash + TOK2CHAR(tok);
-				 * gcc insists on optimizing above to "hash * 127 + ...", thus... */
-				unsigned o = hash - TOK2CHAR(tok);
-				hash = hash * 128 - o; /* we want SPEED here */
-				continue;
+			/* Hash algorithm taken from Robert Sedgewick, Algorithms in C, 3d ed., p 578. */
+			/*hash = hash * 128 - hash + TOK2CHAR(tok);
+			 * gcc insists on optimizing above to "hash * 127 + ...", thus... */
+#define HASH_CHAR(c) do { unsigned o = hash - (c); hash = hash * 128 - o; } while (0)
+			unsigned hash = 0;
+			bool eof;
+
+			if (can_use_map(&ft[i])) {
+				/* Same hashes as read_token() loop below would give */
+				const unsigned char *p = ft[i].ft_map + ft[i].ft_pos;
+				const unsigned char *end = ft[i].ft_map + ft[i].ft_size;
+				const unsigned char *q = p;
+
+				while (q < end) {
+					HASH_CHAR(*q);
+					if (*q++ == '\n')
+						break;
+				}
+				ft[i].ft_pos = q - ft[i].ft_map;
+				eof = (q == p || q[-1] != '\n');
+				if (eof) /* read_token() returns EOF as a char */
+					HASH_CHAR(CHAR_MASK);
+			} else {
+				token_t tok = 0;
+				while (1) {
+					tok = read_token(&ft[i], tok);
+					if (tok & TOK_EMPTY)
+						break;
+					HASH_CHAR(TOK2CHAR(tok)); /* we want SPEED here */
+				}
+				eof = (tok & TOK_EOF);
 			}
+#undef HASH_CHAR
 			if (nlen[i]++ == sz) {
 				sz = sz * 3 / 2;
 				nfile[i] = xrealloc(nfile[i], (sz + 3) * sizeof(nfile[i][0]));
@@ -489,13 +711,11 @@ static NOINLINE int *create_J(FILE_and_pos_t ft[2], int nlen[2], off_t *ix[2])
 			nfile[i][nlen[i]].value = hash & INT_MAX;
 			/* like ftello(ft[i].ft_fp) but faster (avoids lseek syscall) */
 			nfile[i][nlen[i]].offset = ft[i].ft_pos;
-			if (tok & TOK_EOF) {
+			if (eof) {
 				/* EOF counts as a token, so we have to adjust it here */
 				nfile[i][nlen[i]].offset++;
 				break;
 			}
-start:
-			hash = tok = 0;
 		}
 		/* Exclude lone EOF line from the end of the file, to make fetch()'s job easier */
 		if (nfile[i][nlen[i]].offset - nfile[i][nlen[i] - 1].offset == 1)
@@ -513,6 +733,14 @@ start:
 	for (; suff < nlen[0] - pref && suff < nlen[1] - pref &&
 	       nfile[0][nlen[0] - suff].value == nfile[1][nlen[1] - suff].value;
 	       suff++);
+#if ENABLE_FEATURE_DIFF_MYERS
+	if (option_mask32 & FLAG(myers)) {
+		J = myers_J(nfile, nlen, pref, suff);
+		free(nfile[0]);
+		free(nfile[1]);
+		goto rescan;
+	}
+#endif
 	/* Arrays are pruned by the suffix and prefix length,
 	 * the result being sorted and stored in sfile[fileno],
 	 * and their sizes are stored in slen[fileno]
@@ -564,6 +792,7 @@ start:
 	free(class);
 	free(member);
 
+ IF_FEATURE_DIFF_MYERS(rescan:)
 	/* Both files are rescanned, in an effort to find any lines
 	 * which, due to limitations intrinsic to any hashing algorithm,
 	 * are different but ended up confounded as the same
@@ -572,6 +801,23 @@ start:
 		if (!J[i])
 			continue;
 
+		if (can_use_map(&ft[0]) && can_use_map(&ft[1])) {
+			off_t start0 = ix[0][i - 1];
+			off_t start1 = ix[1][J[i] - 1];
+			off_t len = ix[0][i] - start0;
+			/* Last line without '\n' has EOF "char" at the end */
+			bool eof0 = (ix[0][i] > ft[0].ft_size);
+			bool eof1 = (ix[1][J[i]] > ft[1].ft_size);
+
+			if (len != ix[1][J[i]] - start1
+			 || eof0 != eof1
+			 || memcmp(ft[0].ft_map + start0, ft[1].ft_map + start1, len - eof0) != 0
+			) {
+				J[i] = 0; /* Break the correspondence */
+			}
+			continue;
+		}
+
 		seek_ft(&ft[0], ix[0][i - 1]);
 		seek_ft(&ft[1], ix[1][J[i] - 1]);
 
@@ -593,19 +839,16 @@ start:
 	return J;
 }
 
-static bool diff(FILE* fp[2], char *file[2])
+static bool diff(FILE_and_pos_t ft[2], char *file[2])
 {
 	int nlen[2];
 	off_t *ix[2];
-	FILE_and_pos_t ft[2];
 	typedef struct { int a, b; } vec_t[2];
 	vec_t *vec = NULL;
 	int i = 1, j, k, idx = -1;
 	bool anychange = false;
 	int *J;
 
-	ft[0].ft_fp = fp[0];
-	ft[1].ft_fp = fp[1];
 	/* note that ft[i].ft_pos is unintitalized, create_J()
 	 * must not assume otherwise */
 	J = create_J(ft, nlen, ix);
@@ -706,12 +949,17 @@ static bool diff(FILE* fp[2], char *file[2])
 
 static int diffreg(char *file[2])
 {
-	FILE *fp[2];
+	FILE_and_pos_t ft[2];
+	struct stat st[2];
 	bool binary = false, differ = false;
+	/* With -q, any byte difference is enough to say "Files differ",
+	 * unless differences may be ignored */
+	bool quick = (option_mask32 & (FLAG(q) | FLAG(b) | FLAG(i) | FLAG(w) | FLAG(B))) == FLAG(q);
 	int status = STATUS_SAME, i;
 
-	fp[0] = stdin;
-	fp[1] = stdin;
+	memset(ft, 0, sizeof(ft));
+	ft[0].ft_fp = stdin;
+	ft[1].ft_fp = stdin;
 	for (i = 0; i < 2; i++) {
 		int fd = STDIN_FILENO;
 		if (!LONE_DASH(file[i])) {
@@ -741,17 +989,49 @@ static int diffreg(char *file[2])
 			fd = fd_tmp;
 			xlseek(fd, 0, SEEK_SET);
 		}
-		fp[i] = fdopen(fd, "r");
+		ft[i].ft_fp = fdopen(fd, "r");
+		if (fstat(fd, &st[i]) != 0)
+			st[i].st_mode = 0;
+	}
+
+	if (quick
+	 && S_ISREG(st[0].st_mode) && S_ISREG(st[1].st_mode)
+	 && st[0].st_size != st[1].st_size
+	) {
+		differ = true;
+		goto compared;
+	}
+
+	/* Lines are hashed, compared and printed
+	 * much faster from memory than with getc() */
+	for (i = 0; i < 2; i++) {
+		if (S_ISREG(st[i].st_mode)
+		 && st[i].st_size > 0 && st[i].st_size <= SSIZE_MAX
+		) {
+			void *map = mmap(NULL, st[i].st_size, PROT_READ, MAP_PRIVATE,
+					fileno(ft[i].ft_fp), 0);
+			if (map != MAP_FAILED) {
+				ft[i].ft_map = map;
+				ft[i].ft_size = st[i].st_size;
+			}
+		}
 	}
 
+	if (ft[0].ft_map && ft[1].ft_map) {
+		size_t n = MIN(ft[0].ft_size, ft[1].ft_size);
+		differ = (ft[0].ft_size != ft[1].ft_size
+			|| memcmp(ft[0].ft_map, ft[1].ft_map, n) != 0);
+		binary = (memchr(ft[0].ft_map, 0, n) || memchr(ft[1].ft_map, 0, n));
+		goto compared;
+	}
 	setup_common_bufsiz();
 	while (1) {
 		const size_t sz = COMMON_BUFSIZE / 2;
 		char *const buf0 = bb_common_bufsiz1;
 		char *const buf1 = buf0 + sz;
 		int j, k;
-		i = fread(buf0, 1, sz, fp[0]);
-		j = fread(buf1, 1, sz, fp[1]);
+		i = fread(buf0, 1, sz, ft[0].ft_fp);
+		j = fread(buf1, 1, sz, ft[1].ft_fp);
 		if (i != j) {
 			differ = true;
 			i = MIN(i, j);
@@ -765,17 +1045,21 @@ static int diffreg(char *file[2])
 				differ = true;
 		}
 	}
+ compared:
 	if (differ) {
 		if (binary && !(option_mask32 & FLAG(a)))
 			status = STATUS_BINARY;
-		else if (diff(fp, file))
+		else if (quick || diff(ft, file))
 			status = STATUS_DIFFER;
 	}
 	if (status != STATUS_SAME)
 		exit_status |= 1;
 out:
-	fclose_if_not_stdin(fp[0]);
-	fclose_if_not_stdin(fp[1]);
+	for (i = 0; i < 2; i++) {
+		if (ft[i].ft_map)
+			munmap((void*)ft[i].ft_map, ft[i].ft_size);
+		fclose_if_not_stdin(ft[i].ft_fp);
+	}
 
 	return status;
 }
@@ -964,6 +1248,9 @@ static const char diff_longopts[] ALIGN1 =
 	"report-identical-files\0"   No_argument       "s"
 	"starting-file\0"            Required_argument "S"
 	"minimal\0"                  No_argument       "d"
+# if ENABLE_FEATURE_DIFF_MYERS
+	"algorithm\0"                Required_argument "\xff"
+# endif
 	;
 # define GETOPT32 getopt32long
 # define LONGOPTS ,diff_longopts
@@ -978,14 +1265,31 @@ int diff_main(int argc UNUSED_PARAM, char **argv)
 	int gotstdin = 0, i;
 	char *file[2], *s_start = NULL;
 	llist_t *L_arg = NULL;
+	IF_FEATURE_DIFF_MYERS(const char *algo = "stone";)
 
 	INIT_G();
 
 	/* exactly 2 params; collect multiple -L <label>; -U N */
-	GETOPT32(argv, "^" "abdiL:*NqrsS:tTU:+wupBE" "\0" "=2"
+	GETOPT32(argv, "^" "abdiL:*NqrsS:tTU:+wupBE" IF_FEATURE_DIFF_MYERS("\xff:") "\0" "=2"
 			LONGOPTS,
-			&L_arg, &s_start, &opt_U_context);
+			&L_arg, &s_start, &opt_U_context IF_FEATURE_DIFF_MYERS(, &algo));
 	argv += optind;
+#if ENABLE_FEATURE_DIFF_MYERS
+	/* Reuse the option bit to mean "use myers" */
+	option_mask32 &= ~FLAG(myers);
+	switch (index_in_strings("stone\0""myers\0""minimal\0", algo)) {
+	case 2: /* minimal */
+		option_mask32 |= FLAG(d);
+		/* fall through */
+	case 1: /* myers */
+		option_mask32 |= FLAG(myers);
+		/* fall through */
+	case 0:
+		break;
+	default:
+		bb_error_msg_and_die("unknown algorithm '%s'", algo);
+	}
+#endif
 	while (L_arg)
 		label[!!label[0]] = llist_pop(&L_arg);
 
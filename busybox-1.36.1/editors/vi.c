@@ -341,6 +341,12 @@ struct globals {
 	smallint cmd_mode;       // 0=command  1=insert 2=replace
 	int modified_count;      // buffer contents changed if !0
 	int last_modified_count; // = -1;
+	// Line index: text[] cut into spans which know their newline count
+	struct lidx_span {
+		int len;
+		int nl;          // -1: needs recounting
+	} *lidx;                 // NULL: not built yet
+	int lidx_cnt;
 	int cmdline_filecnt;     // how many file names on cmd line
 	int cmdcnt;              // repetition count
 	char *rstart;            // start of text in Replace mode
@@ -476,6 +482,8 @@ struct globals {
 #define cmd_mode                (G.cmd_mode           )
 #define modified_count          (G.modified_count     )
 #define last_modified_count     (G.last_modified_count)
+#define lidx                    (G.lidx               )
+#define lidx_cnt                (G.lidx_cnt           )
 #define cmdline_filecnt         (G.cmdline_filecnt    )
 #define cmdcnt                  (G.cmdcnt             )
 #define rstart                  (G.rstart             )
@@ -749,6 +757,158 @@ static char *end_screen(void)
 	return q;
 }
 
+// count newlines in p..q-1
+static int count_nl(const char *p, const char *q)
+{
+	int cnt = 0;
+
+	while (p < q) {
+		p = memchr(p, '\n', q - p);
+		if (!p)
+			break;
+		cnt++;
+		p++;
+	}
+	return cnt;
+}
+
+// Line index. Counting lines up to a position, or finding line N,
+// walks the span table and scans one span, not the whole text[].
+// Edits adjust lengths of the spans they touch and mark them
+// for recounting, which is done when the index is next used.
+#define LIDX_SPAN (64 * 1024)
+
+// build the index if needed, recount changed spans
+static void lidx_update(void)
+{
+	char *p = text;
+	int i;
+
+	if (!lidx) {
+		lidx = xmalloc(sizeof(lidx[0]));
+		lidx_cnt = 1;
+		lidx[0].len = end - text;
+		lidx[0].nl = -1;
+	}
+	for (i = 0; i < lidx_cnt; i++) {
+		struct lidx_span *sp = &lidx[i];
+
+		if (sp->nl < 0) {
+			if (sp->len == 0 && lidx_cnt > 1) {
+				// emptied by deletions: drop it
+				memmove(sp, sp + 1, (lidx_cnt - i - 1) * sizeof(lidx[0]));
+				lidx_cnt--;
+				i--;
+				continue;
+			}
+			if (sp->len >= 2 * LIDX_SPAN) {
+				// grew big (or is the whole file): split it
+				int n = sp->len / LIDX_SPAN;
+				int j;
+
+				lidx = xrealloc(lidx, (lidx_cnt + n - 1) * sizeof(lidx[0]));
+				sp = &lidx[i];
+				memmove(sp + n, sp + 1, (lidx_cnt - i - 1) * sizeof(lidx[0]));
+				lidx_cnt += n - 1;
+				for (j = 1; j < n; j++) {
+					sp[j].len = LIDX_SPAN;
+					sp[j].nl = -1;
+				}
+				sp->len -= (n - 1) * LIDX_SPAN;
+			}
+			sp->nl = count_nl(p, p + sp->len);
+		}
+		p += sp->len;
+	}
+}
+
+// size bytes were inserted at p
+static void lidx_insert(char *p, int size)
+{
+	int off = p - text;
+	int i;
+
+	if (!lidx)
+		return;
+	// at a span boundary, grow the earlier span
+	for (i = 0; i < lidx_cnt - 1 && off > lidx[i].len; i++)
+		off -= lidx[i].len;
+	lidx[i].len += size;
+	lidx[i].nl = -1;
+}
+
+// size bytes at p were deleted
+static void lidx_delete(char *p, int size)
+{
+	int off = p - text;
+	int i;
+
+	if (!lidx)
+		return;
+	for (i = 0; i < lidx_cnt && size > 0; i++) {
+		int n = lidx[i].len - off;
+
+		if (n <= 0) {
+			off -= lidx[i].len;
+			continue;
+		}
+		if (n > size)
+			n = size;
+		lidx[i].len -= n;
+		lidx[i].nl = -1;
+		size -= n;
+		off = 0;
+	}
+}
+
+// text[p..q-1] was changed in place
+static void lidx_changed(char *p, char *q)
+{
+	int off = p - text;
+	int i;
+
+	if (!lidx)
+		return;
+	for (i = 0; i < lidx_cnt && q > p; i++) {
+		int n = lidx[i].len - off;
+
+		if (n <= 0) {
+			off -= lidx[i].len;
+			continue;
+		}
+		lidx[i].nl = -1;
+		p += n;
+		off = 0;
+	}
+}
+
+// number of newlines before p
+static int lines_before(char *p)
+{
+	char *s = text;
+	int cnt = 0;
+	int i;
+
+	lidx_update();
+	for (i = 0; i < lidx_cnt && p - s >= lidx[i].len; i++) {
+		cnt += lidx[i].nl;
+		s += lidx[i].len;
+	}
+	return cnt + count_nl(s, p);
+}
+
+// number of newlines in text[]
+static int lines_total(void)
+{
+	int cnt = 0;
+	int i;
+
+	lidx_update();
+	for (i = 0; i < lidx_cnt; i++)
+		cnt += lidx[i].nl;
+	return cnt;
+}
+
 // count line from start to stop
 static int count_lines(char *start, char *stop)
 {
@@ -760,6 +920,10 @@ static int count_lines(char *start, char *stop)
 		start = stop;
 		stop = q;
 	}
+	if (start == text) { // the usual case, "what line are we on?"
+		stop = end_line(stop);
+		return lines_before(stop < end ? stop + 1 : end);
+	}
 	cnt = 0;
 	stop = end_line(stop);
 	while (start <= stop && start <= end - 1) {
@@ -773,9 +937,18 @@ static int count_lines(char *start, char *stop)
 
 static char *find_line(int li)	// find beginning of line #li
 {
-	char *q;
+	char *q = text;
+	int rest = lines_total();
+	int i;
 
-	for (q = text; li > 1; li--) {
+	// skip spans which end before line #li starts. Stepping stops
+	// at the last line, so do not skip past the last newline
+	for (i = 0; li - 1 > lidx[i].nl && rest - lidx[i].nl > 0; i++) {
+		li -= lidx[i].nl;
+		rest -= lidx[i].nl;
+		q += lidx[i].len;
+	}
+	for (; li > 1; li--) {
 		q = next_line(q);
 	}
 	return q;
@@ -1265,16 +1438,14 @@ static int format_edit_status(void)
 	// (this will cause a mis-reporting of modified status
 	// once every MAXINT editing operations.)
 
-	// it would be nice to do a similar optimization here -- if
-	// we haven't done a motion that could have changed which line
-	// we're on, then we shouldn't have to do this count_lines()
+	// count_lines() remembers where it counted last time,
+	// so this only scans text between old and new cursor position
 	cur = count_lines(text, dot);
 
-	// count_lines() is expensive.
-	// Call it only if something was changed since last time
+	// Total is known if nothing was changed since last time
 	// we were here:
 	if (modified_count != last_modified_count) {
-		tot = cur + count_lines(dot, end - 1) - 1;
+		tot = lines_total();
 		last_modified_count = modified_count;
 	}
 
@@ -1499,6 +1670,7 @@ static uintptr_t text_hole_make(char *p, int size)	// at "p", make a 'size' byte
 
 	if (size <= 0)
 		return bias;
+	lidx_insert(p, size);
 	end += size;		// adjust the new END
 	if (end >= (text + text_size)) {
 		char *new_text;
@@ -1567,6 +1739,7 @@ static char *text_hole_delete(char *p, char *q, int undo)
 	if (dest < text || dest >= end)
 		goto thd0;
 	modified_count++;
+	lidx_delete(dest, src - dest);
 	if (src >= end)
 		goto thd_atend;	// just delete the end of the buffer
 	memmove(dest, src, cnt);
@@ -2128,6 +2301,7 @@ static char *char_insert(char *p, char c, int undo) // insert the char c at 'p'
 		refresh(FALSE);	// show the ^
 		c = get_one_char();
 		*p = c;
+		lidx_changed(p, p + 1);
 #if ENABLE_FEATURE_VI_UNDO
 		undo_push_insert(p, 1, undo);
 #else
@@ -2227,6 +2401,7 @@ static char *char_insert(char *p, char c, int undo) // insert the char c at 'p'
 					// move the indent to the current line
 					memmove(bol + 1, bol, len);
 					*bol = '\n';
+					lidx_changed(bol, bol + len + 1);
 					return p;
 				}
 			} else {
@@ -2312,6 +2487,8 @@ static int init_text_buffer(char *fn)
 	free(text);
 	text_size = 10240;
 	screenbegin = dot = end = text = xzalloc(text_size);
+	free(lidx);
+	lidx = NULL;
 
 	update_filename(fn);
 	rc = file_insert(fn, text, 1);
@@ -4241,6 +4418,7 @@ static void do_cmd(int c)
 		do {
 			dot_end();		// move to NL
 			if (dot < end - 1) {	// make sure not last char in text[]
+				lidx_changed(dot, dot + 1);
 #if ENABLE_FEATURE_VI_UNDO
 				undo_push(dot, 1, UNDO_DEL);
 				*dot++ = ' ';	// replace NL with space
@@ -65,6 +65,24 @@
 //config:	default y
 //config:	depends on XARGS
 //config:
+//config:config FEATURE_XARGS_SUPPORT_GROUP
+//config:	bool "Enable --group: do not mix output of parallel processes"
+//config:	default y
+//config:	depends on FEATURE_XARGS_SUPPORT_PARALLEL
+//config:	help
+//config:	Support --group: stdout of every PROG run by -P N is buffered
+//config:	in a temporary file and printed in one piece when PROG exits.
+//config:
+//config:config FEATURE_XARGS_SUPPORT_JOBSERVER
+//config:	bool "Use GNU make jobserver to limit parallel processes"
+//config:	default y
+//config:	depends on FEATURE_XARGS_SUPPORT_PARALLEL
+//config:	help
+//config:	If MAKEFLAGS has --jobserver-auth=R,W or --jobserver-auth=fifo:PATH,
+//config:	-P N takes a token from make's jobserver for every process
+//config:	except the first one, so that xargs run from a parallel make
+//config:	(and make run from xargs) stay within one CPU budget.
+//config:
 //config:config FEATURE_XARGS_SUPPORT_ARGS_FILE
 //config:	bool "Enable -a FILE: use FILE instead of stdin"
 //config:	default y
@@ -75,6 +93,8 @@
 //kbuild:lib-$(CONFIG_XARGS) += xargs.o
 
 #include "libbb.h"
+#include "busybox.h" /* for APPLET_IS_NOFORK/NOEXEC */
+#include "NUM_APPLETS.h"
 #include "common_bufsiz.h"
 
 /* This is a NOEXEC applet. Be very careful! */
@@ -116,6 +136,18 @@ struct globals {
 #if ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL
 	int running_procs;
 	int max_procs;
+#endif
+#if ENABLE_FEATURE_XARGS_SUPPORT_GROUP
+	struct xargs_job {
+		pid_t pid;
+		int out_fd;
+	} *jobs;
+#endif
+#if ENABLE_FEATURE_XARGS_SUPPORT_JOBSERVER
+	int js_rfd;
+	int js_wfd;
+	int js_held;     /* tokens taken from jobserver */
+	char *js_tokens; /* their values, we must return the same bytes */
 #endif
 	smalluint xargs_exitcode;
 #if ENABLE_FEATURE_XARGS_SUPPORT_QUOTES
@@ -137,6 +169,9 @@ struct globals {
 	G.idx = 0; \
 	IF_FEATURE_XARGS_SUPPORT_PARALLEL(G.running_procs = 0;) \
 	IF_FEATURE_XARGS_SUPPORT_PARALLEL(G.max_procs = 1;) \
+	IF_FEATURE_XARGS_SUPPORT_GROUP(G.jobs = NULL;) \
+	IF_FEATURE_XARGS_SUPPORT_JOBSERVER(G.js_rfd = -1;) \
+	IF_FEATURE_XARGS_SUPPORT_JOBSERVER(G.js_held = 0;) \
 	G.xargs_exitcode = 0; \
 	IF_FEATURE_XARGS_SUPPORT_QUOTES(G.process_stdin__state = NORM;) \
 	IF_FEATURE_XARGS_SUPPORT_QUOTES(G.process_stdin__q = '\0';) \
@@ -156,6 +191,9 @@ enum {
 	IF_FEATURE_XARGS_SUPPORT_ZERO_TERM(   OPTBIT_ZEROTERM   ,)
 	IF_FEATURE_XARGS_SUPPORT_REPL_STR(    OPTBIT_REPLSTR    ,)
 	IF_FEATURE_XARGS_SUPPORT_REPL_STR(    OPTBIT_REPLSTR1   ,)
+	IF_FEATURE_XARGS_SUPPORT_PARALLEL(    OPTBIT_PARALLEL   ,)
+	IF_FEATURE_XARGS_SUPPORT_ARGS_FILE(   OPTBIT_ARGS_FILE  ,)
+	IF_FEATURE_XARGS_SUPPORT_GROUP(       OPTBIT_GROUP      ,)
 
 	OPT_VERBOSE     = 1 << OPTBIT_VERBOSE    ,
 	OPT_NO_EMPTY    = 1 << OPTBIT_NO_EMPTY   ,
@@ -169,6 +207,7 @@ enum {
 	OPT_ZEROTERM    = IF_FEATURE_XARGS_SUPPORT_ZERO_TERM(   (1 << OPTBIT_ZEROTERM   )) + 0,
 	OPT_REPLSTR     = IF_FEATURE_XARGS_SUPPORT_REPL_STR(    (1 << OPTBIT_REPLSTR    )) + 0,
 	OPT_REPLSTR1    = IF_FEATURE_XARGS_SUPPORT_REPL_STR(    (1 << OPTBIT_REPLSTR1   )) + 0,
+	OPT_GROUP       = IF_FEATURE_XARGS_SUPPORT_GROUP(       (1 << OPTBIT_GROUP      )) + 0,
 };
 #define OPTION_STR "+trn:s:e::E:o" \
 	IF_FEATURE_XARGS_SUPPORT_CONFIRMATION("p") \
@@ -176,9 +215,167 @@ enum {
 	IF_FEATURE_XARGS_SUPPORT_ZERO_TERM(   "0") \
 	IF_FEATURE_XARGS_SUPPORT_REPL_STR(    "I:i::") \
 	IF_FEATURE_XARGS_SUPPORT_PARALLEL(    "P:+") \
-	IF_FEATURE_XARGS_SUPPORT_ARGS_FILE(   "a:")
+	IF_FEATURE_XARGS_SUPPORT_ARGS_FILE(   "a:") \
+	IF_FEATURE_XARGS_SUPPORT_GROUP(       "\xff")
 
 
+#if ENABLE_FEATURE_XARGS_SUPPORT_JOBSERVER
+/* GNU make passes jobserver to its children in MAKEFLAGS:
+ * "--jobserver-auth=R,W" (pipe fds), "--jobserver-auth=fifo:PATH"
+ * (make 4.4+) or "--jobserver-fds=R,W" (make < 4.2).
+ * The last one wins: nested makes append their own.
+ */
+static void xargs_jobserver_init(void)
+{
+	char *p, *s;
+
+	p = getenv("MAKEFLAGS");
+	if (!p)
+		return;
+	s = NULL;
+	while ((p = strstr(p, "--jobserver-")) != NULL) {
+		p += sizeof("--jobserver-")-1;
+		if (is_prefixed_with(p, "auth=") || is_prefixed_with(p, "fds="))
+			s = strchr(p, '=') + 1;
+	}
+	if (!s)
+		return;
+	if (is_prefixed_with(s, "fifo:")) {
+		s = xstrndup(s + 5, strchrnul(s, ' ') - (s + 5));
+		/* O_RDWR: never blocks on open, we both read and write tokens */
+		G.js_rfd = G.js_wfd = open(s, O_RDWR);
+		free(s);
+	} else {
+		int r, w;
+		if (sscanf(s, "%d,%d", &r, &w) == 2
+		/* make closes them for commands not marked with '+' */
+		 && fcntl(r, F_GETFD) >= 0 && fcntl(w, F_GETFD) >= 0
+		) {
+			G.js_rfd = r;
+			G.js_wfd = w;
+		}
+	}
+	if (G.js_rfd >= 0)
+		G.js_tokens = xmalloc(G.max_procs);
+}
+
+/* We have one implicit token, every other running PROG needs one
+ * from the jobserver. Returns 0 if there are none available now.
+ */
+static int xargs_get_token(void)
+{
+	int r;
+
+	if (G.js_rfd < 0 || G.running_procs == 0)
+		return 1;
+	/* Even if the fd is shared with other jobserver clients,
+	 * we must not block: our own finished children hold tokens
+	 * which only we can return.
+	 */
+	ndelay_on(G.js_rfd);
+	r = safe_read(G.js_rfd, &G.js_tokens[G.js_held], 1);
+	ndelay_off(G.js_rfd);
+	if (r != 1)
+		return 0;
+	G.js_held++;
+	return 1;
+}
+
+static void xargs_put_tokens(void)
+{
+	while (G.js_held != 0 && G.js_held >= G.running_procs) {
+		G.js_held--;
+		full_write(G.js_wfd, &G.js_tokens[G.js_held], 1);
+	}
+}
+#else
+# define xargs_jobserver_init() ((void)0)
+# define xargs_get_token() 1
+# define xargs_put_tokens() ((void)0)
+#endif
+
+#if ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL
+static pid_t xargs_spawn(void)
+{
+	pid_t pid;
+# if ENABLE_FEATURE_PREFER_APPLETS && BB_MMU && (NUM_APPLETS > 1)
+	int a;
+# endif
+	IF_FEATURE_XARGS_SUPPORT_GROUP(struct xargs_job *job = NULL;)
+	IF_FEATURE_XARGS_SUPPORT_GROUP(int saved_stdout = -1;)
+
+# if ENABLE_FEATURE_XARGS_SUPPORT_GROUP
+	if (G.jobs) {
+		job = G.jobs;
+		while (job->pid > 0)
+			job++;
+		if (job->pid < 0) /* end marker: no free slot, don't group */
+			job = NULL;
+	}
+	if (job) {
+		char *name;
+		const char *tmpdir;
+
+		tmpdir = getenv("TMPDIR");
+		name = concat_path_file(tmpdir ? tmpdir : "/tmp", "xargs.XXXXXX");
+		job->out_fd = xmkstemp(name);
+		unlink(name);
+		free(name);
+		close_on_exec_on(job->out_fd);
+		/* spawn() can't redirect child's stdout, do it around it */
+		fflush_all();
+		saved_stdout = dup(STDOUT_FILENO);
+		close_on_exec_on(saved_stdout);
+		xdup2(job->out_fd, STDOUT_FILENO);
+	}
+# endif
+# if ENABLE_FEATURE_PREFER_APPLETS && BB_MMU && (NUM_APPLETS > 1)
+	a = find_applet_by_name(G.args[0]);
+	if (a >= 0 && APPLET_IS_NOEXEC(a)) {
+		fflush_all();
+		pid = fork();
+		if (pid == 0)
+			run_noexec_applet_and_exit(a, G.args[0], G.args);
+	} else
+# endif
+		pid = spawn(G.args);
+# if ENABLE_FEATURE_XARGS_SUPPORT_GROUP
+	if (job) {
+		xmove_fd(saved_stdout, STDOUT_FILENO);
+		if (pid > 0)
+			job->pid = pid;
+		else
+			close(job->out_fd);
+	}
+# endif
+	return pid;
+}
+#endif
+
+#if ENABLE_FEATURE_XARGS_SUPPORT_GROUP
+/* Returns 0 if pid is not a child we started with --group */
+static int xargs_flush_job(pid_t pid)
+{
+	struct xargs_job *job;
+
+	if (!G.jobs)
+		return 1;
+	for (job = G.jobs; job->pid != -1; job++) {
+		if (job->pid == pid) {
+			job->pid = 0;
+			xlseek(job->out_fd, 0, SEEK_SET);
+			fflush_all();
+			bb_copyfd_eof(job->out_fd, STDOUT_FILENO);
+			close(job->out_fd);
+			return 1;
+		}
+	}
+	return 0;
+}
+#else
+# define xargs_flush_job(pid) 1
+#endif
+
 /*
  * Returns 0 if xargs should continue (but may set G.xargs_exitcode to 123).
  * Else sets G.xargs_exitcode to error code and returns nonzero.
@@ -205,13 +402,20 @@ static int xargs_exec(void)
 			pid = safe_waitpid(-1, &wstat, 0);
 		else
 			pid = wait_any_nohang(&wstat);
+		if (pid <= 0 && G.max_procs != 0 && !xargs_get_token()) {
+			/* Jobserver has no free tokens, wait until
+			 * one of our children finishes and frees one */
+			pid = safe_waitpid(-1, &wstat, 0);
+		}
 		if (pid > 0) {
 			/* We may have children we don't know about:
 			 * sh -c 'sleep 1 & exec xargs ...'
 			 * Do not make G.running_procs go negative.
+			 * With --group, only our own jobs free a slot.
 			 */
-			if (G.running_procs != 0)
+			if (xargs_flush_job(pid) && G.running_procs != 0)
 				G.running_procs--;
+			xargs_put_tokens();
 			status = WIFSIGNALED(wstat)
 				? 0x180 + WTERMSIG(wstat)
 				: WEXITSTATUS(wstat);
@@ -227,13 +431,25 @@ static int xargs_exec(void)
 			/* Not in final waitpid() loop,
 			 * and G.running_procs < G.max_procs: start more procs
 			 */
-			status = spawn(G.args);
-			/* here "status" actually holds pid, or -1 */
-			if (status > 0) {
-				G.running_procs++;
-				status = 0;
+# if ENABLE_FEATURE_PREFER_APPLETS && (NUM_APPLETS > 1)
+			int a = find_applet_by_name(G.args[0]);
+			if (a >= 0 && APPLET_IS_NOFORK(a)) {
+				/* Not worth a fork: run it right now, in-process.
+				 * Its output can't mix with grouped output of others.
+				 */
+				status = run_nofork_applet(a, G.args);
+			} else
+# endif
+			{
+				status = xargs_spawn();
+				/* here "status" actually holds pid, or -1 */
+				if (status > 0) {
+					G.running_procs++;
+					status = 0;
+				}
+				/* else: status == -1 (failed to fork or exec) */
 			}
-			/* else: status == -1 (failed to fork or exec) */
+			xargs_put_tokens();
 		} else {
 			/* final waitpid() loop: must be ECHILD "no more children" */
 			status = 0;
@@ -600,6 +816,9 @@ static int xargs_ask_confirmation(void)
 //usage:	IF_FEATURE_XARGS_SUPPORT_PARALLEL(
 //usage:     "\n	-P N	Run up to N PROGs in parallel"
 //usage:	)
+//usage:	IF_FEATURE_XARGS_SUPPORT_GROUP(
+//usage:     "\n	--group	Don't mix output of parallel PROGs"
+//usage:	)
 //usage:	IF_FEATURE_XARGS_SUPPORT_TERMOPT(
 //usage:     "\n	-x	Exit if size is exceeded"
 //usage:	)
@@ -629,7 +848,8 @@ int xargs_main(int argc UNUSED_PARAM, char **argv)
 	INIT_G();
 
 	opt = getopt32long(argv, OPTION_STR,
-		"no-run-if-empty\0" No_argument "r",
+		"no-run-if-empty\0" No_argument "r"
+		IF_FEATURE_XARGS_SUPPORT_GROUP("group\0" No_argument "\xff"),
 		&max_args, &max_chars, &G.eof_str, &G.eof_str
 		IF_FEATURE_XARGS_SUPPORT_REPL_STR(, &G.repl_str, &G.repl_str)
 		IF_FEATURE_XARGS_SUPPORT_PARALLEL(, &G.max_procs)
@@ -639,6 +859,15 @@ int xargs_main(int argc UNUSED_PARAM, char **argv)
 #if ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL
 	if (G.max_procs <= 0) /* -P0 means "run lots of them" */
 		G.max_procs = 100; /* let's not go crazy high */
+	if (G.max_procs > 1) {
+# if ENABLE_FEATURE_XARGS_SUPPORT_GROUP
+		if (opt & OPT_GROUP) {
+			G.jobs = xzalloc(sizeof(G.jobs[0]) * (G.max_procs + 1));
+			G.jobs[G.max_procs].pid = -1; /* end marker */
+		}
+# endif
+		xargs_jobserver_init();
+	}
 #endif
 
 #if ENABLE_FEATURE_XARGS_SUPPORT_ARGS_FILE
@@ -786,6 +1015,10 @@ int xargs_main(int argc UNUSED_PARAM, char **argv)
 #if ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL
 	G.max_procs = 0;
 	xargs_exec(); /* final waitpid() loop */
+# if ENABLE_FEATURE_CLEAN_UP
+	IF_FEATURE_XARGS_SUPPORT_GROUP(free(G.jobs);)
+	IF_FEATURE_XARGS_SUPPORT_JOBSERVER(if (G.js_rfd >= 0) free(G.js_tokens);)
+# endif
 #endif
 
 	return G.xargs_exitcode;
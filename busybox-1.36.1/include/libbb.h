@@ -839,7 +839,7 @@ struct tls_aes {
 };
 #define TLS_MAX_MAC_SIZE 32
 #define TLS_MAX_KEY_SIZE 32
-#define TLS_MAX_IV_SIZE   4
+#define TLS_MAX_IV_SIZE  12
 struct tls_handshake_data; /* opaque */
 typedef struct tls_state {
 	unsigned flags;
@@ -870,7 +870,7 @@ typedef struct tls_state {
 	//   number MUST be set to zero whenever a connection state is made the
 	//   active state.  Sequence numbers are of type uint64 and may not
 	//   exceed 2^64-1.
-	/*uint64_t read_seq64_be;*/
+	uint64_t read_seq64_be;
 	uint64_t write_seq64_be;
 
 	/*uint8_t *server_write_MAC_key;*/
@@ -2189,6 +2189,10 @@
        "Compare files line by line and output the differences between them.\n" \
        "This implementation supports unified diffs only.\n" \
      "\n	-a	Treat all files as text" \
+	IF_FEATURE_DIFF_MYERS( \
+     "\n	--algorithm=myers|minimal|stone" \
+     "\n		Diff algorithm (default stone)" \
+	) \
      "\n	-b	Ignore changes in the amount of whitespace" \
      "\n	-B	Ignore changes whose lines are all blank" \
      "\n	-d	Try hard to find a smaller set of changes" \
@@ -2459,6 +2463,9 @@
      "\n	-s N	Pass command line of no more than N bytes" \
 	IF_FEATURE_XARGS_SUPPORT_PARALLEL( \
      "\n	-P N	Run up to N PROGs in parallel" \
+	) \
+	IF_FEATURE_XARGS_SUPPORT_GROUP( \
+     "\n	--group	Don't mix output of parallel PROGs" \
 	) \
 	IF_FEATURE_XARGS_SUPPORT_TERMOPT( \
      "\n	-x	Exit if size is exceeded" \
@@ -4000,6 +4007,7 @@
        " [-p [IP:]PORT]" \
 	IF_FEATURE_HTTPD_SETUID(" [-u USER[:GRP]]") \
 	IF_FEATURE_HTTPD_BASIC_AUTH(" [-r REALM]") \
+	IF_FEATURE_HTTPD_GZIP_CACHE(" [-z DIR]") \
        " [-h HOME]\n" \
        "or httpd -d/-e" IF_FEATURE_HTTPD_AUTH_MD5("/-m") " STRING" \
 
@@ -4015,6 +4023,8 @@
      "\n	-r REALM	Authentication Realm for Basic Authentication") \
      "\n	-h HOME		Home directory (default .)" \
      "\n	-c FILE		Configuration file (default {/etc,HOME}/httpd.conf)" \
+	IF_FEATURE_HTTPD_GZIP_CACHE( \
+     "\n	-z DIR		Gzip text files on the fly, cache results in DIR") \
 	IF_FEATURE_HTTPD_AUTH_MD5( \
      "\n	-m STRING	MD5 crypt STRING") \
      "\n	-e STRING	HTML encode STRING" \
@@ -4836,11 +4846,11 @@
 #define wget_trivial_usage \
 	IF_FEATURE_WGET_LONG_OPTIONS( \
        "[-cqS] [--spider] [-O FILE] [-o LOGFILE] [--header STR]\n" \
-       "	[--post-data STR | --post-file FILE] [-Y on/off]\n" \
-       "	"IF_FEATURE_WGET_OPENSSL("[--no-check-certificate] ")"[-P DIR] [-U AGENT]"IF_FEATURE_WGET_TIMEOUT(" [-T SEC]")" URL..." \
+       "	[--post-data STR | --post-file FILE] [-Y on/off]"IF_FEATURE_WGET_SEGMENTS(" [--segments N]")"\n" \
+       "	"IF_FEATURE_WGET_OPENSSL("[--no-check-certificate] ")"[-P DIR] [-U AGENT]"IF_FEATURE_WGET_TIMEOUT(" [-T SEC]")" [-i FILE] [URL]..." \
 	) \
 	IF_NOT_FEATURE_WGET_LONG_OPTIONS( \
-       "[-cqS] [-O FILE] [-o LOGFILE] [-Y on/off] [-P DIR] [-U AGENT]"IF_FEATURE_WGET_TIMEOUT(" [-T SEC]")" URL..." \
+       "[-cqS] [-O FILE] [-o LOGFILE] [-Y on/off] [-P DIR] [-U AGENT]"IF_FEATURE_WGET_TIMEOUT(" [-T SEC]")" [-i FILE] [URL]..." \
 	) \
 
 #define wget_full_usage "\n\n" \
@@ -4850,6 +4860,9 @@
      "\n	--header STR	Add STR (of form 'header: value') to headers" \
      "\n	--post-data STR	Send STR using POST method" \
      "\n	--post-file FILE	Send FILE using POST method" \
+	IF_FEATURE_WGET_SEGMENTS( \
+     "\n	--segments N	Download using N connections in parallel" \
+	) \
 	IF_FEATURE_WGET_OPENSSL( \
      "\n	--no-check-certificate	Don't validate the server's certificate" \
 	) \
@@ -4863,6 +4876,7 @@
 	) \
      "\n	-O FILE		Save to FILE ('-' for stdout)" \
      "\n	-o LOGFILE	Log messages to FILE" \
+     "\n	-i FILE		Download URLs listed in FILE ('-' for stdin)" \
      "\n	-U STR		Use STR for User-Agent header" \
      "\n	-Y on/off	Use proxy" \
 
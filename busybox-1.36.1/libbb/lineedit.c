@@ -829,6 +829,115 @@ static unsigned path_parse(char ***p)
 	return npth + 1;
 }
 
+# if ENABLE_FEATURE_TAB_COMPLETION_CACHE
+/* Sorted listings of directories we completed in, most recently
+ * used first. A listing is valid while directory's mtime is the same
+ * and is older than the time the listing was read (otherwise
+ * the directory could change again within the same second).
+ */
+struct dir_listing {
+	struct dir_listing *next;
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	time_t read_time;
+	char *blob;
+	unsigned cnt;
+	char *names[];
+};
+static struct dir_listing *dir_listings;
+#  define MAX_DIR_LISTINGS 64
+
+static struct dir_listing *get_dir_listing(const char *lpath)
+{
+	struct dir_listing **pp, *dl;
+	struct dirent *next;
+	struct stat st;
+	DIR *dir;
+	char *blob, *p;
+	size_t len, size;
+	unsigned cnt;
+	time_t now;
+
+	if (stat(lpath, &st) != 0)
+		return NULL;
+
+	for (pp = &dir_listings; (dl = *pp) != NULL; pp = &dl->next) {
+		if (dl->dev == st.st_dev && dl->ino == st.st_ino) {
+			*pp = dl->next;
+			if (dl->mtime == st.st_mtime && dl->mtime < dl->read_time)
+				goto found;
+			free(dl->blob);
+			free(dl);
+			break;
+		}
+	}
+
+	now = time(NULL);
+	dir = opendir(lpath);
+	if (!dir)
+		return NULL;
+	blob = NULL;
+	len = size = 0;
+	cnt = 0;
+	while ((next = readdir(dir)) != NULL) {
+		size_t l = strlen(next->d_name) + 1;
+		if (len + l > size) {
+			size = (len + l) * 2 + 256;
+			blob = xrealloc(blob, size);
+		}
+		memcpy(blob + len, next->d_name, l);
+		len += l;
+		cnt++;
+	}
+	closedir(dir);
+
+	dl = xmalloc(sizeof(*dl) + cnt * sizeof(dl->names[0]));
+	dl->dev = st.st_dev;
+	dl->ino = st.st_ino;
+	dl->mtime = st.st_mtime;
+	dl->read_time = now;
+	dl->blob = blob;
+	dl->cnt = cnt;
+	p = blob;
+	for (cnt = 0; cnt < dl->cnt; cnt++) {
+		dl->names[cnt] = p;
+		p += strlen(p) + 1;
+	}
+	qsort_string_vector(dl->names, dl->cnt);
+ found:
+	dl->next = dir_listings;
+	dir_listings = dl;
+
+	/* forget least recently used ones */
+	cnt = 0;
+	for (pp = &dir_listings; (dl = *pp) != NULL; pp = &dl->next) {
+		if (++cnt > MAX_DIR_LISTINGS) {
+			*pp = dl->next;
+			free(dl->blob);
+			free(dl);
+			break;
+		}
+	}
+	return dir_listings;
+}
+
+/* Index of the first name in dl which is >= prefix */
+static unsigned dir_listing_lower_bound(struct dir_listing *dl,
+		const char *prefix, unsigned prefix_len)
+{
+	unsigned lo = 0, hi = dl->cnt;
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (strncmp(dl->names[mid], prefix, prefix_len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+# endif
+
 /* Complete command, directory or file name.
  * Return the length of the prefix used for matching.
  */
@@ -888,8 +997,13 @@ static NOINLINE unsigned complete_cmd_dir_file(const char *command, int type)
 	}
 
 	for (i = 0; i < npaths; i++) {
+# if ENABLE_FEATURE_TAB_COMPLETION_CACHE
+		struct dir_listing *dl;
+		unsigned j;
+# else
 		DIR *dir;
 		struct dirent *next;
+# endif
 		struct stat st;
 		char *found;
 		const char *lpath;
@@ -903,6 +1017,23 @@ static NOINLINE unsigned complete_cmd_dir_file(const char *command, int type)
 		}
 
 		lpath = *paths[i] ? paths[i] : ".";
+# if ENABLE_FEATURE_TAB_COMPLETION_CACHE
+		dl = get_dir_listing(lpath);
+		if (!dl)
+			continue; /* don't print an error */
+
+		/* names are sorted: matches are a contiguous run */
+		for (j = dir_listing_lower_bound(dl, basecmd, baselen); j < dl->cnt; j++) {
+			unsigned len;
+			const char *name_found = dl->names[j];
+
+			/* match? */
+			if (strncmp(basecmd, name_found, baselen) != 0)
+				break; /* no, and no more */
+			/* .../<tab>: bash 3.2.0 shows dotfiles, but not . and .. */
+			if (!basecmd[0] && DOT_OR_DOTDOT(name_found))
+				continue;
+# else
 		dir = opendir(lpath);
 		if (!dir)
 			continue; /* don't print an error */
@@ -917,6 +1048,7 @@ static NOINLINE unsigned complete_cmd_dir_file(const char *command, int type)
 			/* match? */
 			if (strncmp(basecmd, name_found, baselen) != 0)
 				continue; /* no */
+# endif
 
 			found = concat_path_file(lpath, name_found);
 			/* NB: stat() first so that we see is it a directory;
@@ -948,7 +1080,9 @@ static NOINLINE unsigned complete_cmd_dir_file(const char *command, int type)
  cont:
 			free(found);
 		}
+# if !ENABLE_FEATURE_TAB_COMPLETION_CACHE
 		closedir(dir);
+# endif
 	} /* for every path */
 
 	if (paths != path1) {
@@ -1489,66 +1623,89 @@ void FAST_FUNC free_line_input_t(line_input_t *n)
 /* state->flags is already checked to be nonzero */
 static void load_history(line_input_t *st_parm)
 {
-	char *temp_h[MAX_HISTORY];
-	char *line;
-	FILE *fp;
-	unsigned idx, i, line_len;
+	struct stat sb;
+	char *buf, *s, *e;
+	size_t size;
+	unsigned idx, cnt;
+	int fd;
 
 	/* NB: do not trash old history if file can't be opened */
 
-	fp = fopen_for_read(st_parm->hist_file);
-	if (fp) {
-		/* clean up old history */
-		for (idx = st_parm->cnt_history; idx > 0;) {
-			idx--;
-			free(st_parm->history[idx]);
-			st_parm->history[idx] = NULL;
-		}
+	fd = open(st_parm->hist_file, O_RDONLY);
+	if (fd < 0)
+		return;
+	/* Map the file instead of reading it line by line:
+	 * we only need its last max_history non-empty lines,
+	 * and with a large file most of the rest is never touched.
+	 */
+	buf = NULL;
+	size = 0;
+	if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode)
+	 && sb.st_size > 0 && sb.st_size <= INT_MAX - 4095
+	) {
+		size = sb.st_size;
+		buf = mmap_read(fd, size);
+		if (buf == MAP_FAILED)
+			buf = NULL;
+	}
+	if (!buf) {
+		size = INT_MAX - 4095;
+		buf = xmalloc_read(fd, &size);
+		sb.st_size = 0; /* not mapped */
+	}
+	close(fd);
+	if (!buf)
+		return;
 
-		/* fill temp_h[], retaining only last MAX_HISTORY lines */
-		memset(temp_h, 0, sizeof(temp_h));
-		idx = 0;
-		st_parm->cnt_history_in_file = 0;
-		while ((line = xmalloc_fgetline(fp)) != NULL) {
-			if (line[0] == '\0') {
-				free(line);
-				continue;
-			}
-			free(temp_h[idx]);
-			temp_h[idx] = line;
-			st_parm->cnt_history_in_file++;
-			idx++;
-			if (idx == st_parm->max_history)
-				idx = 0;
-		}
-		fclose(fp);
+	/* clean up old history */
+	for (idx = st_parm->cnt_history; idx > 0;) {
+		idx--;
+		free(st_parm->history[idx]);
+		st_parm->history[idx] = NULL;
+	}
 
-		/* find first non-NULL temp_h[], if any */
-		if (st_parm->cnt_history_in_file) {
-			while (temp_h[idx] == NULL) {
-				idx++;
-				if (idx == st_parm->max_history)
-					idx = 0;
-			}
+	/* walk lines back from the end of file, filling history[] backwards */
+	idx = st_parm->max_history;
+	e = buf + size;
+	if (e != buf && e[-1] == '\n')
+		e--;
+	for (;;) {
+		s = memrchr(buf, '\n', e - buf);
+		s = s ? s + 1 : buf;
+		if (s != e) {
+			if (idx == 0)
+				break;
+			st_parm->history[--idx] = xstrndup(s,
+				e - s < MAX_LINELEN ? e - s : MAX_LINELEN - 1);
+		}
+		if (s == buf) {
+			e = buf;
+			break;
 		}
+		e = s - 1;
+	}
+	cnt = st_parm->max_history - idx;
+	memmove(st_parm->history, st_parm->history + idx, cnt * sizeof(st_parm->history[0]));
+	memset(st_parm->history + cnt, 0, idx * sizeof(st_parm->history[0]));
+	st_parm->cnt_history = cnt;
 
-		/* copy temp_h[] to st_parm->history[] */
-		for (i = 0; i < st_parm->max_history;) {
-			line = temp_h[idx];
-			if (!line)
+	if (!ENABLE_FEATURE_EDITING_SAVE_ON_EXIT && idx == 0) {
+		/* count the older non-empty lines we did not keep */
+		for (s = buf; s != e; s++) {
+			if (*s == '\n')
+				continue;
+			cnt++;
+			s = memchr(s, '\n', e - s);
+			if (!s)
 				break;
-			idx++;
-			if (idx == st_parm->max_history)
-				idx = 0;
-			line_len = strlen(line);
-			if (line_len >= MAX_LINELEN)
-				line[MAX_LINELEN-1] = '\0';
-			st_parm->history[i++] = line;
 		}
-		st_parm->cnt_history = i;
-		if (ENABLE_FEATURE_EDITING_SAVE_ON_EXIT)
-			st_parm->cnt_history_in_file = i;
 	}
+	st_parm->cnt_history_in_file = cnt;
+
+	if (sb.st_size)
+		munmap(buf, size);
+	else
+		free(buf);
 }
 
 #  if ENABLE_FEATURE_EDITING_SAVE_ON_EXIT
@@ -276,7 +276,13 @@ typedef struct BcNum {
 #define BC_NUM_DEF_SIZE         16
 #define BC_NUM_PRINT_WIDTH      70
 
-#define BC_NUM_KARATSUBA_LEN    32
+// Multiplication and division work on base 10^9 "limbs",
+// not on single decimal digits:
+typedef uint32_t BcLimb;
+#define BC_LIMB_DIGITS          9
+#define BC_LIMB_BASE            1000000000
+// below this many limbs, schoolbook multiplication is faster:
+#define BC_NUM_KARATSUBA_LEN    24
 
 typedef enum BcInst {
 #if ENABLE_BC
@@ -1591,25 +1597,6 @@ static void bc_num_retireMul(BcNum *n, size_t scale, bool neg1, bool neg2)
 	if (n->len != 0) n->neg = !neg1 != !neg2;
 }
 
-static void bc_num_split(BcNum *restrict n, size_t idx, BcNum *restrict a,
-                         BcNum *restrict b)
-{
-	if (idx < n->len) {
-		b->len = n->len - idx;
-		a->len = idx;
-		a->rdx = b->rdx = 0;
-
-		memcpy(b->num, n->num + idx, b->len * sizeof(BcDig));
-		memcpy(a->num, n->num, idx * sizeof(BcDig));
-	} else {
-		bc_num_zero(b);
-		bc_num_copy(a, n);
-	}
-
-	bc_num_clean(a);
-	bc_num_clean(b);
-}
-
 static BC_STATUS zbc_num_shift(BcNum *n, size_t places)
 {
 	if (places == 0 || n->len == 0) RETURN_STATUS(BC_STATUS_SUCCESS);
@@ -1871,13 +1858,176 @@ static FAST_FUNC BC_STATUS zbc_num_s(BcNum *a, BcNum *b, BcNum *restrict c, size
 	RETURN_STATUS(BC_STATUS_SUCCESS); // can't make void, see zbc_num_binary()
 }
 
+// Pack decimal digits (least significant first) into limbs.
+// Returns number of limbs, without leading zero limbs.
+static size_t bc_limbs_from_digits(BcLimb *l, const BcDig *n, size_t len)
+{
+	size_t i, nl;
+
+	nl = (len + BC_LIMB_DIGITS - 1) / BC_LIMB_DIGITS;
+	for (i = 0; i < nl; i++) {
+		size_t j = i * BC_LIMB_DIGITS;
+		size_t end = BC_MIN(j + BC_LIMB_DIGITS, len);
+		BcLimb v = 0;
+		while (end > j)
+			v = v * 10 + n[--end];
+		l[i] = v;
+	}
+	while (nl != 0 && l[nl - 1] == 0)
+		nl--;
+	return nl;
+}
+
+// Unpack limbs into exactly len decimal digits (zero-padded)
+static void bc_limbs_to_digits(BcDig *n, size_t len, const BcLimb *l, size_t nl)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		size_t k = i / BC_LIMB_DIGITS;
+		BcLimb v;
+		if (k >= nl) {
+			memset(n + i, 0, (len - i) * sizeof(BcDig));
+			break;
+		}
+		v = l[k];
+		do {
+			n[i] = v % 10;
+			v /= 10;
+		} while ((++i % BC_LIMB_DIGITS) != 0 && i < len);
+		i--;
+	}
+}
+
+// r[0..n] = a[0..an) + b[0..bn), an >= bn. Returns length of r.
+static size_t bc_limbs_add(BcLimb *r, const BcLimb *a, size_t an,
+		const BcLimb *b, size_t bn)
+{
+	BcLimb carry = 0;
+	size_t i;
+
+	for (i = 0; i < an; i++) {
+		BcLimb v = a[i] + carry + (i < bn ? b[i] : 0);
+		carry = (v >= BC_LIMB_BASE);
+		r[i] = carry ? v - BC_LIMB_BASE : v;
+	}
+	r[i] = carry;
+	return an + carry;
+}
+
+// a[0..an) += b[0..bn), caller guarantees no overflow past a[an-1]
+static void bc_limbs_add_to(BcLimb *a, size_t an, const BcLimb *b, size_t bn)
+{
+	BcLimb carry = 0;
+	size_t i;
+
+	for (i = 0; i < an && (i < bn || carry); i++) {
+		BcLimb v = a[i] + carry + (i < bn ? b[i] : 0);
+		carry = (v >= BC_LIMB_BASE);
+		a[i] = carry ? v - BC_LIMB_BASE : v;
+	}
+}
+
+// a[0..an) -= b[0..bn), a >= b
+static void bc_limbs_sub_from(BcLimb *a, size_t an, const BcLimb *b, size_t bn)
+{
+	BcLimb borrow = 0;
+	size_t i;
+
+	for (i = 0; i < an && (i < bn || borrow); i++) {
+		BcLimb sub = borrow + (i < bn ? b[i] : 0);
+		borrow = (a[i] < sub);
+		a[i] = a[i] + (borrow ? BC_LIMB_BASE : 0) - sub;
+	}
+}
+
+// r[0..an+bn) = a * b. r must not overlap a or b.
+static void bc_limbs_mul(BcLimb *r, const BcLimb *a, size_t an,
+		const BcLimb *b, size_t bn)
+{
+	size_t i, j, h;
+	BcLimb *t;
+
+	if (an < bn) {
+		const BcLimb *tp = a; a = b; b = tp;
+		i = an; an = bn; bn = i;
+	}
+	memset(r, 0, (an + bn) * sizeof(r[0]));
+	if (bn == 0)
+		return;
+
+	if (bn < BC_NUM_KARATSUBA_LEN) {
+		for (i = 0; i < bn; i++) {
+			uint64_t carry = 0;
+			uint64_t bi = b[i];
+			if (bi == 0)
+				continue;
+			for (j = 0; j < an; j++) {
+				uint64_t v = a[j] * bi + r[i + j] + carry;
+				carry = v / BC_LIMB_BASE;
+				r[i + j] = (BcLimb)(v - carry * BC_LIMB_BASE);
+			}
+			r[i + an] = (BcLimb)carry;
+#if ENABLE_FEATURE_BC_INTERACTIVE
+			// a=2^1000000
+			// a*a <- without check below, this will not be interruptible
+			if (G_interrupt) return;
+#endif
+		}
+		return;
+	}
+
+	if (bn * 2 <= an) {
+		// Unbalanced: multiply a by b in bn-sized slices
+		t = xmalloc(2 * bn * sizeof(t[0]));
+		for (i = 0; i < an; i += bn) {
+			size_t n = BC_MIN(bn, an - i);
+			bc_limbs_mul(t, a + i, n, b, bn);
+			bc_limbs_add_to(r + i, an + bn - i, t, n + bn);
+		}
+		free(t);
+		return;
+	}
+
+	// Karatsuba: a = a1*B^h + a0, b = b1*B^h + b0,
+	// a*b = z2*B^2h + (z1 - z2 - z0)*B^h + z0,
+	// z2 = a1*b1, z0 = a0*b0, z1 = (a1+a0)*(b1+b0)
+	h = (an + 1) / 2;
+	{
+		size_t sa, sb, an1 = an - h, bn1 = bn - h;
+		// sum_a: an1+1 (<= h+1), sum_b: h+1, z1: 2h+2, z0: 2h, z2: an1+bn1
+		t = xmalloc((6 * h + 4 + an1 + bn1) * sizeof(t[0]));
+#define sum_a (t)
+#define sum_b (t + h + 1)
+#define z1    (t + 2 * h + 2)
+#define z0    (t + 4 * h + 4)
+#define z2    (t + 6 * h + 4)
+		sa = bc_limbs_add(sum_a, a, h, a + h, an1);
+		sb = bc_limbs_add(sum_b, b, h, b + h, bn1);
+		bc_limbs_mul(z1, sum_a, sa, sum_b, sb);
+		bc_limbs_mul(z0, a, h, b, h);
+		bc_limbs_mul(z2, a + h, an1, b + h, bn1);
+		bc_limbs_sub_from(z1, sa + sb, z0, 2 * h);
+		bc_limbs_sub_from(z1, sa + sb, z2, an1 + bn1);
+		memcpy(r, z0, 2 * h * sizeof(r[0]));
+		memcpy(r + 2 * h, z2, (an1 + bn1) * sizeof(r[0]));
+		bc_limbs_add_to(r + h, an + bn - h, z1, BC_MIN(sa + sb, an + bn - h));
+#undef sum_a
+#undef sum_b
+#undef z1
+#undef z0
+#undef z2
+		free(t);
+	}
+}
+
 static FAST_FUNC BC_STATUS zbc_num_k(BcNum *restrict a, BcNum *restrict b,
                          BcNum *restrict c)
 #define zbc_num_k(...) (zbc_num_k(__VA_ARGS__) COMMA_SUCCESS)
 {
-	BcStatus s;
-	size_t max, max2;
-	BcNum l1, h1, l2, h2, m2, m1, z0, z1, z2, temp;
+	BcLimb small[4 * BC_NUM_KARATSUBA_LEN];
+	BcLimb *la, *lb, *lc;
+	size_t an, bn;
 	bool aone;
 
 	if (a->len == 0 || b->len == 0) {
@@ -1890,94 +2040,130 @@ static FAST_FUNC BC_STATUS zbc_num_k(BcNum *restrict a, BcNum *restrict b,
 		RETURN_STATUS(BC_STATUS_SUCCESS);
 	}
 
-	if (a->len < BC_NUM_KARATSUBA_LEN
-	 || b->len < BC_NUM_KARATSUBA_LEN
-	/* || a->len + b->len < BC_NUM_KARATSUBA_LEN - redundant check */
-	) {
-		size_t i, j, len;
-
-		bc_num_expand(c, a->len + b->len + 1);
-
-		memset(c->num, 0, sizeof(BcDig) * c->cap);
-		c->len = len = 0;
-
-		for (i = 0; i < b->len; ++i) {
-			unsigned carry = 0;
-			for (j = 0; j < a->len; ++j) {
-				unsigned in = c->num[i + j];
-				in += (unsigned)a->num[j] * (unsigned)b->num[i] + carry;
-				// note: compilers prefer _unsigned_ div/const
-				carry = in / 10;
-				c->num[i + j] = (BcDig)(in % 10);
-			}
-
-			c->num[i + j] += (BcDig) carry;
-			len = BC_MAX(len, i + j + !!carry);
+	an = (a->len + BC_LIMB_DIGITS - 1) / BC_LIMB_DIGITS;
+	bn = (b->len + BC_LIMB_DIGITS - 1) / BC_LIMB_DIGITS;
+	// Operands of loop counters and the like are a few limbs long,
+	// don't go to malloc for them
+	la = small;
+	if (2 * (an + bn) > ARRAY_SIZE(small))
+		la = xmalloc(2 * (an + bn) * sizeof(la[0]));
+	lb = la + an;
+	lc = lb + bn;
+	an = bc_limbs_from_digits(la, a->num, a->len);
+	bn = bc_limbs_from_digits(lb, b->num, b->len);
+	bc_limbs_mul(lc, la, an, lb, bn);
+
+	bc_num_expand(c, a->len + b->len + 1);
+	memset(c->num, 0, sizeof(BcDig) * c->cap);
+	c->len = a->len + b->len;
+	bc_limbs_to_digits(c->num, c->len, lc, an + bn);
+	while (c->len != 0 && c->num[c->len - 1] == 0)
+		c->len--;
+	if (la != small)
+		free(la);
 
 #if ENABLE_FEATURE_BC_INTERACTIVE
-			// a=2^1000000
-			// a*a <- without check below, this will not be interruptible
-			if (G_interrupt) return BC_STATUS_FAILURE;
+	if (G_interrupt) return BC_STATUS_FAILURE;
 #endif
-		}
+	RETURN_STATUS(BC_STATUS_SUCCESS);
+}
 
-		c->len = len;
+// q[0..un-vn] = u[0..un) / v[0..vn), v[vn-1] != 0, un >= vn.
+// Knuth's algorithm D. u must have room for un+1 limbs, it is destroyed.
+static void bc_limbs_div(BcLimb *q, BcLimb *u, size_t un, BcLimb *v, size_t vn)
+{
+	BcLimb d;
+	size_t i, j;
 
-		RETURN_STATUS(BC_STATUS_SUCCESS);
+	if (vn == 1) {
+		uint64_t rem = 0;
+		for (j = un; j-- != 0;) {
+			uint64_t cur = rem * BC_LIMB_BASE + u[j];
+			q[j] = (BcLimb)(cur / v[0]);
+			rem = cur % v[0];
+		}
+		return;
 	}
 
-	max = BC_MAX(a->len, b->len);
-	bc_num_init(&l1, max);
-	bc_num_init(&h1, max);
-	bc_num_init(&l2, max);
-	bc_num_init(&h2, max);
-	bc_num_init(&m1, max);
-	bc_num_init(&m2, max);
-	bc_num_init(&z0, max);
-	bc_num_init(&z1, max);
-	bc_num_init(&z2, max);
-	bc_num_init(&temp, max + max);
-
-	max2 = (max + 1) / 2;
-	bc_num_split(a, max2, &l1, &h1);
-	bc_num_split(b, max2, &l2, &h2);
-
-	s = zbc_num_add(&h1, &l1, &m1, 0);
-	if (s) goto err;
-	s = zbc_num_add(&h2, &l2, &m2, 0);
-	if (s) goto err;
+	// Normalize: make v's top limb >= BASE/2
+	d = BC_LIMB_BASE / ((uint64_t)v[vn - 1] + 1);
+	u[un] = 0;
+	if (d != 1) {
+		uint64_t carry = 0;
+		for (i = 0; i < un; i++) {
+			uint64_t x = (uint64_t)u[i] * d + carry;
+			carry = x / BC_LIMB_BASE;
+			u[i] = (BcLimb)(x - carry * BC_LIMB_BASE);
+		}
+		u[un] = (BcLimb)carry;
+		carry = 0;
+		for (i = 0; i < vn; i++) {
+			uint64_t x = (uint64_t)v[i] * d + carry;
+			carry = x / BC_LIMB_BASE;
+			v[i] = (BcLimb)(x - carry * BC_LIMB_BASE);
+		}
+	}
 
-	s = zbc_num_k(&h1, &h2, &z0);
-	if (s) goto err;
-	s = zbc_num_k(&m1, &m2, &z1);
-	if (s) goto err;
-	s = zbc_num_k(&l1, &l2, &z2);
-	if (s) goto err;
+	for (j = un - vn + 1; j-- != 0;) {
+		uint64_t num, qhat, rhat;
+		int64_t borrow;
+		uint64_t carry;
 
-	s = zbc_num_sub(&z1, &z0, &temp, 0);
-	if (s) goto err;
-	s = zbc_num_sub(&temp, &z2, &z1, 0);
-	if (s) goto err;
+		num = (uint64_t)u[j + vn] * BC_LIMB_BASE + u[j + vn - 1];
+		qhat = num / v[vn - 1];
+		rhat = num % v[vn - 1];
+		while (qhat >= BC_LIMB_BASE
+		 || qhat * v[vn - 2] > rhat * BC_LIMB_BASE + u[j + vn - 2]
+		) {
+			qhat--;
+			rhat += v[vn - 1];
+			if (rhat >= BC_LIMB_BASE)
+				break;
+		}
 
-	s = zbc_num_shift(&z0, max2 * 2);
-	if (s) goto err;
-	s = zbc_num_shift(&z1, max2);
-	if (s) goto err;
-	s = zbc_num_add(&z0, &z1, &temp, 0);
-	if (s) goto err;
-	s = zbc_num_add(&temp, &z2, c, 0);
- err:
-	bc_num_free(&temp);
-	bc_num_free(&z2);
-	bc_num_free(&z1);
-	bc_num_free(&z0);
-	bc_num_free(&m2);
-	bc_num_free(&m1);
-	bc_num_free(&h2);
-	bc_num_free(&l2);
-	bc_num_free(&h1);
-	bc_num_free(&l1);
-	RETURN_STATUS(s);
+		// u[j..j+vn] -= qhat * v
+		borrow = 0;
+		carry = 0;
+		for (i = 0; i < vn; i++) {
+			uint64_t p = qhat * v[i] + carry;
+			int64_t t;
+			carry = p / BC_LIMB_BASE;
+			t = (int64_t)u[i + j] - (int64_t)(p - carry * BC_LIMB_BASE) + borrow;
+			borrow = 0;
+			if (t < 0) {
+				t += BC_LIMB_BASE;
+				borrow = -1;
+			}
+			u[i + j] = (BcLimb)t;
+		}
+		{
+			int64_t t = (int64_t)u[j + vn] - (int64_t)carry + borrow;
+			borrow = 0;
+			if (t < 0) {
+				t += BC_LIMB_BASE;
+				borrow = -1;
+			}
+			u[j + vn] = (BcLimb)t;
+		}
+		if (borrow) {
+			// qhat was one too large: add v back
+			qhat--;
+			carry = 0;
+			for (i = 0; i < vn; i++) {
+				BcLimb x = u[i + j] + v[i] + carry;
+				carry = (x >= BC_LIMB_BASE);
+				u[i + j] = carry ? x - BC_LIMB_BASE : x;
+			}
+			u[j + vn] = (BcLimb)((u[j + vn] + carry) % BC_LIMB_BASE);
+		}
+		q[j] = (BcLimb)qhat;
+#if ENABLE_FEATURE_BC_INTERACTIVE
+		// a=2^100000
+		// scale=40000
+		// 1/a <- without check below, this will not be interruptible
+		if (G_interrupt) return;
+#endif
+	}
 }
 
 static FAST_FUNC BC_STATUS zbc_num_m(BcNum *a, BcNum *b, BcNum *restrict c, size_t scale)
@@ -2022,7 +2208,7 @@ static FAST_FUNC BC_STATUS zbc_num_m(BcNum *a, BcNum *b, BcNum *restrict c, size
 static FAST_FUNC BC_STATUS zbc_num_d(BcNum *a, BcNum *b, BcNum *restrict c, size_t scale)
 {
 	BcStatus s;
-	size_t len, end, i;
+	size_t len, end;
 	BcNum cp;
 
 	if (b->len == 0)
@@ -2074,20 +2260,27 @@ static FAST_FUNC BC_STATUS zbc_num_d(BcNum *a, BcNum *b, BcNum *restrict c, size
 	c->len = cp.len;
 
 	s = BC_STATUS_SUCCESS;
-	for (i = end - 1; i < end; --i) {
-		BcDig *n, q;
-		n = cp.num + i;
-		for (q = 0; n[len] != 0 || bc_num_compare(n, b->num, len) >= 0; ++q)
-			bc_num_subArrays(n, b->num, len);
-		c->num[i] = q;
+	{
+		// c = cp / b, as integers
+		BcLimb *u, *v, *q;
+		size_t un, vn;
+
+		un = (cp.len + BC_LIMB_DIGITS - 1) / BC_LIMB_DIGITS;
+		vn = (len + BC_LIMB_DIGITS - 1) / BC_LIMB_DIGITS;
+		u = xmalloc((2 * un + vn + 2) * sizeof(u[0]));
+		v = u + un + 1;
+		q = v + vn;
+		un = bc_limbs_from_digits(u, cp.num, cp.len);
+		vn = bc_limbs_from_digits(v, b->num, len);
+		if (un >= vn) {
+			bc_limbs_div(q, u, un, v, vn);
+			bc_limbs_to_digits(c->num, end, q, un - vn + 1);
+		} else
+			memset(c->num, 0, end * sizeof(BcDig));
+		free(u);
 #if ENABLE_FEATURE_BC_INTERACTIVE
-		// a=2^100000
-		// scale=40000
-		// 1/a <- without check below, this will not be interruptible
-		if (G_interrupt) {
+		if (G_interrupt)
 			s = BC_STATUS_FAILURE;
-			break;
-		}
 #endif
 	}
 
@@ -2307,12 +2500,15 @@ static NOINLINE BC_STATUS zbc_num_sqrt(BcNum *a, BcNum *restrict b, size_t scale
 	pow = BC_NUM_INT(a);
 
 	if (pow) {
+		// a has pow integer digits: start from 2*10^k if pow = 2k+1,
+		// 6*10^(k-1) if pow = 2k. Starting too high costs
+		// one iteration per halving of the error.
 		if (pow & 1)
 			x0->num[0] = 2;
 		else
 			x0->num[0] = 6;
 
-		pow -= 2 - (pow & 1);
+		pow = (pow - 1) / 2;
 
 		bc_num_extend(x0, pow);
 
@@ -6683,6 +6879,10 @@ static BC_STATUS zxc_program_exec(void)
 		char inst = code[ip->inst_idx++];
 
 		dbg_exec("inst at %zd:%d results.len:%d", ip->inst_idx - 1, inst, G.prog.results.len);
+		// Plain switch on purpose. Tried "goto *label_table[inst]",
+		// also with the dispatch copied to the ends of hot handlers:
+		// no measurable speedup (time goes to BcNum copying and
+		// allocation), +1.4k text and +0.5k data.
 		switch (inst) {
 		case XC_INST_RET:
 			if (IS_DC) { // end of '?' reached
@@ -6793,6 +6993,7 @@ static BC_STATUS zxc_program_exec(void)
 		case XC_INST_PRINT_STR:
 			dbg_exec("XC_INST_PRINTxyz(%d):", inst - XC_INST_PRINT);
 			s = zxc_program_print(inst, 0);
+			fflush_and_check();
 			break;
 		case XC_INST_STR:
 			dbg_exec("XC_INST_STR:");
@@ -6862,6 +7063,7 @@ static BC_STATUS zxc_program_exec(void)
 				s = zxc_program_print(XC_INST_PRINT, idx);
 				if (s) break;
 			}
+			fflush_and_check();
 			break;
 		}
 		case DC_INST_CLEAR_STACK:
@@ -6899,6 +7101,7 @@ static BC_STATUS zxc_program_exec(void)
 		case DC_INST_PRINT_STREAM:
 			dbg_exec("DC_INST_PRINT_STREAM:");
 			s = zdc_program_printStream();
+			fflush_and_check();
 			break;
 		case DC_INST_LOAD:
 		case DC_INST_PUSH_VAR: {
@@ -6935,10 +7138,11 @@ static BC_STATUS zxc_program_exec(void)
 			xc_program_reset();
 			RETURN_STATUS(s);
 		}
-
-		fflush_and_check();
+		// Output is flushed by the instructions which print,
+		// fflush(NULL) after every instruction is not cheap
 	}
 
+	fflush_and_check();
 	RETURN_STATUS(BC_STATUS_SUCCESS);
 }
 #define zxc_program_exec(...) (zxc_program_exec(__VA_ARGS__) COMMA_SUCCESS)
@@ -31,6 +31,16 @@
 //config:	default 9999999
 //config:	depends on LESS
 //config:
+//config:config FEATURE_LESS_MMAP
+//config:	bool "Read regular files with mmap"
+//config:	default n
+//config:	depends on LESS && !NOMMU
+//config:	help
+//config:	Map regular files into memory instead of reading them
+//config:	in small pieces. Makes 'G' and searches in big files faster.
+//config:	Lines are still copied out of the mapping, so memory use
+//config:	is the same as without this option.
+//config:
 //config:config FEATURE_LESS_BRACKETS
 //config:	bool "Enable bracket searching"
 //config:	default y
@@ -204,6 +214,13 @@ struct globals {
 	ssize_t eof_error; /* eof if 0, error if < 0 */
 	ssize_t readpos;
 	ssize_t readeof; /* must be signed */
+#if ENABLE_FEATURE_LESS_MMAP
+	char *mapped; /* mapped input file */
+	size_t mapped_size;
+	smallint mapped_shrunk; /* got SIGBUS reading it */
+	volatile smallint sigbus_armed; /* sigbus_jmp is valid */
+	jmp_buf sigbus_jmp;
+#endif
 	const char **buffer;
 	const char **flines;
 	const char *empty_line_marker;
@@ -227,6 +244,7 @@ struct globals {
 	int wanted_match; /* signed! */
 	int num_matches;
 	regex_t pattern;
+	char *literal; /* pattern has no special chars: use strstr */
 	smallint pattern_valid;
 #endif
 #if ENABLE_FEATURE_LESS_RAW
@@ -467,6 +485,36 @@ static int at_end(void)
  * "git log -p | less -m" on the kernel git tree is a good test for EAGAINs,
  * "/search on very long input" and "reaching max line count" corner cases.
  */
+#if ENABLE_FEATURE_LESS_MMAP
+/* If the file is truncated under us, touching the mapping past its
+ * new end raises SIGBUS. All reads of the mapping are done here:
+ * copy a run of up to max chars >= ' ' from file offset pos to dst,
+ * and return its length. If there is no such run, store the char
+ * at pos to *cp. Returns -1 on SIGBUS, nothing was consumed then.
+ */
+static ssize_t copy_from_map(char *dst, ssize_t pos, ssize_t max, char *cp)
+{
+	const char *s = G.mapped + pos;
+	const char *q = s;
+
+	if (setjmp(G.sigbus_jmp) != 0) {
+		G.sigbus_armed = 0;
+		return -1;
+	}
+	G.sigbus_armed = 1;
+	barrier();
+	while (q < s + max && (unsigned char)*q >= ' ')
+		q++;
+	if (q == s)
+		*cp = *s;
+	else
+		memcpy(dst, s, q - s);
+	barrier();
+	G.sigbus_armed = 0;
+	return q - s;
+}
+#endif
+
 static void read_lines(void)
 {
 	char *current_line, *p;
@@ -480,6 +528,11 @@ static void read_lines(void)
 
 #define readbuf bb_common_bufsiz1
 	setup_common_bufsiz();
+#if ENABLE_FEATURE_LESS_MMAP
+	/* We may have been idle for long, look at file size again */
+	if (G.mapped)
+		readeof = readpos;
+#endif
 
 	/* (careful: max_fline can be -1) */
 	if (max_fline + 1 > MAXLINES)
@@ -505,8 +558,39 @@ static void read_lines(void)
 		while (1) { /* read chars until we have a line */
 			char c;
 			/* if no unprocessed chars left, eat more */
-			if (readpos >= readeof) {
-				int flags = ndelay_on(0);
+			if (readpos >= readeof IF_FEATURE_LESS_MMAP(|| G.mapped_shrunk)) {
+				int flags;
+#if ENABLE_FEATURE_LESS_MMAP
+				if (G.mapped) {
+					struct stat st;
+					/* Hand out the mapping 1M at a time, and check
+					 * that the file was not truncated meanwhile:
+					 * touching pages past its end gives SIGBUS */
+					if (!G.mapped_shrunk
+					 && fstat(STDIN_FILENO, &st) == 0
+					 && readpos < st.st_size
+					 && (size_t)readpos < G.mapped_size
+					) {
+						readeof = G.mapped_size;
+						if (readeof > st.st_size)
+							readeof = st.st_size;
+						if (readeof - readpos > 1024 * 1024)
+							readeof = readpos + 1024 * 1024;
+						goto have_chars;
+					}
+					/* End of mapping (or file was truncated).
+					 * File may be still growing,
+					 * continue with read() from here */
+					munmap(G.mapped, G.mapped_size);
+					G.mapped = NULL;
+					G.mapped_shrunk = 0;
+					if (lseek(STDIN_FILENO, readpos, SEEK_SET) < 0) {
+						eof_error = -1;
+						goto reached_eof;
+					}
+				}
+#endif
+				flags = ndelay_on(0);
 
 				while (1) {
 					time_t t;
@@ -530,7 +614,53 @@ static void read_lines(void)
 					goto reached_eof;
 				retry_EAGAIN = 1;
 			}
+#if ENABLE_FEATURE_LESS_MMAP
+ have_chars:
+			if (G.mapped) {
+				ssize_t n = w - (ssize_t)last_line_pos;
+
+				if (n > readeof - readpos)
+					n = readeof - readpos;
+				IF_FEATURE_LESS_RAW(if (G.in_escape) n = 0;)
+				n = copy_from_map(p, readpos, n, &c);
+				if (n < 0) {
+					/* File was truncated: go on with read()
+					 * from the first byte we did not take */
+					G.mapped_shrunk = 1;
+					continue;
+				}
+				if (n > 0) {
+					p += n;
+					*p = '\0';
+					readpos += n;
+					last_line_pos += n;
+					continue;
+				}
+				/* c is set, no fast path for it */
+			} else
+#endif
 			c = readbuf[readpos];
+			/* fast path: copy a run of printable chars at once */
+			if ((unsigned char)c >= ' '
+			 IF_FEATURE_LESS_RAW(&& !G.in_escape)
+			) {
+				const char *s = readbuf + readpos;
+				const char *q = s;
+				ssize_t n = w - (ssize_t)last_line_pos;
+
+				if (n > readeof - readpos)
+					n = readeof - readpos;
+				while (q < s + n && (unsigned char)*q >= ' ')
+					q++;
+				n = q - s;
+				if (n > 0) {
+					p = mempcpy(p, s, n);
+					*p = '\0';
+					readpos += n;
+					last_line_pos += n;
+					continue;
+				}
+			}
 			/* backspace? [needed for manpages] */
 			/* <tab><bs> is (a) insane and */
 			/* (b) harder to do correctly, so we refuse to do it */
@@ -616,6 +746,14 @@ static void read_lines(void)
 			if (wanted_match >= num_matches) { /* goto_match called us */
 				fill_match_lines(old_max_fline);
 				old_max_fline = max_fline;
+				/* Let user interrupt a long search with a keypress */
+				if (!(max_fline & 0xfff)) {
+					struct pollfd pfd;
+					pfd.fd = kbd_fd;
+					pfd.events = POLLIN;
+					if (poll(&pfd, 1, 0) > 0)
+						break;
+				}
 			}
 			if (wanted_match < num_matches)
 				break;
@@ -1048,6 +1186,37 @@ static void buffer_lineno(int lineno)
 	buffer_to_line(lineno, TRUE);
 }
 
+#if ENABLE_FEATURE_LESS_MMAP
+/* If stdin is a regular file, map it. read_lines() then takes
+ * chars from the mapping through copy_from_map() */
+static void map_input(void)
+{
+	struct stat st;
+	off_t pos;
+	char *map;
+
+	if (G.mapped) {
+		munmap(G.mapped, G.mapped_size);
+		G.mapped = NULL;
+	}
+	G.mapped_shrunk = 0;
+	if (fstat(STDIN_FILENO, &st) != 0 || !S_ISREG(st.st_mode))
+		return;
+	pos = lseek(STDIN_FILENO, 0, SEEK_CUR);
+	if (pos < 0 || pos >= st.st_size || st.st_size > SSIZE_MAX)
+		return;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+	if (map == MAP_FAILED)
+		return;
+	G.mapped = map;
+	G.mapped_size = st.st_size;
+	readpos = pos;
+	readeof = pos; /* read_lines() will take it from here */
+}
+#else
+# define map_input() ((void)0)
+#endif
+
 static void open_file_and_read_lines(void)
 {
 	if (filename) {
@@ -1065,6 +1234,7 @@ static void open_file_and_read_lines(void)
 	}
 	readpos = 0;
 	readeof = 0;
+	map_input();
 	last_line_pos = 0;
 	terminated = 1;
 	read_lines();
@@ -1327,7 +1497,10 @@ static void goto_match(int match)
 	/* Try to find next match if eof isn't reached yet */
 	if (match >= num_matches && eof_error > 0) {
 		wanted_match = match; /* "I want to read until I see N'th match" */
+		/* In raw mode any key makes read_lines() stop searching */
+		tcsetattr(kbd_fd, TCSANOW, &term_less);
 		read_lines();
+		set_tty_cooked();
 	}
 	if (num_matches) {
 		normalize_match_pos(match);
@@ -1337,6 +1510,13 @@ static void goto_match(int match)
 	}
 }
 
+static int line_matches(const char *line)
+{
+	if (G.literal)
+		return strstr(line, G.literal) != NULL;
+	return regexec(&pattern, line, 0, NULL, 0) == 0;
+}
+
 static void fill_match_lines(unsigned pos)
 {
 	if (!pattern_valid)
@@ -1344,7 +1524,7 @@ static void fill_match_lines(unsigned pos)
 	/* Run the regex on each line of the current file */
 	while (pos <= max_fline) {
 		/* If this line matches */
-		if (regexec(&pattern, flines[pos], 0, NULL, 0) == 0
+		if (line_matches(flines[pos])
 		/* and we didn't match it last time */
 		 && !(num_matches && match_lines[num_matches-1] == pos)
 		) {
@@ -1368,6 +1548,8 @@ static void regex_process(void)
 		regfree(&pattern);
 		pattern_valid = 0;
 	}
+	free(G.literal);
+	G.literal = NULL;
 
 	/* Get the uncompiled regular expression from the user */
 	clear_line();
@@ -1382,12 +1564,17 @@ static void regex_process(void)
 	/* Compile the regex and check for errors */
 	err = regcomp_or_errmsg(&pattern, uncomp_regex,
 				(option_mask32 & FLAG_I) ? REG_ICASE : 0);
-	free(uncomp_regex);
 	if (err) {
+		free(uncomp_regex);
 		print_statusline(err);
 		free(err);
 		return;
 	}
+	/* Plain strings are far cheaper to find with strstr */
+	if (!(option_mask32 & FLAG_I) && !strpbrk(uncomp_regex, ".[]\\*^$"))
+		G.literal = uncomp_regex;
+	else
+		free(uncomp_regex);
 
 	pattern_valid = 1;
 	match_pos = 0;
@@ -1807,6 +1994,16 @@ static void sigwinch_handler(int sig UNUSED_PARAM)
 }
 #endif
 
+#if ENABLE_FEATURE_LESS_MMAP
+/* File was truncated while copy_from_map() read it */
+static void sigbus_handler(int sig)
+{
+	if (!G.sigbus_armed)
+		sig_catcher(sig); /* a real bug */
+	longjmp(G.sigbus_jmp, 1);
+}
+#endif
+
 int less_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int less_main(int argc, char **argv)
 {
@@ -1905,6 +2102,17 @@ int less_main(int argc, char **argv)
 
 	/* We want to restore term_orig on exit */
 	bb_signals(BB_FATAL_SIGS, sig_catcher);
+#if ENABLE_FEATURE_LESS_MMAP
+	{
+		/* SA_NODEFER: longjmp out of the handler
+		 * must not leave SIGBUS blocked */
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = sigbus_handler;
+		sa.sa_flags = SA_NODEFER;
+		sigaction_set(SIGBUS, &sa);
+	}
+#endif
 #if ENABLE_FEATURE_LESS_WINCH
 	signal(SIGWINCH, sigwinch_handler);
 #endif
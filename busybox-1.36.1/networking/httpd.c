@@ -117,6 +117,16 @@
 //config:	"Range: bytes=NNN-[MMM]" header. Allows for resuming interrupted
 //config:	downloads, seeking in multimedia players etc.
 //config:
+//config:config FEATURE_HTTPD_KEEP_ALIVE
+//config:	bool "Support persistent (keep-alive) connections"
+//config:	default y
+//config:	depends on HTTPD
+//config:	help
+//config:	Serve several requests for static files over one connection
+//config:	(HTTP/1.1 default, or "Connection: keep-alive" for HTTP/1.0),
+//config:	without the cost of new TCP connection and fork per request.
+//config:	CGI and proxy responses still close the connection.
+//config:
 //config:config FEATURE_HTTPD_SETUID
 //config:	bool "Enable -u <user> option"
 //config:	default y
@@ -221,6 +231,18 @@
 //config:	Makes httpd send files using GZIP content encoding if the
 //config:	client supports it and a pre-compressed <file>.gz exists.
 //config:
+//config:config FEATURE_HTTPD_GZIP_CACHE
+//config:	bool "Compress text files on the fly"
+//config:	default y
+//config:	depends on FEATURE_HTTPD_GZIP
+//config:	help
+//config:	With -z DIR, text files which have no pre-compressed <file>.gz
+//config:	are compressed by running gzip, and the result is kept in DIR
+//config:	for later requests. Entries are named after device, inode,
+//config:	mtime and size of the original file, so a changed file gets
+//config:	a new entry. Oldest entries are removed when DIR grows
+//config:	over 16 megabytes.
+//config:
 //config:config FEATURE_HTTPD_ETAG
 //config:	bool "Support caching via ETag header"
 //config:	default y
@@ -269,6 +291,7 @@
 //usage:       " [-p [IP:]PORT]"
 //usage:	IF_FEATURE_HTTPD_SETUID(" [-u USER[:GRP]]")
 //usage:	IF_FEATURE_HTTPD_BASIC_AUTH(" [-r REALM]")
+//usage:	IF_FEATURE_HTTPD_GZIP_CACHE(" [-z DIR]")
 //usage:       " [-h HOME]\n"
 //usage:       "or httpd -d/-e" IF_FEATURE_HTTPD_AUTH_MD5("/-m") " STRING"
 //usage:#define httpd_full_usage "\n\n"
@@ -283,6 +306,8 @@
 //usage:     "\n	-r REALM	Authentication Realm for Basic Authentication")
 //usage:     "\n	-h HOME		Home directory (default .)"
 //usage:     "\n	-c FILE		Configuration file (default {/etc,HOME}/httpd.conf)"
+//usage:	IF_FEATURE_HTTPD_GZIP_CACHE(
+//usage:     "\n	-z DIR		Gzip text files on the fly, cache results in DIR")
 //usage:	IF_FEATURE_HTTPD_AUTH_MD5(
 //usage:     "\n	-m STRING	MD5 crypt STRING")
 //usage:     "\n	-e STRING	HTML encode STRING"
@@ -303,6 +328,9 @@
 #if ENABLE_FEATURE_USE_SENDFILE
 # include <sys/sendfile.h>
 #endif
+#if ENABLE_FEATURE_HTTPD_KEEP_ALIVE
+# include <netinet/tcp.h>
+#endif
 
 /* see sys/netinet6/in6.h */
 #if defined(__FreeBSD__)
@@ -321,6 +349,13 @@
 #define MAX_HTTP_HEADERS_SIZE (32*1024)
 
 #define HEADER_READ_TIMEOUT 60
+/* How long an idle keep-alive connection waits for the next request */
+#define KEEP_ALIVE_TIMEOUT 5
+/* How many files a kept connection holds open for reuse */
+#define FD_CACHE_SIZE 8
+/* Size limit of -z DIR, and smallest file worth compressing */
+#define GZIP_CACHE_SIZE (16 * 1024 * 1024)
+#define GZIP_MIN_SIZE 256
 
 #define STR1(s) #s
 #define STR(s) STR1(s)
@@ -342,9 +377,9 @@ typedef struct Htaccess {
 } Htaccess;
 
 #if ENABLE_FEATURE_HTTPD_ACL_IP
-/* Must have "next" as a first member */
+/* Kept in an array sorted by (mask descending, ip ascending),
+ * see compare_ip_rules() */
 typedef struct Htaccess_IP {
-	struct Htaccess_IP *next;
 	unsigned ip;
 	unsigned mask;
 	int allow_deny;
@@ -460,6 +495,26 @@ struct globals {
 	time_t last_mod;
 #if ENABLE_FEATURE_HTTPD_ETAG
 	char *if_none_match;
+#endif
+#if ENABLE_FEATURE_HTTPD_KEEP_ALIVE
+	/* client wants keep-alive / response allows it */
+	smallint keep_alive;
+	jmp_buf next_request;
+	/* identity of the requested file, from stat() */
+	dev_t file_dev;
+	ino_t file_ino;
+	/* g_query if it was xstrdup'ed, freed before next request */
+	char *g_query_malloced;
+	/* files sent on this connection, most recently used first */
+	struct cached_fd {
+		char *path;
+		int fd;
+		dev_t dev;
+		ino_t ino;
+	} fd_cache[FD_CACHE_SIZE];
+#endif
+#if ENABLE_FEATURE_HTTPD_GZIP_CACHE
+	const char *gzip_cache_dir;
 #endif
 	char *rmt_ip_str;       /* for $REMOTE_ADDR and $REMOTE_PORT */
 	const char *bind_addr_or_port;
@@ -473,6 +528,7 @@ struct globals {
 	const char *found_moved_temporarily;
 #if ENABLE_FEATURE_HTTPD_ACL_IP
 	Htaccess_IP *ip_a_d;    /* config allow/deny lines */
+	unsigned ip_a_d_cnt;
 #endif
 
 	IF_FEATURE_HTTPD_BASIC_AUTH(const char *g_realm;)
@@ -515,6 +571,11 @@ struct globals {
 #else
 # define content_gzip     0
 #endif
+#if ENABLE_FEATURE_HTTPD_KEEP_ALIVE
+# define keep_alive       (G.keep_alive       )
+#else
+# define keep_alive       0
+#endif
 #define bind_addr_or_port (G.bind_addr_or_port)
 #define g_query           (G.g_query          )
 #define opt_c_configFile  (G.opt_c_configFile )
@@ -564,6 +625,12 @@ enum {
 	SEND_HEADERS     = (1 << 0),
 	SEND_BODY        = (1 << 1),
 };
+/* keep_alive values */
+enum {
+	KEEP_ALIVE_NEVER     = -1, /* subdir config was applied, or unread body */
+	KEEP_ALIVE_REQUESTED = 1,
+	KEEP_ALIVE_ACTIVE    = 2, /* response has known length, can reuse connection */
+};
 static void send_file_and_exit(const char *url, int what) NORETURN;
 
 static void free_llist(has_next_ptr **pptr)
@@ -582,13 +649,6 @@ static ALWAYS_INLINE void free_Htaccess_list(Htaccess **pptr)
 	free_llist((has_next_ptr**)pptr);
 }
 
-#if ENABLE_FEATURE_HTTPD_ACL_IP
-static ALWAYS_INLINE void free_Htaccess_IP_list(Htaccess_IP **pptr)
-{
-	free_llist((has_next_ptr**)pptr);
-}
-#endif
-
 #if ENABLE_FEATURE_HTTPD_ACL_IP
 /* Returns presumed mask width in bits or < 0 on error.
  * Updates strp, stores IP at provided pointer */
@@ -674,6 +734,22 @@ static int scan_ip_mask(const char *str, unsigned *ipp, unsigned *maskp)
 	*maskp = (uint32_t)(~mask);
 	return 0;
 }
+
+/* Rules with the same mask form one run, sorted by ip within it.
+ * The order of runs does not matter for correctness (any matching
+ * D denies), more specific masks simply come first.
+ */
+static int compare_ip_rules(const void *a, const void *b)
+{
+	const Htaccess_IP *x = a;
+	const Htaccess_IP *y = b;
+
+	if (x->mask != y->mask)
+		return x->mask < y->mask ? 1 : -1;
+	if (x->ip != y->ip)
+		return x->ip < y->ip ? -1 : 1;
+	return 0;
+}
 #endif
 
 /*
@@ -705,7 +781,9 @@ static int parse_conf(const char *path, int flag)
 
 	/* discard old rules */
 #if ENABLE_FEATURE_HTTPD_ACL_IP
-	free_Htaccess_IP_list(&G.ip_a_d);
+	free(G.ip_a_d);
+	G.ip_a_d = NULL;
+	G.ip_a_d_cnt = 0;
 #endif
 	flg_deny_all = 0;
 	/* retain previous auth and mime config only for subdir parse */
@@ -824,28 +902,14 @@ static int parse_conf(const char *path, int flag)
 				continue;
 			}
 			/* store "allow/deny IP/mask" line */
-			pip = xzalloc(sizeof(*pip));
+			G.ip_a_d = xrealloc_vector(G.ip_a_d, 4, G.ip_a_d_cnt);
+			pip = &G.ip_a_d[G.ip_a_d_cnt++];
 			if (scan_ip_mask(after_colon, &pip->ip, &pip->mask)) {
 				/* IP{/mask} syntax error detected, protect all */
 				ch = 'D';
 				pip->mask = 0;
 			}
 			pip->allow_deny = ch;
-			if (ch == 'D') {
-				/* Deny:from_IP - prepend */
-				pip->next = G.ip_a_d;
-				G.ip_a_d = pip;
-			} else {
-				/* A:from_IP - append (thus all D's precedes A's) */
-				Htaccess_IP *prev_IP = G.ip_a_d;
-				if (prev_IP == NULL) {
-					G.ip_a_d = pip;
-				} else {
-					while (prev_IP->next)
-						prev_IP = prev_IP->next;
-					prev_IP->next = pip;
-				}
-			}
 			continue;
 		}
 #endif
@@ -986,6 +1050,10 @@ static int parse_conf(const char *path, int flag)
 	} /* while (fgets) */
 
 	fclose(f);
+#if ENABLE_FEATURE_HTTPD_ACL_IP
+	if (G.ip_a_d_cnt > 1)
+		qsort(G.ip_a_d, G.ip_a_d_cnt, sizeof(G.ip_a_d[0]), compare_ip_rules);
+#endif
 	return 0;
 }
 
@@ -1050,10 +1118,15 @@ static int openServer(void)
 
 /*
  * Log the connection closure and exit.
+ * On a keep-alive connection, go read the next request instead.
  */
 static void log_and_exit(void) NORETURN;
 static void log_and_exit(void)
 {
+#if ENABLE_FEATURE_HTTPD_KEEP_ALIVE
+	if (keep_alive == KEEP_ALIVE_ACTIVE)
+		longjmp(G.next_request, 1);
+#endif
 	/* Paranoia. IE said to be buggy. It may send some extra data
 	 * or be confused by us just exiting without SHUT_WR. Oh well. */
 	shutdown(1, SHUT_WR);
@@ -1106,6 +1179,20 @@ static void send_headers(unsigned responseNum)
 	if (verbose)
 		bb_error_msg("response:%u", responseNum);
 
+#if ENABLE_FEATURE_HTTPD_KEEP_ALIVE
+	/* Connection can be reused only if client will know where
+	 * the response ends: file with Content-Length, or no body */
+	if (keep_alive > 0
+	 && (responseNum == HTTP_NOT_MODIFIED
+	    || ((responseNum == HTTP_OK || responseNum == HTTP_PARTIAL_CONTENT) && file_size != -1)
+	    )
+	) {
+		keep_alive = KEEP_ALIVE_ACTIVE;
+	} else {
+		keep_alive = 0;
+	}
+#endif
+
 	/* We use sprintf, not snprintf (it's less code).
 	 * iobuf[] is several kbytes long and all headers we generate
 	 * always fit into those kbytes.
@@ -1122,11 +1209,12 @@ static void send_headers(unsigned responseNum)
 #if ENABLE_FEATURE_HTTPD_DATE
 			"Date: %s\r\n"
 #endif
-			"Connection: close\r\n",
+			"Connection: %s\r\n",
 			responseNum, responseString
 #if ENABLE_FEATURE_HTTPD_DATE
 			, date_str
 #endif
+			, keep_alive == KEEP_ALIVE_ACTIVE ? "keep-alive" : "close"
 		);
 	}
 
@@ -1260,7 +1348,9 @@ static void send_headers(unsigned responseNum)
 	 * https://bugs.chromium.org/p/chromium/issues/detail?id=94730
 	 */
 	if (content_gzip)
-		len += sprintf(iobuf + len, "Content-Encoding: gzip\r\n");
+		len += sprintf(iobuf + len, "Content-Encoding: gzip\r\n"
+			/* caches must not give it to clients without gzip */
+			"Vary: Accept-Encoding\r\n");
 
 	iobuf[len++] = '\r';
 	iobuf[len++] = '\n';
@@ -1282,6 +1372,7 @@ static void send_headers(unsigned responseNum)
 	if (full_write(STDOUT_FILENO, iobuf, len) != len) {
 		if (verbose > 1)
 			bb_simple_perror_msg("error");
+		IF_FEATURE_HTTPD_KEEP_ALIVE(keep_alive = 0;)
 		log_and_exit();
 	}
 }
@@ -1728,6 +1819,248 @@ static void send_cgi_and_exit(
 
 #endif          /* FEATURE_HTTPD_CGI */
 
+#if ENABLE_FEATURE_HTTPD_KEEP_ALIVE
+/*
+ * Open a file for sending on a kept connection.
+ * Clients ask for the same files again and again, so the fds stay open
+ * and are reused while path still names the same file (dev/ino from
+ * a fresh stat()). Data and size are always current: an fd follows
+ * in-place changes of its file, and a replaced file has a new inode.
+ * Returned fd belongs to the cache, do not close it.
+ */
+static int open_cached(const char *path, dev_t dev, ino_t ino)
+{
+	struct cached_fd *c = G.fd_cache;
+	struct cached_fd hit;
+	unsigned i;
+	int fd;
+
+	for (i = 0; i < FD_CACHE_SIZE && c[i].path; i++) {
+		if (strcmp(c[i].path, path) != 0)
+			continue;
+		hit = c[i];
+		if (hit.dev == dev && hit.ino == ino) {
+			/* move to front */
+			memmove(&c[1], &c[0], i * sizeof(c[0]));
+			c[0] = hit;
+			return hit.fd;
+		}
+		/* file was replaced, forget it */
+		close(hit.fd);
+		free(hit.path);
+		memmove(&c[i], &c[i + 1], (FD_CACHE_SIZE - 1 - i) * sizeof(c[0]));
+		c[FD_CACHE_SIZE - 1].path = NULL;
+		break;
+	}
+
+	/* Cached fds stay open across requests: do not leak them to CGIs */
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		i = FD_CACHE_SIZE - 1;
+		if (c[i].path) { /* evict least recently used */
+			close(c[i].fd);
+			free(c[i].path);
+		}
+		memmove(&c[1], &c[0], i * sizeof(c[0]));
+		c[0].path = xstrdup(path);
+		c[0].fd = fd;
+		c[0].dev = dev;
+		c[0].ino = ino;
+	}
+	return fd;
+}
+#endif
+
+#if ENABLE_FEATURE_HTTPD_GZIP_CACHE
+static int is_compressible(const char *mime_type)
+{
+	if (!mime_type)
+		return 0;
+	return is_prefixed_with(mime_type, "text/")
+		|| strstr(mime_type, "javascript")
+		|| strstr(mime_type, "json")
+		|| strstr(mime_type, "xml");
+}
+
+struct gzip_cache_ent {
+	char *name;
+	time_t mtime;
+	off_t size;
+};
+
+static int compare_gzip_cache_ents(const void *a, const void *b)
+{
+	const struct gzip_cache_ent *x = a;
+	const struct gzip_cache_ent *y = b;
+
+	if (x->mtime != y->mtime)
+		return x->mtime < y->mtime ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Called after a new entry was added to -z DIR. Removes entries for
+ * older versions of the same file (same "dev-ino-" prefix), then
+ * removes oldest entries until DIR fits in GZIP_CACHE_SIZE.
+ */
+static void trim_gzip_cache(const char *keep, const char *prefix)
+{
+	DIR *dir;
+	struct dirent *de;
+	struct gzip_cache_ent *ents = NULL;
+	unsigned cnt = 0;
+	unsigned i;
+	off_t total = 0;
+
+	dir = opendir(G.gzip_cache_dir);
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		struct stat sb;
+		char *path;
+
+		if (de->d_name[0] == '.')
+			continue;
+		path = concat_path_file(G.gzip_cache_dir, de->d_name);
+		if (strcmp(de->d_name, keep) != 0
+		 && is_prefixed_with(de->d_name, prefix)
+		) {
+			unlink(path);
+		} else if (stat(path, &sb) == 0 && S_ISREG(sb.st_mode)) {
+			total += sb.st_size;
+			if (strcmp(de->d_name, keep) == 0)
+				goto next;
+			ents = xrealloc_vector(ents, 4, cnt);
+			ents[cnt].name = path;
+			ents[cnt].mtime = sb.st_mtime;
+			ents[cnt].size = sb.st_size;
+			cnt++;
+			continue;
+		}
+ next:
+		free(path);
+	}
+	closedir(dir);
+
+	qsort(ents, cnt, sizeof(ents[0]), compare_gzip_cache_ents);
+	for (i = 0; i < cnt; i++) {
+		if (total > GZIP_CACHE_SIZE) {
+			unlink(ents[i].name);
+			total -= ents[i].size;
+		}
+		free(ents[i].name);
+	}
+	free(ents);
+}
+
+/* Compress the file open as fd into path, via a temporary file */
+static int make_gzip_variant(int fd, const struct stat *sb, const char *path)
+{
+	struct stat sb2;
+	void (*sv)(int);
+	char *tmp;
+	pid_t pid;
+	int status = -1;
+	int zfd;
+
+	tmp = xasprintf("%s/.%u.tmp", G.gzip_cache_dir, (unsigned)getpid());
+	zfd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (zfd < 0)
+		goto ret;
+	lseek(fd, 0, SEEK_SET);
+	/* in daemon mode it is SIG_IGN, and we need to wait for gzip */
+	sv = signal(SIGCHLD, SIG_DFL);
+	pid = vfork();
+	if (pid == 0) {
+		/* Child process */
+		xmove_fd(fd, 0);
+		xmove_fd(zfd, 1);
+		BB_EXECLP("gzip", "gzip", "-c", (char *)NULL);
+		_exit(127);
+	}
+	if (pid > 0)
+		safe_waitpid(pid, &status, 0);
+	signal(SIGCHLD, sv);
+	close(zfd);
+
+	/* Was the file modified while we were reading it? */
+	if (status != 0
+	 || fstat(fd, &sb2) != 0
+	 || sb2.st_mtime != sb->st_mtime
+	 || sb2.st_mtim.tv_nsec != sb->st_mtim.tv_nsec
+	 || sb2.st_size != sb->st_size
+	 || rename(tmp, path) != 0
+	) {
+		unlink(tmp);
+		status = -1;
+	}
+ ret:
+	free(tmp);
+	return status;
+}
+
+/*
+ * Find or create a gzipped copy of the file open as fd in -z DIR.
+ * On success, updates file_size and content_gzip and returns the fd
+ * to send instead. Returns -1 if the file should be sent as is.
+ */
+static int open_gzip_variant(int fd, int cached)
+{
+	struct stat sb, zsb;
+	char *path;
+	const char *name;
+	int zfd;
+
+	if (fstat(fd, &sb) != 0)
+		return -1;
+	/* Same-size rewrites within a second differ only in mtime nsec */
+	path = xasprintf("%s/%llx-%llx-%llx.%lx-%llx.gz", G.gzip_cache_dir,
+		(unsigned long long)sb.st_dev,
+		(unsigned long long)sb.st_ino,
+		(unsigned long long)sb.st_mtime,
+		(unsigned long)sb.st_mtim.tv_nsec,
+		(unsigned long long)sb.st_size
+	);
+	name = bb_basename(path);
+	zfd = -1;
+	if (stat(path, &zsb) != 0) {
+		int r = make_gzip_variant(fd, &sb, path);
+		/* gzip has read fd to EOF. If we end up sending it
+		 * (gzip failed, or data is incompressible), the read()
+		 * fallback of send_file_and_exit() needs it rewound */
+		lseek(fd, 0, SEEK_SET);
+		if (r == 0) {
+			/* "dev-ino-" of this file */
+			char *prefix = xstrndup(name, strchr(strchr(name, '-') + 1, '-') + 1 - name);
+			trim_gzip_cache(name, prefix);
+			free(prefix);
+		}
+		if (stat(path, &zsb) != 0)
+			goto ret;
+	}
+#if ENABLE_FEATURE_HTTPD_KEEP_ALIVE
+	if (cached)
+		zfd = open_cached(path, zsb.st_dev, zsb.st_ino);
+	else
+#endif
+		zfd = open(path, O_RDONLY);
+	if (zfd < 0)
+		goto ret;
+	/* Incompressible data is also cached, to not retry every time */
+	if (zsb.st_size >= sb.st_size) {
+		if (!cached)
+			close(zfd);
+		zfd = -1;
+		goto ret;
+	}
+	file_size = zsb.st_size;
+	content_gzip = 1;
+ ret:
+	free(path);
+	return zfd;
+}
+#endif
+
 /*
  * Send a file response to a HTTP request, and exit
  *
@@ -1740,23 +2073,47 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 	char *suffix;
 	int fd;
 	ssize_t count;
+	off_t left;
+#if ENABLE_FEATURE_HTTPD_KEEP_ALIVE
+	/* Only files stat()ed by this request: not error pages (SEND_BODY only) */
+	smallint cached = (keep_alive > 0 && (what & SEND_HEADERS) && file_size != -1);
+#else
+	enum { cached = 0 };
+#endif
+	IF_FEATURE_HTTPD_GZIP_CACHE(smallint want_gzip;)
 
+	fd = -1;
+	IF_FEATURE_HTTPD_GZIP_CACHE(want_gzip = content_gzip;)
 	if (content_gzip) {
 		/* does <url>.gz exist? Then use it instead */
+		struct stat sb;
 		char *gzurl = xasprintf("%s.gz", url);
-		fd = open(gzurl, O_RDONLY);
+#if ENABLE_FEATURE_HTTPD_KEEP_ALIVE
+		if (cached) {
+			if (stat(gzurl, &sb) == 0)
+				fd = open_cached(gzurl, sb.st_dev, sb.st_ino);
+		} else
+#endif
+		{
+			fd = open(gzurl, O_RDONLY);
+			if (fd != -1)
+				fstat(fd, &sb);
+		}
 		free(gzurl);
 		if (fd != -1) {
-			struct stat sb;
-			fstat(fd, &sb);
 			file_size = sb.st_size;
 			last_mod = sb.st_mtime;
 		} else {
 			IF_FEATURE_HTTPD_GZIP(content_gzip = 0;)
-			fd = open(url, O_RDONLY);
 		}
-	} else {
-		fd = open(url, O_RDONLY);
+	}
+	if (fd < 0) {
+#if ENABLE_FEATURE_HTTPD_KEEP_ALIVE
+		if (cached)
+			fd = open_cached(url, G.file_dev, G.file_ino);
+		else
+#endif
+			fd = open(url, O_RDONLY);
 		/* file_size and last_mod are already populated */
 	}
 	if (fd < 0) {
@@ -1768,18 +2125,6 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 			send_headers_and_exit(HTTP_NOT_FOUND);
 		log_and_exit();
 	}
-#if ENABLE_FEATURE_HTTPD_ETAG
-	/* ETag is "hex(last_mod)-hex(file_size)" e.g. "5e132e20-417" */
-	sprintf(G.etag, "\"%llx-%llx\"", (unsigned long long)last_mod, (unsigned long long)file_size);
-
-	if (G.if_none_match) {
-		dbg("If-None-Match:'%s' file's ETag:'%s'\n", G.if_none_match, G.etag);
-		/* Weak ETag comparision.
-		 * If-None-Match may have many ETags but they are quoted so we can use simple substring search */
-		if (strstr(G.if_none_match, G.etag))
-			send_headers_and_exit(HTTP_NOT_MODIFIED);
-	}
-#endif
 	/* If you want to know about EPIPE below
 	 * (happens if you abort downloads from local httpd): */
 	signal(SIGPIPE, SIG_IGN);
@@ -1851,12 +2196,40 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 
 	dbg("sending file '%s' content-type:%s\n", url, found_mime_type);
 
-#if ENABLE_FEATURE_HTTPD_RANGES
-	if (what == SEND_BODY /* err pages and ranges don't mix */
-	 || content_gzip /* we are sending compressed page: can't do ranges */  ///why?
+#if ENABLE_FEATURE_HTTPD_GZIP_CACHE
+	if (want_gzip && !content_gzip && G.gzip_cache_dir
+	 && (what & SEND_HEADERS) && file_size != -1
+	 && file_size >= GZIP_MIN_SIZE && file_size <= GZIP_CACHE_SIZE / 4
+	 && is_compressible(found_mime_type)
 	) {
-		range_start = -1;
+		int zfd = open_gzip_variant(fd, cached);
+		if (zfd >= 0) {
+			if (!cached)
+				close(fd);
+			fd = zfd;
+		}
+	}
+#endif
+#if ENABLE_FEATURE_HTTPD_ETAG
+	/* ETag is "hex(last_mod)-hex(file_size)" e.g. "5e132e20-417" */
+	sprintf(G.etag, "\"%llx-%llx\"", (unsigned long long)last_mod, (unsigned long long)file_size);
+
+	if (G.if_none_match) {
+		dbg("If-None-Match:'%s' file's ETag:'%s'\n", G.if_none_match, G.etag);
+		/* Weak ETag comparision.
+		 * If-None-Match may have many ETags but they are quoted so we can use simple substring search */
+		if (strstr(G.if_none_match, G.etag)) {
+			if (!cached)
+				close(fd);
+			send_headers_and_exit(HTTP_NOT_MODIFIED);
+		}
 	}
+#endif
+
+#if ENABLE_FEATURE_HTTPD_RANGES
+	/* Ranges of a compressed page are ranges of its .gz data */
+	if (what == SEND_BODY) /* err pages and ranges don't mix */
+		range_start = -1;
 	range_len = MAXINT(off_t);
 	if (range_start >= 0) {
 		if (!range_end || range_end > file_size - 1) {
@@ -1870,12 +2243,20 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 		} else {
 			range_len = range_end - range_start + 1;
 			send_headers(HTTP_PARTIAL_CONTENT);
-			what = SEND_BODY;
+			what &= ~SEND_HEADERS;
 		}
 	}
 #endif
 	if (what & SEND_HEADERS)
 		send_headers(HTTP_OK);
+	left = 0;
+	if (!(what & SEND_BODY)) /* HEAD */
+		goto done;
+	left = range_len;
+	/* On a reused connection, body must be exactly Content-Length long
+	 * (send_headers() set file_size to it) */
+	if (keep_alive == KEEP_ALIVE_ACTIVE)
+		left = file_size;
 #if ENABLE_FEATURE_USE_SENDFILE
 	{
 		off_t offset;
@@ -1889,27 +2270,32 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 		while (1) {
 			/* sz is rounded down to 64k */
 			ssize_t sz = MAXINT(ssize_t) - 0xffff;
-			IF_FEATURE_HTTPD_RANGES(if (sz > range_len) sz = range_len;)
+			if (sz > left)
+				sz = left;
 			count = sendfile(STDOUT_FILENO, fd, &offset, sz);
 			if (count < 0) {
 				if (offset == range_start) /* was it the very 1st sendfile? */
 					break; /* fall back to read/write loop */
 				goto fin;
 			}
-			IF_FEATURE_HTTPD_RANGES(range_len -= count;)
-			if (count == 0 || range_len == 0)
-				log_and_exit();
+			left -= count;
+			if (count == 0 || left == 0)
+				goto done;
 		}
 	}
 #endif
+	/* Reused fd can be anywhere, sendfile() did not move it */
+	if (cached)
+		lseek(fd, range_start > 0 ? range_start : 0, SEEK_SET);
 	while ((count = safe_read(fd, iobuf, IOBUF_SIZE)) > 0) {
 		ssize_t n;
-		IF_FEATURE_HTTPD_RANGES(if (count > range_len) count = range_len;)
+		if (count > left)
+			count = left;
 		n = full_write(STDOUT_FILENO, iobuf, count);
 		if (count != n)
 			break;
-		IF_FEATURE_HTTPD_RANGES(range_len -= count;)
-		if (range_len == 0)
+		left -= count;
+		if (left == 0)
 			break;
 	}
 	if (count < 0) {
@@ -1917,33 +2303,77 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 		if (verbose > 1)
 			bb_simple_perror_msg("error");
 	}
+ done:
+#if ENABLE_FEATURE_HTTPD_KEEP_ALIVE
+	/* file shrank, or write error? can't reuse connection */
+	if (left != 0)
+		keep_alive = 0;
+#endif
+	if (!cached)
+		close(fd);
 	log_and_exit();
 }
 
 #if ENABLE_FEATURE_HTTPD_ACL_IP
 static void if_ip_denied_send_HTTP_FORBIDDEN_and_exit(unsigned remote_ip)
 {
-	Htaccess_IP *cur;
-
-	for (cur = G.ip_a_d; cur; cur = cur->next) {
-		dbg("checkPermIP: '%s' ? '%u.%u.%u.%u/%u.%u.%u.%u'\n",
-			rmt_ip_str,
-			(unsigned char)(cur->ip >> 24),
-			(unsigned char)(cur->ip >> 16),
-			(unsigned char)(cur->ip >> 8),
-			(unsigned char)(cur->ip),
-			(unsigned char)(cur->mask >> 24),
-			(unsigned char)(cur->mask >> 16),
-			(unsigned char)(cur->mask >> 8),
-			(unsigned char)(cur->mask)
-		);
-		if ((remote_ip & cur->mask) == cur->ip) {
-			if (cur->allow_deny == 'A')
-				return;
-			send_headers_and_exit(HTTP_FORBIDDEN);
+	const Htaccess_IP *rules = G.ip_a_d;
+	unsigned cnt = G.ip_a_d_cnt;
+	unsigned run;
+	smallint allowed = 0;
+
+	/* Rules are sorted by mask, then by ip. For each distinct mask,
+	 * binary search for remote_ip & mask within that run.
+	 * Any matching D rule denies; otherwise any matching A rule allows.
+	 */
+	for (run = 0; run < cnt;) {
+		unsigned mask = rules[run].mask;
+		unsigned key = remote_ip & mask;
+		unsigned lo, hi, end;
+
+		/* find end of this mask's run */
+		lo = run + 1;
+		hi = cnt;
+		while (lo < hi) {
+			unsigned mid = (lo + hi) / 2;
+			if (rules[mid].mask == mask)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		end = lo;
+
+		/* find first rule with ip >= key */
+		lo = run;
+		hi = end;
+		while (lo < hi) {
+			unsigned mid = (lo + hi) / 2;
+			if (rules[mid].ip < key)
+				lo = mid + 1;
+			else
+				hi = mid;
 		}
+		for (; lo < end && rules[lo].ip == key; lo++) {
+			dbg("checkPermIP: '%s' matches '%c:%u.%u.%u.%u/%u.%u.%u.%u'\n",
+				rmt_ip_str, rules[lo].allow_deny,
+				(unsigned char)(key >> 24),
+				(unsigned char)(key >> 16),
+				(unsigned char)(key >> 8),
+				(unsigned char)(key),
+				(unsigned char)(mask >> 24),
+				(unsigned char)(mask >> 16),
+				(unsigned char)(mask >> 8),
+				(unsigned char)(mask)
+			);
+			if (rules[lo].allow_deny == 'D')
+				send_headers_and_exit(HTTP_FORBIDDEN);
+			allowed = 1;
+		}
+		run = end;
 	}
 
+	if (allowed)
+		return;
 	if (flg_deny_all) /* depends on whether we saw "D:*" */
 		send_headers_and_exit(HTTP_FORBIDDEN);
 }
@@ -2200,13 +2630,13 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 		CGI_NORMAL,
 		CGI_INDEX,
 		CGI_INTERPRETER,
-	} cgi_type = CGI_NONE;
+	} cgi_type;
 #endif
 #if ENABLE_FEATURE_HTTPD_PROXY
 	Htaccess_Proxy *proxy_entry;
 #endif
 #if ENABLE_FEATURE_HTTPD_BASIC_AUTH
-	smallint authorized = -1;
+	smallint authorized;
 #endif
 	char *HTTP_slash;
 
@@ -2243,6 +2673,54 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 	/* Install timeout handler. get_line() needs it. */
 	signal(SIGALRM, send_REQUEST_TIMEOUT_and_exit);
 
+#if ENABLE_FEATURE_HTTPD_KEEP_ALIVE
+	/* Do not let Nagle hold back the body until peer ACKs
+	 * the headers: on a kept connection there is no FIN to flush it */
+	setsockopt_1(STDOUT_FILENO, IPPROTO_TCP, TCP_NODELAY);
+
+	if (setjmp(G.next_request)) {
+		/* Previous response is sent, connection stays open.
+		 * Forget per-request state and wait for the next request
+		 * (which may be already read, if client pipelines them).
+		 */
+		IF_FEATURE_HTTPD_GZIP(content_gzip = 0;)
+		file_size = -1;
+		found_mime_type = NULL;
+		found_moved_temporarily = NULL;
+		free(G.g_query_malloced);
+		G.g_query_malloced = NULL;
+		g_query = NULL;
+# if ENABLE_FEATURE_HTTPD_RANGES
+		range_start = -1;
+		range_end = 0;
+# endif
+# if ENABLE_FEATURE_HTTPD_ETAG
+		free(G.if_none_match);
+		G.if_none_match = NULL;
+# endif
+# if ENABLE_FEATURE_HTTPD_BASIC_AUTH
+		free(remoteuser);
+		remoteuser = NULL;
+# endif
+		if (hdr_cnt <= 0) {
+			struct pollfd pfd[1];
+			pfd[0].fd = STDIN_FILENO;
+			pfd[0].events = POLLIN;
+			if (safe_poll(pfd, 1, KEEP_ALIVE_TIMEOUT * 1000) <= 0) {
+				keep_alive = 0;
+				log_and_exit();
+			}
+		}
+	}
+	keep_alive = 0;
+#endif
+#if ENABLE_FEATURE_HTTPD_BASIC_AUTH
+	authorized = -1;
+#endif
+#if ENABLE_FEATURE_HTTPD_CGI
+	cgi_type = CGI_NONE;
+#endif
+
 	if (!get_line()) { /* EOF or error or empty line */
 		/* Observed Firefox to "speculatively" open
 		 * extra connections to a new site on first access,
@@ -2276,6 +2754,11 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 	if (!HTTP_slash || strncmp(HTTP_slash + 1, HTTP_200, 5) != 0)
 		send_headers_and_exit(HTTP_BAD_REQUEST);
 	*HTTP_slash++ = '\0';
+#if ENABLE_FEATURE_HTTPD_KEEP_ALIVE
+	/* HTTP/1.1 connections are persistent by default */
+	if (strcmp(HTTP_slash, "HTTP/1.0") > 0)
+		keep_alive = KEEP_ALIVE_REQUESTED;
+#endif
 
 #if ENABLE_FEATURE_HTTPD_PROXY
 	proxy_entry = find_proxy_entry(urlp);
@@ -2391,8 +2874,11 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 		/* have path1/path2 */
 		*tptr = '\0';
 		/* may have subdir config */
-		if (parse_conf(urlcopy + 1, SUBDIR_PARSE) == 0)
+		if (parse_conf(urlcopy + 1, SUBDIR_PARSE) == 0) {
+			/* config changed, don't serve more requests with it */
+			IF_FEATURE_HTTPD_KEEP_ALIVE(keep_alive = KEEP_ALIVE_NEVER;)
 			if_ip_denied_send_HTTP_FORBIDDEN_and_exit(remote_ip);
+		}
 		*tptr = '/';
 	}
 
@@ -2414,8 +2900,10 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 		 * query string would be lost and not available to the CGI.
 		 * Work around it by making a deep copy.
 		 */
-		if (ENABLE_FEATURE_HTTPD_CGI)
+		if (ENABLE_FEATURE_HTTPD_CGI) {
 			g_query = xstrdup(g_query); /* ok for NULL too */
+			IF_FEATURE_HTTPD_KEEP_ALIVE(G.g_query_malloced = g_query;)
+		}
 		strcpy(urlp, index_page);
 	}
 	if (stat(tptr, &sb) == 0) {
@@ -2438,6 +2926,8 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 #endif
 			file_size = sb.st_size;
 			last_mod = sb.st_mtime;
+			IF_FEATURE_HTTPD_KEEP_ALIVE(G.file_dev = sb.st_dev;)
+			IF_FEATURE_HTTPD_KEEP_ALIVE(G.file_ino = sb.st_ino;)
 		}
 	}
 #if ENABLE_FEATURE_HTTPD_CGI
@@ -2472,6 +2962,18 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 			send_headers_and_exit(HTTP_ENTITY_TOO_LARGE);
 #endif
 		dbg("header:'%s'\n", iobuf);
+#if ENABLE_FEATURE_HTTPD_KEEP_ALIVE
+		/* Only CGI reads request body. Elsewhere, body left unread
+		 * on a kept connection would be taken for the next request */
+		if (STRNCASECMP(iobuf, "Transfer-Encoding:") == 0)
+			keep_alive = KEEP_ALIVE_NEVER;
+		if (STRNCASECMP(iobuf, "Content-Length:") == 0) {
+			const char *s = skip_whitespace(iobuf + sizeof("Content-Length:") - 1);
+			s += strspn(s, "0");
+			if (*skip_whitespace(s)) /* not zero */
+				keep_alive = KEEP_ALIVE_NEVER;
+		}
+#endif
 #if ENABLE_FEATURE_HTTPD_CGI
 		/* Only POST needs to know POST_length */
 		if (prequest == request_POST && STRNCASECMP(iobuf, "Content-Length:") == 0) {
@@ -2538,6 +3040,16 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 			continue;
 		}
 #endif
+#if ENABLE_FEATURE_HTTPD_KEEP_ALIVE
+		if (STRNCASECMP(iobuf, "Connection:") == 0 && keep_alive >= 0) {
+			/* not "continue"ing: CGI wants it as $HTTP_CONNECTION */
+			const char *s = iobuf + sizeof("Connection:") - 1;
+			if (strcasestr(s, "close"))
+				keep_alive = 0;
+			else if (strcasestr(s, "keep-alive"))
+				keep_alive = KEEP_ALIVE_REQUESTED;
+		}
+#endif
 #if ENABLE_FEATURE_HTTPD_ETAG
 		if (STRNCASECMP(iobuf, "If-None-Match:") == 0) {
 			free(G.if_none_match);
@@ -2750,6 +3262,7 @@ enum {
 	IF_FEATURE_HTTPD_BASIC_AUTH(    r_opt_realm     ,)
 	IF_FEATURE_HTTPD_AUTH_MD5(      m_opt_md5       ,)
 	IF_FEATURE_HTTPD_SETUID(        u_opt_setuid    ,)
+	IF_FEATURE_HTTPD_GZIP_CACHE(    z_opt_gzip_cache,)
 	p_opt_port      ,
 	p_opt_inetd     ,
 	p_opt_foreground,
@@ -2796,6 +3309,7 @@ int httpd_main(int argc UNUSED_PARAM, char **argv)
 			IF_FEATURE_HTTPD_BASIC_AUTH("r:")
 			IF_FEATURE_HTTPD_AUTH_MD5("m:")
 			IF_FEATURE_HTTPD_SETUID("u:")
+			IF_FEATURE_HTTPD_GZIP_CACHE("z:")
 			"p:ifv"
 			"\0"
 			/* -v counts, -i implies -f */
@@ -2805,6 +3319,7 @@ int httpd_main(int argc UNUSED_PARAM, char **argv)
 			IF_FEATURE_HTTPD_BASIC_AUTH(, &g_realm)
 			IF_FEATURE_HTTPD_AUTH_MD5(, &pass)
 			IF_FEATURE_HTTPD_SETUID(, &s_ugid)
+			IF_FEATURE_HTTPD_GZIP_CACHE(, &G.gzip_cache_dir)
 			, &bind_addr_or_port
 			, &verbose
 		);
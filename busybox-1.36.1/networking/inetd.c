@@ -137,6 +137,11 @@
  * IPv6 addresses are also implemented. However, they may look ugly -
  * ":::service..." means "address '::' (IPv6 wildcard addr)":"service"...
  * You have to put "tcp6"/"udp6" in protocol field to select IPv6.
+ *
+ * Another extension is "wait[.max]/N": up to N copies of a "wait"
+ * server are allowed to share the listening socket. While fewer than N
+ * are running and the socket is readable, inetd starts another one;
+ * when N are running, it stops looking at the socket until one exits.
  */
 
 /* Here's the scoop concerning the user[:group] feature:
@@ -219,6 +224,25 @@
 //config:	depends on INETD
 //config:	help
 //config:	Support Sun-RPC based services
+//config:
+//config:config FEATURE_INETD_EPOLL
+//config:	bool "Use epoll to wait for connections"
+//config:	default y
+//config:	depends on INETD
+//config:	help
+//config:	Wait for connections with Linux-specific epoll instead of
+//config:	select. Each ready socket is then found without walking
+//config:	the list of all services, and the number of services is not
+//config:	limited by FD_SETSIZE (usually 1024).
+//config:
+//config:config FEATURE_INETD_WAIT_POOL
+//config:	bool "Support multiple instances of \"wait\" services"
+//config:	default y
+//config:	depends on INETD
+//config:	help
+//config:	Allow "wait/N" in the wait field: up to N instances
+//config:	of the server may run at the same time, all accepting
+//config:	connections on the same listening socket.
 
 //applet:IF_INETD(APPLET(inetd, BB_DIR_USR_SBIN, BB_SUID_DROP))
 
@@ -239,6 +263,9 @@
 #include <sys/resource.h> /* setrlimit */
 #include <sys/socket.h> /* un.h may need this */
 #include <sys/un.h>
+#if ENABLE_FEATURE_INETD_EPOLL
+# include <sys/epoll.h>
+#endif
 
 #include "libbb.h"
 #include "common_bufsiz.h"
@@ -306,6 +333,11 @@ typedef struct servtab_t {
 #endif
 	pid_t se_wait;                        /* 0:"nowait", 1:"wait", >1:"wait" */
 	                                      /* and waiting for this pid */
+#if ENABLE_FEATURE_INETD_WAIT_POOL
+	unsigned se_pool;                     /* "wait/N": N, else 0 */
+	unsigned se_running;                  /* instances running now */
+	pid_t *se_pool_pid;                   /* their pids, se_pool elements */
+#endif
 	socktype_t se_socktype;               /* SOCK_STREAM/DGRAM/RDM/... */
 	family_t se_family;                   /* AF_UNIX/INET[6] */
 	/* se_proto_no is used by RPC code only... hmm */
@@ -385,11 +417,18 @@ struct globals {
 	struct rlimit rlim_ofile;
 	servtab_t *serv_list;
 	int global_queuelen;
+#if ENABLE_FEATURE_INETD_EPOLL
+	int epoll_fd;
+	unsigned fd2sep_size;
+	servtab_t **fd2sep;  /* listening fd -> its service, NULL if not listening */
+#else
 	int maxsock;         /* max fd# in allsock, -1: unknown */
 	/* whenever maxsock grows, prev_maxsock is set to new maxsock,
 	 * but if maxsock is set to -1, prev_maxsock is not changed */
 	int prev_maxsock;
+#endif
 	unsigned max_concurrency;
+	unsigned wait_children; /* "wait" children we did not reap yet */
 	smallint alarm_armed;
 	uid_t real_uid; /* user ID who ran us */
 	const char *config_filename;
@@ -400,7 +439,9 @@ struct globals {
 	char *ring_pos;
 	char ring[128];
 #endif
+#if !ENABLE_FEATURE_INETD_EPOLL
 	fd_set allsock;
+#endif
 	/* Used in next_line(), and as scratch read buffer */
 	char line[256];          /* _at least_ 256, see LINE_SIZE */
 } FIX_ALIASING;
@@ -410,9 +451,13 @@ enum { LINE_SIZE = COMMON_BUFSIZE - offsetof(struct globals, line) };
 #define rlim_ofile      (G.rlim_ofile     )
 #define serv_list       (G.serv_list      )
 #define global_queuelen (G.global_queuelen)
+#define epoll_fd        (G.epoll_fd       )
+#define fd2sep_size     (G.fd2sep_size    )
+#define fd2sep          (G.fd2sep         )
 #define maxsock         (G.maxsock        )
 #define prev_maxsock    (G.prev_maxsock   )
 #define max_concurrency (G.max_concurrency)
+#define wait_children   (G.wait_children  )
 #define alarm_armed     (G.alarm_armed    )
 #define real_uid        (G.real_uid       )
 #define config_filename (G.config_filename)
@@ -536,7 +581,8 @@ static void bump_nofile(void)
 	/* Never fails under Linux (except if you pass it bad arguments) */
 	getrlimit(RLIMIT_NOFILE, &rl);
 	rl.rlim_cur = MIN(rl.rlim_max, rl.rlim_cur + FD_CHUNK);
-	rl.rlim_cur = MIN(FD_SETSIZE, rl.rlim_cur + FD_CHUNK);
+	if (!ENABLE_FEATURE_INETD_EPOLL)
+		rl.rlim_cur = MIN(FD_SETSIZE, rl.rlim_cur + FD_CHUNK);
 	if (rl.rlim_cur <= rlim_ofile_cur) {
 		bb_error_msg("can't extend file limit, max = %d",
 						(int) rl.rlim_cur);
@@ -551,8 +597,47 @@ static void bump_nofile(void)
 	rlim_ofile_cur = rl.rlim_cur;
 }
 
-static void remove_fd_from_set(int fd)
+#if ENABLE_FEATURE_INETD_EPOLL
+static void remove_fd_from_set(servtab_t *sep)
+{
+	int fd = sep->se_fd;
+	if (fd >= 0 && (unsigned)fd < fd2sep_size && fd2sep[fd]) {
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+		fd2sep[fd] = NULL;
+		dbg("stopped listening on fd:%d\n", fd);
+	}
+}
+
+static void add_fd_to_set(servtab_t *sep)
+{
+	int fd = sep->se_fd;
+	if (fd >= 0) {
+		struct epoll_event ev;
+
+		if ((unsigned)fd >= fd2sep_size) {
+			unsigned old_size = fd2sep_size;
+			fd2sep_size = (fd | 0x3f) + 1;
+			fd2sep = xrealloc(fd2sep, fd2sep_size * sizeof(fd2sep[0]));
+			memset(fd2sep + old_size, 0, (fd2sep_size - old_size) * sizeof(fd2sep[0]));
+		}
+		if (fd2sep[fd]) /* already listening */
+			return;
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			bb_perror_msg("epoll_ctl(%d)", fd);
+			return;
+		}
+		fd2sep[fd] = sep;
+		dbg("started listening on fd:%d\n", fd);
+		if ((rlim_t)fd > rlim_ofile_cur - FD_MARGIN)
+			bump_nofile();
+	}
+}
+#else
+static void remove_fd_from_set(servtab_t *sep)
 {
+	int fd = sep->se_fd;
 	if (fd >= 0) {
 		FD_CLR(fd, &allsock);
 		dbg("stopped listening on fd:%d\n", fd);
@@ -561,8 +646,9 @@ static void remove_fd_from_set(int fd)
 	}
 }
 
-static void add_fd_to_set(int fd)
+static void add_fd_to_set(servtab_t *sep)
 {
+	int fd = sep->se_fd;
 	if (fd >= 0) {
 		FD_SET(fd, &allsock);
 		dbg("started listening on fd:%d\n", fd);
@@ -592,6 +678,7 @@ static void recalculate_maxsock(void)
 	if ((rlim_t)maxsock > rlim_ofile_cur - FD_MARGIN)
 		bump_nofile();
 }
+#endif
 
 static void prepare_socket_fd(servtab_t *sep)
 {
@@ -652,9 +739,13 @@ static void prepare_socket_fd(servtab_t *sep)
 	} else {
 		dbg("new sep->se_fd:%d (!stream)\n", fd);
 	}
+	/* With epoll, children don't walk serv_list to close
+	 * listening sockets, exec does it */
+	if (ENABLE_FEATURE_INETD_EPOLL)
+		close_on_exec_on(fd);
 
-	add_fd_to_set(fd);
 	sep->se_fd = fd;
+	add_fd_to_set(sep);
 }
 
 static int reopen_config_file(void)
@@ -685,6 +776,9 @@ static void free_servtab_strings(servtab_t *cp)
 	free(cp->se_user);
 	free(cp->se_group);
 	free(cp->se_lsa); /* not a string in fact */
+#if ENABLE_FEATURE_INETD_WAIT_POOL
+	free(cp->se_pool_pid); /* neither is this */
+#endif
 	free(cp->se_program);
 	for (i = 0; i < MAXARGV; i++)
 		free(cp->se_argv[i]);
@@ -844,8 +938,18 @@ static NOINLINE servtab_t *parse_one_line(void)
 			goto parse_err;
 	}
 
-	/* [no]wait[.max] user[:group] prog [args] */
+	/* [no]wait[.max][/N] user[:group] prog [args] */
 	arg = token[3];
+#if ENABLE_FEATURE_INETD_WAIT_POOL
+	p = strchr(arg, '/');
+	if (p) {
+		*p++ = '\0';
+		sep->se_pool = bb_strtou(p, NULL, 10);
+		if (errno || sep->se_pool > 1024)
+			goto parse_err;
+		/* se_pool_pid[] is allocated when first instance starts */
+	}
+#endif
 	sep->se_max = max_concurrency;
 	p = strchr(arg, '.');
 	if (p) {
@@ -859,6 +963,10 @@ static NOINLINE servtab_t *parse_one_line(void)
 		arg += 2;
 	if (strcmp(arg, "wait") != 0)
 		goto parse_err;
+#if ENABLE_FEATURE_INETD_WAIT_POOL
+	if (!sep->se_wait && sep->se_pool) /* "nowait/N"?? */
+		goto parse_err;
+#endif
 
 	/* user[:group] prog [args] */
 	sep->se_user = xstrdup(token[4]);
@@ -1009,10 +1117,18 @@ static void reread_config_file(int sig UNUSED_PARAM)
 				 * for a child (and not accepting connects).
 				 * Stop waiting, start listening again.
 				 * (if it's not true, this op is harmless) */
-				add_fd_to_set(sep->se_fd);
+				add_fd_to_set(sep);
 			}
 			sep->se_wait = cp->se_wait;
 			sep->se_max = cp->se_max;
+#if ENABLE_FEATURE_INETD_WAIT_POOL
+			/* Don't forget pids of instances which still run */
+			if (sep->se_running == 0) {
+				free(sep->se_pool_pid);
+				sep->se_pool_pid = NULL;
+				sep->se_pool = cp->se_pool;
+			}
+#endif
 			/* string fields need more love - we don't want to leak them */
 #define SWAP(type, a, b) do { type c = (type)a; a = (type)b; b = (type)c; } while (0)
 			SWAP(char*, sep->se_user, cp->se_user);
@@ -1094,7 +1210,7 @@ static void reread_config_file(int sig UNUSED_PARAM)
 		 || lsa->len != sep->se_lsa->len
 		 || memcmp(&lsa->u.sa, &sep->se_lsa->u.sa, lsa->len) != 0
 		) {
-			remove_fd_from_set(sep->se_fd);
+			remove_fd_from_set(sep);
 			maybe_close(sep->se_fd);
 			free(sep->se_lsa);
 			sep->se_lsa = lsa;
@@ -1121,7 +1237,7 @@ static void reread_config_file(int sig UNUSED_PARAM)
 			continue;
 		}
 		*sepp = sep->se_next;
-		remove_fd_from_set(sep->se_fd);
+		remove_fd_from_set(sep);
 		maybe_close(sep->se_fd);
 #if ENABLE_FEATURE_INETD_RPC
 		if (is_rpc_service(sep))
@@ -1137,6 +1253,27 @@ static void reread_config_file(int sig UNUSED_PARAM)
 	errno = save_errno;
 }
 
+#if ENABLE_FEATURE_INETD_WAIT_POOL
+/* If pid is one of "wait/N" instances of sep, forget it */
+static int pool_forget_pid(servtab_t *sep, pid_t pid)
+{
+	unsigned i;
+
+	if (sep->se_pool_pid) {
+		for (i = 0; i < sep->se_pool; i++) {
+			if (sep->se_pool_pid[i] == pid) {
+				sep->se_pool_pid[i] = 0;
+				sep->se_running--;
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+#else
+# define pool_forget_pid(sep, pid) 0
+#endif
+
 static void reap_child(int sig UNUSED_PARAM)
 {
 	pid_t pid;
@@ -1148,9 +1285,16 @@ static void reap_child(int sig UNUSED_PARAM)
 		pid = wait_any_nohang(&status);
 		if (pid <= 0)
 			break;
+		/* Most children are "nowait" ones, don't walk
+		 * the whole serv_list for each of them */
+		if (wait_children == 0)
+			continue;
 		for (sep = serv_list; sep; sep = sep->se_next) {
-			if (sep->se_wait != pid)
+			if (sep->se_wait == pid)
+				sep->se_wait = 1;
+			else if (!pool_forget_pid(sep, pid))
 				continue;
+			wait_children--;
 			/* One of our "wait" services */
 			if (WIFEXITED(status) && WEXITSTATUS(status))
 				bb_error_msg("%s: exit status %u",
@@ -1158,8 +1302,7 @@ static void reap_child(int sig UNUSED_PARAM)
 			else if (WIFSIGNALED(status))
 				bb_error_msg("%s: exit signal %u",
 						sep->se_program, WTERMSIG(status));
-			sep->se_wait = 1;
-			add_fd_to_set(sep->se_fd);
+			add_fd_to_set(sep);
 			break;
 		}
 	}
@@ -1264,6 +1407,12 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 	if (rlim_ofile_cur == RLIM_INFINITY)    /* ! */
 		rlim_ofile_cur = OPEN_MAX;
 
+#if ENABLE_FEATURE_INETD_EPOLL
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+		bb_simple_perror_msg_and_die("epoll_create1");
+#endif
+
 	memset(&sa, 0, sizeof(sa));
 	/*sigemptyset(&sa.sa_mask); - memset did it */
 	sigaddset(&sa.sa_mask, SIGALRM);
@@ -1292,6 +1441,31 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 	for (;;) {
 		int ready_fd_cnt;
 		int ctrl, accepted_fd, new_udp_fd;
+#if ENABLE_FEATURE_INETD_EPOLL
+		struct epoll_event events[16];
+		int i;
+
+		/* if there are no fds to wait on, we will block
+		 * until signal wakes us up */
+		ready_fd_cnt = epoll_wait(epoll_fd, events, ARRAY_SIZE(events), -1);
+		if (ready_fd_cnt < 0) {
+			if (errno != EINTR) {
+				bb_simple_perror_msg("epoll_wait");
+				sleep1();
+			}
+			continue;
+		}
+		dbg("ready_fd_cnt:%d\n", ready_fd_cnt);
+
+		for (i = 0; i < ready_fd_cnt; i++) {
+			int fd = events[i].data.fd;
+
+			/* An earlier event in this batch (or a signal)
+			 * may have made us stop listening on fd */
+			sep = ((unsigned)fd < fd2sep_size) ? fd2sep[fd] : NULL;
+			if (!sep || sep->se_fd != fd)
+				continue;
+#else
 		fd_set readable;
 
 		if (maxsock < 0)
@@ -1314,9 +1488,9 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 		for (sep = serv_list; ready_fd_cnt && sep; sep = sep->se_next) {
 			if (sep->se_fd == -1 || !FD_ISSET(sep->se_fd, &readable))
 				continue;
-
-			dbg("ready fd:%d\n", sep->se_fd);
 			ready_fd_cnt--;
+#endif
+			dbg("ready fd:%d\n", sep->se_fd);
 			ctrl = sep->se_fd;
 			accepted_fd = -1;
 			new_udp_fd = -1;
@@ -1381,7 +1555,7 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 						if (now - sep->se_time <= CNT_INTERVAL) {
 							bb_error_msg("%s/%s: too many connections, pausing",
 									sep->se_service, sep->se_proto);
-							remove_fd_from_set(sep->se_fd);
+							remove_fd_from_set(sep);
 							close(sep->se_fd);
 							sep->se_fd = -1;
 							sep->se_count = 0;
@@ -1421,14 +1595,39 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 				if (sep->se_wait) {
 					/* wait: we passed socket to child,
 					 * will wait for child to terminate */
-					sep->se_wait = pid;
-					remove_fd_from_set(sep->se_fd);
+					wait_children++;
+#if ENABLE_FEATURE_INETD_WAIT_POOL
+					if (sep->se_pool) {
+						unsigned n = 0;
+						if (!sep->se_pool_pid)
+							sep->se_pool_pid = xzalloc(sep->se_pool * sizeof(sep->se_pool_pid[0]));
+						/* we only get here if there is a free slot */
+						while (sep->se_pool_pid[n])
+							n++;
+						sep->se_pool_pid[n] = pid;
+						/* no room for more? stop listening */
+						if (++sep->se_running >= sep->se_pool)
+							remove_fd_from_set(sep);
+					} else
+#endif
+					{
+						sep->se_wait = pid;
+						remove_fd_from_set(sep);
+					}
 				}
 				if (new_udp_fd >= 0) {
 					/* udp nowait: child connected the socket,
-					 * we created and will use new, unconnected one */
+					 * we created and will use new, unconnected one.
+					 * epoll tracks the old one (child has it open),
+					 * re-register */
+					if (ENABLE_FEATURE_INETD_EPOLL)
+						remove_fd_from_set(sep);
 					xmove_fd(new_udp_fd, sep->se_fd);
 					dbg("moved new_udp_fd:%d to sep->se_fd:%d\n", new_udp_fd, sep->se_fd);
+					if (ENABLE_FEATURE_INETD_EPOLL) {
+						close_on_exec_on(sep->se_fd);
+						add_fd_to_set(sep);
+					}
 				}
 				restore_sigmask(&omask);
 				maybe_close(accepted_fd);
@@ -1517,10 +1716,13 @@ int inetd_main(int argc UNUSED_PARAM, char **argv)
 			if (!sep->se_wait) /* only for usual "tcp nowait" */
 				xdup2(STDIN_FILENO, STDERR_FILENO);
 			/* NB: among others, this loop closes listening sockets
-			 * for nowait stream children */
-			for (sep2 = serv_list; sep2; sep2 = sep2->se_next)
-				if (sep2->se_fd != ctrl)
-					maybe_close(sep2->se_fd);
+			 * for nowait stream children.
+			 * With epoll, they are close-on-exec */
+			if (!ENABLE_FEATURE_INETD_EPOLL) {
+				for (sep2 = serv_list; sep2; sep2 = sep2->se_next)
+					if (sep2->se_fd != ctrl)
+						maybe_close(sep2->se_fd);
+			}
 			sigaction_set(SIGPIPE, &saved_pipe_handler);
 			restore_sigmask(&omask);
 			dbg("execing:'%s'\n", sep->se_program);
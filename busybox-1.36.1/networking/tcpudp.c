@@ -127,7 +127,7 @@ struct globals {
 	unsigned cur_per_host;
 	unsigned cnum;
 	unsigned cmax;
-	struct hcc *cc;
+	struct hcc_table *cc;
 	char **env_cur;
 	char *env_var[1]; /* actually bigger */
 } FIX_ALIASING;
@@ -501,7 +501,7 @@ int tcpudpsvd_main(int argc UNUSED_PARAM, char **argv)
 		cnum++;
 		if_verbose_print_connection_status();
 		if (hccp)
-			hccp->pid = pid;
+			ipsvd_perhost_setpid(G.cc, hccp, pid);
 		/* clean up changes done by vforked child */
 		undo_xsetenv();
 		goto again;
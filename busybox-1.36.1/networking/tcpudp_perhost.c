@@ -10,52 +10,113 @@
 #include "libbb.h"
 #include "tcpudp_perhost.h"
 
-struct hcc* FAST_FUNC ipsvd_perhost_init(unsigned c)
+/* Connections are hashed both by ip (to count connects from it)
+ * and by pid (to find the one which ended on SIGCHLD),
+ * so neither needs to look through all of them */
+struct hcc {
+	char *ip;
+	int pid;
+	struct hcc *ip_next;
+	struct hcc *pid_next; /* also links unused entries */
+};
+
+struct hcc_table {
+	unsigned mask;
+	struct hcc *free_list;
+	struct hcc **ip_hash;
+	struct hcc **pid_hash;
+};
+
+static unsigned hash_ip(const char *ip)
 {
-//	free(cc);
-	struct hcc *cc = xzalloc((c + 1) * sizeof(*cc));
-	cc[c].pid = -1; /* "end" marker */
-	return cc;
+	/* FNV-1a */
+	unsigned h = 0x811c9dc5;
+	while (*ip)
+		h = (h ^ (unsigned char)*ip++) * 0x01000193;
+	return h;
+}
+
+struct hcc_table* FAST_FUNC ipsvd_perhost_init(unsigned c)
+{
+	struct hcc_table *tab;
+	struct hcc *cc;
+	unsigned size;
+
+	size = 1;
+	while (size < c)
+		size <<= 1;
+	tab = xzalloc(sizeof(*tab)
+		+ 2 * size * sizeof(tab->ip_hash[0])
+		+ c * sizeof(*cc)
+	);
+	tab->mask = size - 1;
+	tab->ip_hash = (void*)(tab + 1);
+	tab->pid_hash = tab->ip_hash + size;
+	cc = (void*)(tab->pid_hash + size);
+	while (c) {
+		c--;
+		cc[c].pid_next = tab->free_list;
+		tab->free_list = &cc[c];
+	}
+	return tab;
 }
 
-unsigned FAST_FUNC ipsvd_perhost_add(struct hcc *cc, char *ip, unsigned maxconn, struct hcc **hccpp)
+unsigned FAST_FUNC ipsvd_perhost_add(struct hcc_table *tab, char *ip, unsigned maxconn, struct hcc **hccpp)
 {
-	unsigned i;
+	struct hcc **bucket;
+	struct hcc *hcc;
 	unsigned conn = 1;
-	int freepos = -1;
 
-	for (i = 0; cc[i].pid >= 0; ++i) {
-		if (!cc[i].ip) {
-			freepos = i;
-			continue;
-		}
-		if (strcmp(cc[i].ip, ip) == 0) {
+	bucket = &tab->ip_hash[hash_ip(ip) & tab->mask];
+	for (hcc = *bucket; hcc; hcc = hcc->ip_next) {
+		if (strcmp(hcc->ip, ip) == 0)
 			conn++;
-			continue;
-		}
 	}
-	if (freepos == -1) return 0;
+	hcc = tab->free_list;
+	if (!hcc) return 0;
 	if (conn <= maxconn) {
-		cc[freepos].ip = ip;
-		*hccpp = &cc[freepos];
+		tab->free_list = hcc->pid_next;
+		hcc->ip = ip;
+		hcc->pid = 0;
+		hcc->pid_next = NULL;
+		hcc->ip_next = *bucket;
+		*bucket = hcc;
+		*hccpp = hcc;
 	}
 	return conn;
 }
 
-void FAST_FUNC ipsvd_perhost_remove(struct hcc *cc, int pid)
+void FAST_FUNC ipsvd_perhost_setpid(struct hcc_table *tab, struct hcc *hcc, int pid)
 {
-	unsigned i;
-	for (i = 0; cc[i].pid >= 0; ++i) {
-		if (cc[i].pid == pid) {
-			free(cc[i].ip);
-			cc[i].ip = NULL;
-			cc[i].pid = 0;
+	struct hcc **bucket = &tab->pid_hash[pid & tab->mask];
+
+	hcc->pid = pid;
+	hcc->pid_next = *bucket;
+	*bucket = hcc;
+}
+
+void FAST_FUNC ipsvd_perhost_remove(struct hcc_table *tab, int pid)
+{
+	struct hcc **pp;
+	struct hcc *hcc;
+
+	for (pp = &tab->pid_hash[pid & tab->mask]; (hcc = *pp) != NULL; pp = &hcc->pid_next) {
+		if (hcc->pid == pid) {
+			*pp = hcc->pid_next;
+			pp = &tab->ip_hash[hash_ip(hcc->ip) & tab->mask];
+			while (*pp != hcc)
+				pp = &(*pp)->ip_next;
+			*pp = hcc->ip_next;
+			free(hcc->ip);
+			hcc->ip = NULL;
+			hcc->pid_next = tab->free_list;
+			tab->free_list = hcc;
 			return;
 		}
 	}
 }
 
-//void ipsvd_perhost_free(struct hcc *cc)
+//void ipsvd_perhost_free(struct hcc_table *tab)
 //{
-//	free(cc);
+//	free(tab);
 //}
@@ -9,25 +9,25 @@
 
 PUSH_AND_SET_FUNCTION_VISIBILITY_TO_HIDDEN
 
-struct hcc {
-	char *ip;
-	int pid;
-};
+struct hcc;
+struct hcc_table;
 
-struct hcc* FAST_FUNC ipsvd_perhost_init(unsigned);
+struct hcc_table* FAST_FUNC ipsvd_perhost_init(unsigned);
 
 /* Returns number of already opened connects to this ips, including this one.
  * ip should be a malloc'ed ptr.
  * If return value is <= maxconn, ip is inserted into the table
  * and pointer to table entry if stored in *hccpp
- * (useful for storing pid later).
+ * (for ipsvd_perhost_setpid later).
  * Else ip is NOT inserted (you must take care of it - free() etc) */
-unsigned FAST_FUNC ipsvd_perhost_add(struct hcc *cc, char *ip, unsigned maxconn, struct hcc **hccpp);
+unsigned FAST_FUNC ipsvd_perhost_add(struct hcc_table *tab, char *ip, unsigned maxconn, struct hcc **hccpp);
+
+/* Records pid of the process serving the connection */
+void FAST_FUNC ipsvd_perhost_setpid(struct hcc_table *tab, struct hcc *hcc, int pid);
 
 /* Finds and frees element with pid */
-void FAST_FUNC ipsvd_perhost_remove(struct hcc *cc, int pid);
+void FAST_FUNC ipsvd_perhost_remove(struct hcc_table *tab, int pid);
 
-//unsigned ipsvd_perhost_setpid(int pid);
-//void ipsvd_perhost_free(struct hcc *cc);
+//void ipsvd_perhost_free(struct hcc_table *tab);
 
 POP_SAVED_FUNCTION_VISIBILITY
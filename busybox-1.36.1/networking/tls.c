@@ -7,7 +7,8 @@
 //config:	bool #No description makes it a hidden option
 //config:	default n
 //Note:
-//Config.src also defines FEATURE_TLS_SHA1 option
+//Config.src also defines FEATURE_TLS_SHA1, FEATURE_TLS_AES_HWACCEL
+//and FEATURE_TLS_SESSION_CACHE options
 
 //kbuild:lib-$(CONFIG_TLS) += tls.o
 //kbuild:lib-$(CONFIG_TLS) += tls_pstm.o
@@ -16,6 +17,8 @@
 //kbuild:lib-$(CONFIG_TLS) += tls_pstm_sqr_comba.o
 //kbuild:lib-$(CONFIG_TLS) += tls_aes.o
 //kbuild:lib-$(CONFIG_TLS) += tls_aesgcm.o
+//kbuild:lib-$(CONFIG_TLS) += tls_aesgcm_x86-64_aesNI.o
+//kbuild:lib-$(CONFIG_TLS) += tls_chacha20poly1305.o
 //kbuild:lib-$(CONFIG_TLS) += tls_rsa.o
 //kbuild:lib-$(CONFIG_TLS) += tls_fe.o
 //kbuild:lib-$(CONFIG_TLS) += tls_sp_c32.o
@@ -29,6 +32,8 @@
 #define ALLOW_ECDHE_RSA_WITH_AES_128_CBC_SHA256         1
 #define ALLOW_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256       1
 #define ALLOW_ECDHE_RSA_WITH_AES_128_GCM_SHA256         1
+#define ALLOW_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256 1
+#define ALLOW_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256   1
 #define ALLOW_RSA_WITH_AES_128_CBC_SHA256       1
 #define ALLOW_RSA_WITH_AES_256_CBC_SHA256       1
 #define ALLOW_RSA_WITH_AES_128_GCM_SHA256       1
@@ -245,6 +250,7 @@ enum {
 	GOT_EC_CURVE_X25519    = 1 << 4, // else P256
 	ENCRYPTION_AESGCM      = 1 << 5, // else AES-SHA (or NULL-SHA if ALLOW_RSA_NULL_SHA256=1)
 	ENCRYPT_ON_WRITE       = 1 << 6,
+	ENCRYPTION_CHACHA20    = 1 << 7, // CHACHA20-POLY1305, ENCRYPTION_AESGCM is not set
 };
 
 struct record_hdr {
@@ -269,6 +275,18 @@ struct tls_handshake_data {
 	/* for P256, it contains x,y point pair, each 32 bytes long */
 	uint8_t ecc_pub_key32[2 * 32];
 
+	/* RFC 5077 session ticket, see session_cache_load() */
+	const char *cache_file; /* NULL if session cache is not used */
+	const char *sni;
+	uint8_t *ticket;
+	unsigned ticket_len;
+	unsigned ticket_lifetime;
+	uint16_t cached_cipher_id;
+	smallint offered_ticket;
+	smallint got_new_ticket;
+	smallint resumed;
+	uint8_t session_id[32];
+
 /* HANDSHAKE HASH: */
 	//unsigned saved_client_hello_size;
 	//uint8_t saved_client_hello[1];
@@ -335,7 +353,7 @@ void FAST_FUNC tls_get_random(void *buf, unsigned len)
 		xfunc_die();
 }
 
-static void xorbuf3(void *dst, const void *src1, const void *src2, unsigned count)
+void FAST_FUNC xorbuf3(void *dst, const void *src1, const void *src2, unsigned count)
 {
 	uint8_t *d = dst;
 	const uint8_t *s1 = src1;
@@ -832,8 +850,6 @@ static void xwrite_encrypted_aesgcm(tls_state_t *tls, unsigned size, unsigned ty
 	uint8_t authtag[AES_BLOCK_SIZE] ALIGNED_long; //[16]
 	uint8_t *buf;
 	struct record_hdr *xhdr;
-	unsigned remaining;
-	unsigned cnt;
 	uint64_t t64;
 
 	buf = tls->outbuf + OUTBUF_PFX; /* see above for the byte it points to */
@@ -857,19 +873,9 @@ static void xwrite_encrypted_aesgcm(tls_state_t *tls, unsigned size, unsigned ty
 	/* seq64 is not used later in this func, can increment here */
 	tls->write_seq64_be = SWAP_BE64(1 + SWAP_BE64(t64));
 
-	cnt = 1;
-	remaining = size;
-	while (remaining != 0) {
-		unsigned n;
-
-		cnt++;
-		COUNTER(nonce) = htonl(cnt); /* yes, first cnt here is 2 (!) */
-		aes_encrypt_one_block(&tls->aes_encrypt, nonce, scratch);
-		n = remaining > AES_BLOCK_SIZE ? AES_BLOCK_SIZE : remaining;
-		xorbuf(buf, scratch, n);
-		buf += n;
-		remaining -= n;
-	}
+	COUNTER(nonce) = htonl(2); /* yes, first counter here is 2 (!) */
+	aesgcm_CTR(&tls->aes_encrypt, nonce, buf, buf, size);
+	buf += size;
 
 	aesgcm_GHASH(tls->H, aad, /*sizeof(aad),*/ tls->outbuf + OUTBUF_PFX, size, authtag /*, sizeof(authtag)*/);
 	COUNTER(nonce) = htonl(1);
@@ -893,8 +899,62 @@ static void xwrite_encrypted_aesgcm(tls_state_t *tls, unsigned size, unsigned ty
 #undef COUNTER
 }
 
+/* RFC 7905: no explicit nonce, nonce is the 12-byte IV xored with
+ * 64-bit sequence number (left-padded with zeros):
+ * aad:  seq64 | type | maj.min | len16
+ * sent: 17 03 03 LL LL|ciphertext...|tag16
+ * ......................^^ buf points here
+ */
+static void xwrite_encrypted_chacha20poly1305(tls_state_t *tls, unsigned size, unsigned type)
+{
+	uint8_t aad[13];
+	uint8_t nonce[CHACHA20_NONCESIZE];
+	uint8_t *buf;
+	struct record_hdr *xhdr;
+	uint64_t t64;
+
+	buf = tls->outbuf + OUTBUF_PFX;
+	dump_hex("xwrite_encrypted_chacha20poly1305 plaintext:%s\n", buf, size);
+
+	t64 = tls->write_seq64_be;
+	move_to_unaligned64(aad, t64);
+	aad[8] = type;
+	aad[9] = TLS_MAJ;
+	aad[10] = TLS_MIN;
+	aad[11] = size >> 8;
+	aad[12] = size & 0xff;
+	tls->write_seq64_be = SWAP_BE64(1 + SWAP_BE64(t64));
+
+	memset(nonce, 0, 4);
+	memcpy(nonce + 4, aad, 8);
+	xorbuf(nonce, tls->client_write_IV, CHACHA20_NONCESIZE);
+
+	chacha20poly1305_encrypt(tls->client_write_key, nonce,
+		aad, sizeof(aad),
+		buf, size,
+		buf + size
+	);
+
+	/* Write out */
+	xhdr = (void*)(buf - RECHDR_LEN);
+	size += POLY1305_TAGSIZE;
+	xhdr->type = type;
+	xhdr->proto_maj = TLS_MAJ;
+	xhdr->proto_min = TLS_MIN;
+	xhdr->len16_hi = size >> 8;
+	xhdr->len16_lo = size & 0xff;
+	size += RECHDR_LEN;
+	dump_raw_out(">> %s\n", xhdr, size);
+	xwrite(tls->ofd, xhdr, size);
+	dbg("wrote %u bytes\n", size);
+}
+
 static void xwrite_encrypted(tls_state_t *tls, unsigned size, unsigned type)
 {
+	if (tls->flags & ENCRYPTION_CHACHA20) {
+		xwrite_encrypted_chacha20poly1305(tls, size, type);
+		return;
+	}
 	if (!(tls->flags & ENCRYPTION_AESGCM)) {
 		xwrite_encrypted_and_hmac_signed(tls, size, type);
 		return;
@@ -999,10 +1059,8 @@ static void tls_aesgcm_decrypt(tls_state_t *tls, uint8_t *buf, int size)
 
 	//uint8_t aad[13 + 3] ALIGNED_long; /* +3 creates [16] buffer, simplifying GHASH() */
 	uint8_t nonce[12 + 4] ALIGNED_long; /* +4 creates space for AES block counter */
-	uint8_t scratch[AES_BLOCK_SIZE] ALIGNED_long; //[16]
+	//uint8_t scratch[AES_BLOCK_SIZE] ALIGNED_long; //[16]
 	//uint8_t authtag[AES_BLOCK_SIZE] ALIGNED_long; //[16]
-	unsigned remaining;
-	unsigned cnt;
 
 	//memcpy(aad, buf, 8);
 	//aad[8] = type;
@@ -1015,19 +1073,9 @@ static void tls_aesgcm_decrypt(tls_state_t *tls, uint8_t *buf, int size)
 	memcpy(nonce,     tls->server_write_IV, 4);
 	memcpy(nonce + 4, buf, 8);
 
-	cnt = 1;
-	remaining = size;
-	while (remaining != 0) {
-		unsigned n;
-
-		cnt++;
-		COUNTER(nonce) = htonl(cnt); /* yes, first cnt here is 2 (!) */
-		aes_encrypt_one_block(&tls->aes_decrypt, nonce, scratch);
-		n = remaining > AES_BLOCK_SIZE ? AES_BLOCK_SIZE : remaining;
-		xorbuf3(buf, scratch, buf + 8, n);
-		buf += n;
-		remaining -= n;
-	}
+	COUNTER(nonce) = htonl(2); /* yes, first counter here is 2 (!) */
+	/* Decrypted data is moved 8 bytes down, over the explicit nonce */
+	aesgcm_CTR(&tls->aes_decrypt, nonce, buf + 8, buf, size);
 
 	//aesgcm_GHASH(tls->H, aad, tls->inbuf + RECHDR_LEN, size, authtag);
 	//COUNTER(nonce) = htonl(1);
@@ -1038,6 +1086,34 @@ static void tls_aesgcm_decrypt(tls_state_t *tls, uint8_t *buf, int size)
 #undef COUNTER
 }
 
+static void tls_chacha20poly1305_decrypt(tls_state_t *tls, uint8_t *buf, int size)
+{
+	uint8_t aad[13];
+	uint8_t nonce[CHACHA20_NONCESIZE];
+	uint64_t t64;
+
+	t64 = tls->read_seq64_be;
+	move_to_unaligned64(aad, t64);
+	aad[8] = buf[-RECHDR_LEN]; /* type */
+	aad[9] = TLS_MAJ;
+	aad[10] = TLS_MIN;
+	aad[11] = size >> 8;
+	aad[12] = size & 0xff;
+	tls->read_seq64_be = SWAP_BE64(1 + SWAP_BE64(t64));
+
+	memset(nonce, 0, 4);
+	memcpy(nonce + 4, aad, 8);
+	xorbuf(nonce, tls->server_write_IV, CHACHA20_NONCESIZE);
+
+	if (chacha20poly1305_decrypt(tls->server_write_key, nonce,
+			aad, sizeof(aad),
+			buf, buf, size,
+			buf + size) != 0
+	) {
+		bb_simple_error_msg_and_die("bad MAC");
+	}
+}
+
 static int tls_xread_record(tls_state_t *tls, const char *expected)
 {
 	struct record_hdr *xhdr;
@@ -1112,6 +1188,11 @@ static int tls_xread_record(tls_state_t *tls, const char *expected)
 		if (sz < (int)tls->min_encrypted_len_on_read)
 			bb_error_msg_and_die("bad encrypted len:%u", sz);
 
+		if (tls->flags & ENCRYPTION_CHACHA20) {
+			sz -= POLY1305_TAGSIZE;
+			tls_chacha20poly1305_decrypt(tls, tls->inbuf + RECHDR_LEN, sz);
+			dbg("encrypted size:%u\n", sz);
+		} else
 		if (tls->flags & ENCRYPTION_AESGCM) {
 			/* AESGCM */
 			uint8_t *p = tls->inbuf + RECHDR_LEN;
@@ -1497,9 +1578,183 @@ static ALWAYS_INLINE void fill_handshake_record_hdr(void *buf, unsigned type, un
 	h->len24_lo  = len & 0xff;
 }
 
+#if ENABLE_FEATURE_TLS_SESSION_CACHE
+/* If $TLS_SESSION_CACHE is set, it names a file with one line per server:
+ * "SNI EXPIRY_TIME CIPHER_ID MASTER_SECRET_HEX TICKET_HEX".
+ * A cached ticket is offered in client hello, and if server accepts it,
+ * certificate and key exchange are skipped (RFC 5077 3.1).
+ */
+enum {
+	SESSION_CACHE_MAX_ENTRIES = 16,
+	SESSION_TICKET_MAX_LEN = 2 * 1024,
+	SESSION_TICKET_DEFAULT_LIFETIME = 60 * 60,
+	SESSION_TICKET_MAX_LIFETIME = 7 * 24 * 60 * 60,
+};
+
+/* Split cache line to fields, return 1 if it's a good unexpired entry */
+static int session_cache_parse(char *line, char *field[5])
+{
+	int n = 0;
+
+	while (n < 5) {
+		field[n] = strsep(&line, " ");
+		if (!field[n])
+			return 0;
+		n++;
+	}
+	return line == NULL
+		&& strtoul(field[1], NULL, 10) > (unsigned long)time(NULL)
+		&& strlen(field[3]) == 2 * 48
+		&& strlen(field[4]) <= 2 * SESSION_TICKET_MAX_LEN;
+}
+
+static void session_cache_load(struct tls_handshake_data *hsd, const char *sni)
+{
+	const char *fname;
+	char *line;
+	FILE *fp;
+
+	fname = getenv("TLS_SESSION_CACHE");
+	if (!fname || !fname[0] || !sni || !sni[0] || strpbrk(sni, " \n"))
+		return;
+	hsd->cache_file = fname;
+	hsd->sni = sni;
+
+	fp = fopen_for_read(fname);
+	if (!fp)
+		return;
+	while ((line = xmalloc_fgetline(fp)) != NULL) {
+		char *f[5];
+
+		if (session_cache_parse(line, f) && strcmp(f[0], sni) == 0) {
+			unsigned len = strlen(f[4]) / 2;
+			uint8_t *ticket = xmalloc(len);
+			unsigned cipher_id = bb_strtou(f[2], NULL, 16);
+
+			if (errno == 0 && len != 0
+			 && hex2bin((char*)hsd->master_secret, f[3], 48) && errno == 0
+			 && hex2bin((char*)ticket, f[4], len) && errno == 0
+			) {
+				hsd->cached_cipher_id = cipher_id;
+				hsd->ticket = ticket;
+				hsd->ticket_len = len;
+				hsd->offered_ticket = 1;
+				dbg("cached ticket for %s, cipher %04x\n", sni, hsd->cached_cipher_id);
+				free(line);
+				break;
+			}
+			free(ticket);
+		}
+		free(line);
+	}
+	fclose(fp);
+}
+
+/* Rewrite cache file: replace (or drop) entry for our server,
+ * keep other unexpired entries. Errors are ignored: cache is optional.
+ */
+static void session_cache_save(tls_state_t *tls)
+{
+	struct tls_handshake_data *hsd = tls->hsd;
+	char *tmpname;
+	char *line;
+	FILE *fp;
+	FILE *out;
+	int fd;
+	int cnt;
+
+	if (!hsd->got_new_ticket) {
+		/* Nothing to store. Forget the ticket if it was rejected */
+		if (!hsd->offered_ticket || hsd->resumed)
+			return;
+	}
+
+	tmpname = xasprintf("%s.XXXXXX", hsd->cache_file);
+	fd = mkstemp(tmpname); /* creates it with mode 0600 */
+	if (fd < 0)
+		goto ret;
+	out = fdopen(fd, "w");
+	if (!out) {
+		close(fd);
+		goto del;
+	}
+	cnt = 0;
+	if (hsd->got_new_ticket) {
+		char hex[2 * SESSION_TICKET_MAX_LEN + 1];
+		unsigned lifetime = hsd->ticket_lifetime;
+
+		if (lifetime == 0)
+			lifetime = SESSION_TICKET_DEFAULT_LIFETIME;
+		if (lifetime > SESSION_TICKET_MAX_LIFETIME)
+			lifetime = SESSION_TICKET_MAX_LIFETIME;
+		*bin2hex(hex, (char*)hsd->master_secret, 48) = '\0';
+		fprintf(out, "%s %lu %04x %s ",
+			hsd->sni, (unsigned long)time(NULL) + lifetime,
+			tls->cipher_id, hex
+		);
+		*bin2hex(hex, (char*)hsd->ticket, hsd->ticket_len) = '\0';
+		fprintf(out, "%s\n", hex);
+		cnt++;
+	}
+	fp = fopen_for_read(hsd->cache_file);
+	if (fp) {
+		while ((line = xmalloc_fgetline(fp)) != NULL) {
+			char *f[5];
+			char *copy = xstrdup(line);
+
+			if (cnt < SESSION_CACHE_MAX_ENTRIES
+			 && session_cache_parse(copy, f)
+			 && strcmp(f[0], hsd->sni) != 0
+			) {
+				fprintf(out, "%s\n", line);
+				cnt++;
+			}
+			free(copy);
+			free(line);
+		}
+		fclose(fp);
+	}
+	if (fclose(out) == 0 && rename(tmpname, hsd->cache_file) == 0)
+		goto ret;
+ del:
+	unlink(tmpname);
+ ret:
+	free(tmpname);
+}
+
+static void get_new_session_ticket(tls_state_t *tls, int len)
+{
+	struct tls_handshake_data *hsd = tls->hsd;
+	uint8_t *p = tls->inbuf + RECHDR_LEN;
+	unsigned ticket_len;
+
+	// 04 len24 | lifetime_hint32 | ticket_len16 | ticket
+	if (len < 4 + 4 + 2)
+		bad_record_die(tls, "session ticket", len);
+	ticket_len = 0x100 * p[8] + p[9];
+	if (4 + 4 + 2 + ticket_len > (unsigned)len)
+		bad_record_die(tls, "session ticket", len);
+	dbg("<< NEW_SESSION_TICKET len:%u\n", ticket_len);
+	/* Empty ticket: server will not issue one after all */
+	if (ticket_len == 0 || ticket_len > SESSION_TICKET_MAX_LEN)
+		return;
+	free(hsd->ticket);
+	hsd->ticket = xmemdup(p + 10, ticket_len);
+	hsd->ticket_len = ticket_len;
+	hsd->ticket_lifetime = get_unaligned_be32(p + 4);
+	hsd->got_new_ticket = 1;
+}
+#else
+# define session_cache_load(hsd, sni) ((void)0)
+# define session_cache_save(tls) ((void)0)
+# define get_new_session_ticket(tls, len) ((void)0)
+#endif
+
 static void send_client_hello_and_alloc_hsd(tls_state_t *tls, const char *sni)
 {
 #define NUM_CIPHERS (0 \
+	+ ALLOW_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256 \
+	+ ALLOW_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256 \
 	+ 4 * ENABLE_FEATURE_TLS_SHA1 \
 	+ ALLOW_ECDHE_ECDSA_WITH_AES_128_CBC_SHA256 \
 	+ ALLOW_ECDHE_RSA_WITH_AES_128_CBC_SHA256 \
@@ -1515,6 +1770,14 @@ static void send_client_hello_and_alloc_hsd(tls_state_t *tls, const char *sni)
 		0x00,2 * (1 + NUM_CIPHERS), //len16_be
 		0x00,0xFF, //not a cipher - TLS_EMPTY_RENEGOTIATION_INFO_SCSV
 		/* ^^^^^^ RFC 5746 Renegotiation Indication Extension - some servers will refuse to work with us otherwise */
+	/* ChaCha20 first: servers which honor client order pick it, it is fast without AES instructions.
+	 * On CPUs with them, AES-GCM is moved in front of it at runtime */
+#if ALLOW_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256
+		0xCC,0xA9, //   TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256
+#endif
+#if ALLOW_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256
+		0xCC,0xA8, //   TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256 - ok: openssl s_server ... -cipher ECDHE-RSA-CHACHA20-POLY1305
+#endif
 #if ENABLE_FEATURE_TLS_SHA1
 		0xC0,0x09, // 1 TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA - ok: wget https://is.gd/
 		0xC0,0x0A, // 2 TLS_ECDHE_ECDSA_WITH_AES_256_CBC_SHA - ok: wget https://is.gd/
@@ -1597,7 +1860,7 @@ static void send_client_hello_and_alloc_hsd(tls_state_t *tls, const char *sni)
 		//0x00,0x0b,0x00,0x04,0x03,0x00,0x01,0x02, //extension_type: "ec_point_formats"
 		//0x00,0x16,0x00,0x00, //extension_type: "encrpypt-then-mac"
 		//0x00,0x17,0x00,0x00, //extension_type: "extended_master"
-		//0x00,0x23,0x00,0x00, //extension_type: "session_ticket"
+		//0x00,0x23,0x00,0x00, //extension_type: "session_ticket" - added below if session cache is used
 
 		// kojipkgs.fedoraproject.org responds with alert code 80 ("internal error")
 		// to our hello without signature_algorithms.
@@ -1631,18 +1894,33 @@ static void send_client_hello_and_alloc_hsd(tls_state_t *tls, const char *sni)
 //   0017 0000 - extended master secret
 	};
 	struct client_hello *record;
+	struct tls_handshake_data *hsd;
 	uint8_t *ptr;
 	int len;
 	int ext_len;
+	int sid_len;
 	int sni_len = sni ? strnlen(sni, 127 - 5) : 0;
 
+	tls->hsd = hsd = xzalloc(sizeof(*hsd));
+	/* HANDSHAKE HASH: ^^^ + len if need to save saved_client_hello */
+	session_cache_load(hsd, sni);
+
 	ext_len = 0;
 	ext_len += sizeof(extensions);
 	if (sni_len)
 		ext_len += 9 + sni_len;
+	sid_len = 0;
+	if (hsd->cache_file) {
+		ext_len += 4 + hsd->ticket_len; /* "session_ticket" */
+		/* RFC 5077 3.4: with a ticket, client sends a session id.
+		 * Server echoes it if it accepted the ticket.
+		 */
+		if (hsd->ticket_len)
+			sid_len = sizeof(hsd->session_id);
+	}
 
 	/* +2 is for "len of all extensions" 2-byte field */
-	len = sizeof(*record) + 2 + ext_len;
+	len = sizeof(*record) + sid_len + 2 + ext_len;
 	record = tls_get_zeroed_outbuf(tls, len);
 
 	fill_handshake_record_hdr(record, HANDSHAKE_CLIENT_HELLO, len);
@@ -1652,11 +1930,31 @@ static void send_client_hello_and_alloc_hsd(tls_state_t *tls, const char *sni)
 	if (TLS_DEBUG_FIXED_SECRETS)
 		memset(record->rand32, 0x11, sizeof(record->rand32));
 	/* record->session_id_len = 0; - already is */
+	ptr = &record->cipherid_len16_hi;
+	if (sid_len) {
+		record->session_id_len = sid_len;
+		tls_get_random(hsd->session_id, sid_len);
+		ptr = mempcpy(ptr, hsd->session_id, sid_len);
+	}
 
 	BUILD_BUG_ON(sizeof(ciphers) != 2 * (1 + 1 + NUM_CIPHERS + 1));
-	memcpy(&record->cipherid_len16_hi, ciphers, sizeof(ciphers));
+	ptr = mempcpy(ptr, ciphers, sizeof(ciphers));
+	if (aesgcm_hwaccel()) {
+		/* AES-GCM is faster than ChaCha20 here: list ECDHE AES-GCM
+		 * suites first (keeping their order), before ChaCha20 */
+		uint8_t *first = ptr - sizeof(ciphers) + 4; /* past len16 and SCSV */
+		uint8_t *p;
+		for (p = first; p < ptr - 2; p += 2) { /* ptr - 2: comprtypes */
+			if (p[0] == 0xC0 && (p[1] == 0x2B || p[1] == 0x2F)) {
+				uint8_t id = p[1];
+				memmove(first + 2, first, p - first);
+				first[0] = 0xC0;
+				first[1] = id;
+				first += 2;
+			}
+		}
+	}
 
-	ptr = (void*)(record + 1);
 	*ptr++ = ext_len >> 8;
 	*ptr++ = ext_len;
 	if (sni_len) {
@@ -1671,11 +1969,16 @@ static void send_client_hello_and_alloc_hsd(tls_state_t *tls, const char *sni)
 		ptr[8] = sni_len;         //name len
 		ptr = mempcpy(&ptr[9], sni, sni_len);
 	}
-	memcpy(ptr, extensions, sizeof(extensions));
+	ptr = mempcpy(ptr, extensions, sizeof(extensions));
+	if (hsd->cache_file) {
+		//ptr[0] = 0;
+		ptr[1] = 0x23; //extension_type: "session_ticket"
+		ptr[2] = hsd->ticket_len >> 8;
+		ptr[3] = hsd->ticket_len;
+		memcpy(&ptr[4], hsd->ticket, hsd->ticket_len);
+	}
 
-	tls->hsd = xzalloc(sizeof(*tls->hsd));
-	/* HANDSHAKE HASH: ^^^ + len if need to save saved_client_hello */
-	memcpy(tls->hsd->client_and_server_rand32, record->rand32, sizeof(record->rand32));
+	memcpy(hsd->client_and_server_rand32, record->rand32, sizeof(record->rand32));
 /* HANDSHAKE HASH:
 	tls->hsd->saved_client_hello_size = len;
 	memcpy(tls->hsd->saved_client_hello, record, len);
@@ -1746,10 +2049,24 @@ static void get_server_hello(tls_state_t *tls)
 		bad_record_die(tls, "'server hello'", len);
 	dbg("<< SERVER_HELLO\n");
 
+	if (ENABLE_FEATURE_TLS_SESSION_CACHE
+	 && tls->hsd->offered_ticket
+	 && hp->session_id_len == 32
+	 && memcmp(hp->session_id, tls->hsd->session_id, 32) == 0
+	) {
+		/* Server accepted our ticket */
+		dbg("session resumed\n");
+		tls->hsd->resumed = 1;
+		if (0x100 * cipherid[0] + cipherid[1] != tls->hsd->cached_cipher_id)
+			bad_record_die(tls, "'server hello'", len);
+	}
+
 	memcpy(tls->hsd->client_and_server_rand32 + 32, hp->rand32, sizeof(hp->rand32));
 
 	/* Set up encryption params based on selected cipher */
 #if 0
+		0xCC,0xA9, //   TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256
+		0xCC,0xA8, //   TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256
 		0xC0,0x09, // 1 TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA - ok: wget https://is.gd/
 		0xC0,0x0A, // 2 TLS_ECDHE_ECDSA_WITH_AES_256_CBC_SHA - ok: wget https://is.gd/
 		0xC0,0x13, // 3 TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA - ok: openssl s_server ... -cipher ECDHE-RSA-AES128-SHA
@@ -1782,6 +2099,13 @@ static void get_server_hello(tls_state_t *tls)
 	tls->key_size = AES256_KEYSIZE;
 	tls->MAC_size = SHA256_OUTSIZE;
 	/*tls->IV_size = 0; - already is */
+	if (cipherid[0] == 0xCC) {
+		/* CCA8,CCA9 are ECDHE CHACHA20-POLY1305 (RFC 7905) */
+		tls->flags |= NEED_EC_KEY | ENCRYPTION_CHACHA20;
+		tls->key_size = CHACHA20_KEYSIZE;
+		tls->MAC_size = 0;
+		tls->IV_size = CHACHA20_NONCESIZE;
+	} else
 	if (cipherid[0] == 0xC0) {
 		/* All C0xx are ECDHE */
 		tls->flags |= NEED_EC_KEY;
@@ -1970,6 +2294,86 @@ static void send_empty_client_cert(tls_state_t *tls)
 	xwrite_and_update_handshake_hash(tls, sizeof(*record));
 }
 
+static void derive_session_keys(tls_state_t *tls)
+{
+	// RFC 5246
+	// 6.3.  Key Calculation
+	//
+	// The Record Protocol requires an algorithm to generate keys required
+	// by the current connection state (see Appendix A.6) from the security
+	// parameters provided by the handshake protocol.
+	//
+	// The master secret is expanded into a sequence of secure bytes, which
+	// is then split to a client write MAC key, a server write MAC key, a
+	// client write encryption key, and a server write encryption key.  Each
+	// of these is generated from the byte sequence in that order.  Unused
+	// values are empty.  Some AEAD ciphers may additionally require a
+	// client write IV and a server write IV (see Section 6.2.3.3).
+	//
+	// When keys and MAC keys are generated, the master secret is used as an
+	// entropy source.
+	//
+	// To generate the key material, compute
+	//
+	//    key_block = PRF(SecurityParameters.master_secret,
+	//                    "key expansion",
+	//                    SecurityParameters.server_random +
+	//                    SecurityParameters.client_random);
+	//
+	// until enough output has been generated.  Then, the key_block is
+	// partitioned as follows:
+	//
+	//    client_write_MAC_key[SecurityParameters.mac_key_length]
+	//    server_write_MAC_key[SecurityParameters.mac_key_length]
+	//    client_write_key[SecurityParameters.enc_key_length]
+	//    server_write_key[SecurityParameters.enc_key_length]
+	//    client_write_IV[SecurityParameters.fixed_iv_length]
+	//    server_write_IV[SecurityParameters.fixed_iv_length]
+	{
+		uint8_t tmp64[64];
+
+		/* make "server_rand32 + client_rand32" */
+		memcpy(&tmp64[0] , &tls->hsd->client_and_server_rand32[32], 32);
+		memcpy(&tmp64[32], &tls->hsd->client_and_server_rand32[0] , 32);
+
+		prf_hmac_sha256(/*tls,*/
+			tls->client_write_MAC_key, 2 * (tls->MAC_size + tls->key_size + tls->IV_size),
+			// also fills:
+			// server_write_MAC_key[]
+			// client_write_key[]
+			// server_write_key[]
+			// client_write_IV[]
+			// server_write_IV[]
+			tls->hsd->master_secret, sizeof(tls->hsd->master_secret),
+			"key expansion",
+			tmp64, 64
+		);
+		tls->client_write_key = tls->client_write_MAC_key + (2 * tls->MAC_size);
+		tls->server_write_key = tls->client_write_key + tls->key_size;
+		tls->client_write_IV = tls->server_write_key + tls->key_size;
+		tls->server_write_IV = tls->client_write_IV + tls->IV_size;
+		dump_hex("client_write_MAC_key:%s\n",
+			tls->client_write_MAC_key, tls->MAC_size
+		);
+		dump_hex("client_write_key:%s\n",
+			tls->client_write_key, tls->key_size
+		);
+		dump_hex("client_write_IV:%s\n",
+			tls->client_write_IV, tls->IV_size
+		);
+
+		if (!(tls->flags & ENCRYPTION_CHACHA20)) {
+			aes_setkey(&tls->aes_decrypt, tls->server_write_key, tls->key_size);
+			aes_setkey(&tls->aes_encrypt, tls->client_write_key, tls->key_size);
+			{
+				uint8_t iv[AES_BLOCK_SIZE];
+				memset(iv, 0, AES_BLOCK_SIZE);
+				aes_encrypt_one_block(&tls->aes_encrypt, iv, tls->H);
+			}
+		}
+	}
+}
+
 static void send_client_key_exchange(tls_state_t *tls)
 {
 	struct client_key_exchange {
@@ -2067,80 +2471,7 @@ static void send_client_key_exchange(tls_state_t *tls)
 	);
 	dump_hex("master secret:%s\n", tls->hsd->master_secret, sizeof(tls->hsd->master_secret));
 
-	// RFC 5246
-	// 6.3.  Key Calculation
-	//
-	// The Record Protocol requires an algorithm to generate keys required
-	// by the current connection state (see Appendix A.6) from the security
-	// parameters provided by the handshake protocol.
-	//
-	// The master secret is expanded into a sequence of secure bytes, which
-	// is then split to a client write MAC key, a server write MAC key, a
-	// client write encryption key, and a server write encryption key.  Each
-	// of these is generated from the byte sequence in that order.  Unused
-	// values are empty.  Some AEAD ciphers may additionally require a
-	// client write IV and a server write IV (see Section 6.2.3.3).
-	//
-	// When keys and MAC keys are generated, the master secret is used as an
-	// entropy source.
-	//
-	// To generate the key material, compute
-	//
-	//    key_block = PRF(SecurityParameters.master_secret,
-	//                    "key expansion",
-	//                    SecurityParameters.server_random +
-	//                    SecurityParameters.client_random);
-	//
-	// until enough output has been generated.  Then, the key_block is
-	// partitioned as follows:
-	//
-	//    client_write_MAC_key[SecurityParameters.mac_key_length]
-	//    server_write_MAC_key[SecurityParameters.mac_key_length]
-	//    client_write_key[SecurityParameters.enc_key_length]
-	//    server_write_key[SecurityParameters.enc_key_length]
-	//    client_write_IV[SecurityParameters.fixed_iv_length]
-	//    server_write_IV[SecurityParameters.fixed_iv_length]
-	{
-		uint8_t tmp64[64];
-
-		/* make "server_rand32 + client_rand32" */
-		memcpy(&tmp64[0] , &tls->hsd->client_and_server_rand32[32], 32);
-		memcpy(&tmp64[32], &tls->hsd->client_and_server_rand32[0] , 32);
-
-		prf_hmac_sha256(/*tls,*/
-			tls->client_write_MAC_key, 2 * (tls->MAC_size + tls->key_size + tls->IV_size),
-			// also fills:
-			// server_write_MAC_key[]
-			// client_write_key[]
-			// server_write_key[]
-			// client_write_IV[]
-			// server_write_IV[]
-			tls->hsd->master_secret, sizeof(tls->hsd->master_secret),
-			"key expansion",
-			tmp64, 64
-		);
-		tls->client_write_key = tls->client_write_MAC_key + (2 * tls->MAC_size);
-		tls->server_write_key = tls->client_write_key + tls->key_size;
-		tls->client_write_IV = tls->server_write_key + tls->key_size;
-		tls->server_write_IV = tls->client_write_IV + tls->IV_size;
-		dump_hex("client_write_MAC_key:%s\n",
-			tls->client_write_MAC_key, tls->MAC_size
-		);
-		dump_hex("client_write_key:%s\n",
-			tls->client_write_key, tls->key_size
-		);
-		dump_hex("client_write_IV:%s\n",
-			tls->client_write_IV, tls->IV_size
-		);
-
-		aes_setkey(&tls->aes_decrypt, tls->server_write_key, tls->key_size);
-		aes_setkey(&tls->aes_encrypt, tls->client_write_key, tls->key_size);
-		{
-			uint8_t iv[AES_BLOCK_SIZE];
-			memset(iv, 0, AES_BLOCK_SIZE);
-			aes_encrypt_one_block(&tls->aes_encrypt, iv, tls->H);
-		}
-	}
+	derive_session_keys(tls);
 }
 
 static const uint8_t rec_CHANGE_CIPHER_SPEC[] ALIGN1 = {
@@ -2221,6 +2552,50 @@ static void send_client_finished(tls_state_t *tls)
 	xwrite_encrypted(tls, sizeof(*record), RECORD_TYPE_HANDSHAKE);
 }
 
+static void get_server_change_cipher_spec_and_finished(tls_state_t *tls)
+{
+	int len;
+
+	len = tls_xread_record(tls, "switch to encrypted traffic");
+	if (len >= 4 && tls->inbuf[0] == RECORD_TYPE_HANDSHAKE
+	 && tls->inbuf[RECHDR_LEN] == HANDSHAKE_NEW_SESSION_TICKET
+	) {
+		/* RFC 5077 3.3: it comes right before CHANGE_CIPHER_SPEC */
+		get_new_session_ticket(tls, len);
+		len = tls_xread_record(tls, "switch to encrypted traffic");
+	}
+
+	/* Get CHANGE_CIPHER_SPEC */
+	if (len != 1 || memcmp(tls->inbuf, rec_CHANGE_CIPHER_SPEC, 6) != 0)
+		bad_record_die(tls, "switch to encrypted traffic", len);
+	dbg("<< CHANGE_CIPHER_SPEC\n");
+
+	if (ALLOW_RSA_NULL_SHA256
+	 && tls->cipher_id == TLS_RSA_WITH_NULL_SHA256
+	) {
+		tls->min_encrypted_len_on_read = tls->MAC_size;
+	} else
+	if (tls->flags & ENCRYPTION_CHACHA20) {
+		tls->min_encrypted_len_on_read = POLY1305_TAGSIZE;
+	} else
+	if (!(tls->flags & ENCRYPTION_AESGCM)) {
+		unsigned mac_blocks = (unsigned)(TLS_MAC_SIZE(tls) + AES_BLOCK_SIZE-1) / AES_BLOCK_SIZE;
+		/* all incoming packets now should be encrypted and have
+		 * at least IV + (MAC padded to blocksize):
+		 */
+		tls->min_encrypted_len_on_read = AES_BLOCK_SIZE + (mac_blocks * AES_BLOCK_SIZE);
+	} else {
+		tls->min_encrypted_len_on_read = 8 + AES_BLOCK_SIZE;
+	}
+	dbg("min_encrypted_len_on_read: %u\n", tls->min_encrypted_len_on_read);
+
+	/* Get (encrypted) FINISHED from the server */
+	len = tls_xread_record(tls, "'server finished'");
+	if (len < 4 || tls->inbuf[RECHDR_LEN] != HANDSHAKE_FINISHED)
+		bad_record_die(tls, "'server finished'", len);
+	dbg("<< FINISHED\n");
+}
+
 void FAST_FUNC tls_handshake(tls_state_t *tls, const char *sni)
 {
 	// Client              RFC 5246                Server
@@ -2246,6 +2621,24 @@ void FAST_FUNC tls_handshake(tls_state_t *tls, const char *sni)
 	send_client_hello_and_alloc_hsd(tls, sni);
 	get_server_hello(tls);
 
+	if (ENABLE_FEATURE_TLS_SESSION_CACHE && tls->hsd->resumed) {
+		// RFC 5077 3.1: abbreviated handshake
+		// ClientHello (with ticket) ------->
+		//                                   ServerHello
+		//                            NewSessionTicket*
+		//                            [ChangeCipherSpec]
+		//                          <-------    Finished
+		// [ChangeCipherSpec]
+		// Finished                  ------->
+		/* master secret came from the cache */
+		derive_session_keys(tls);
+		get_server_change_cipher_spec_and_finished(tls);
+		send_change_cipher_spec(tls);
+		tls->flags |= ENCRYPT_ON_WRITE;
+		send_client_finished(tls);
+		goto done;
+	}
+
 	// RFC 5246
 	// The server MUST send a Certificate message whenever the agreed-
 	// upon key exchange method uses certificates for authentication
@@ -2314,37 +2707,15 @@ void FAST_FUNC tls_handshake(tls_state_t *tls, const char *sni)
 
 	send_client_finished(tls);
 
-	/* Get CHANGE_CIPHER_SPEC */
-	len = tls_xread_record(tls, "switch to encrypted traffic");
-	if (len != 1 || memcmp(tls->inbuf, rec_CHANGE_CIPHER_SPEC, 6) != 0)
-		bad_record_die(tls, "switch to encrypted traffic", len);
-	dbg("<< CHANGE_CIPHER_SPEC\n");
-
-	if (ALLOW_RSA_NULL_SHA256
-	 && tls->cipher_id == TLS_RSA_WITH_NULL_SHA256
-	) {
-		tls->min_encrypted_len_on_read = tls->MAC_size;
-	} else
-	if (!(tls->flags & ENCRYPTION_AESGCM)) {
-		unsigned mac_blocks = (unsigned)(TLS_MAC_SIZE(tls) + AES_BLOCK_SIZE-1) / AES_BLOCK_SIZE;
-		/* all incoming packets now should be encrypted and have
-		 * at least IV + (MAC padded to blocksize):
-		 */
-		tls->min_encrypted_len_on_read = AES_BLOCK_SIZE + (mac_blocks * AES_BLOCK_SIZE);
-	} else {
-		tls->min_encrypted_len_on_read = 8 + AES_BLOCK_SIZE;
-	}
-	dbg("min_encrypted_len_on_read: %u\n", tls->min_encrypted_len_on_read);
-
-	/* Get (encrypted) FINISHED from the server */
-	len = tls_xread_record(tls, "'server finished'");
-	if (len < 4 || tls->inbuf[RECHDR_LEN] != HANDSHAKE_FINISHED)
-		bad_record_die(tls, "'server finished'", len);
-	dbg("<< FINISHED\n");
+	get_server_change_cipher_spec_and_finished(tls);
 	/* application data can be sent/received */
 
+ done:
+	session_cache_save(tls);
+
 	/* free handshake data */
 	psRsaKey_clear(&tls->hsd->server_rsa_pub_key);
+	free(tls->hsd->ticket);
 //	if (PARANOIA)
 //		memset(tls->hsd, 0, tls->hsd->hsd_size);
 	free(tls->hsd);
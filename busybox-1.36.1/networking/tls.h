@@ -82,6 +82,7 @@ typedef  int16_t  int16;
 
 void tls_get_random(void *buf, unsigned len) FAST_FUNC;
 
+void xorbuf3(void *dst, const void *src1, const void *src2, unsigned count) FAST_FUNC;
 void xorbuf(void* buf, const void* mask, unsigned count) FAST_FUNC;
 
 #define ALIGNED_long ALIGNED(sizeof(long))
@@ -103,6 +104,7 @@ void xorbuf_aligned_AES_BLOCK_SIZE(void* buf, const void* mask) FAST_FUNC;
 #include "tls_pstm.h"
 #include "tls_aes.h"
 #include "tls_aesgcm.h"
+#include "tls_chacha20poly1305.h"
 #include "tls_rsa.h"
 
 #define EC_CURVE_KEYSIZE   32
@@ -9,3 +9,13 @@ void aesgcm_GHASH(uint8_t* h,
 	const uint8_t* c, unsigned cSz,
 	uint8_t* s //, unsigned sSz
 ) FAST_FUNC;
+
+void aesgcm_CTR(struct tls_aes *aes, uint8_t *ctr,
+	const uint8_t *src, uint8_t *dst, unsigned size
+) FAST_FUNC;
+
+#if ENABLE_FEATURE_TLS_AES_HWACCEL
+int aesgcm_hwaccel(void) FAST_FUNC;
+#else
+# define aesgcm_hwaccel() 0
+#endif
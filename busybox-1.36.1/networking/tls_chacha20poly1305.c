@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2018 Denys Vlasenko
+ *
+ * Licensed under GPLv2, see file LICENSE in this source tree.
+ */
+
+/* ChaCha20 and Poly1305 AEAD, RFC 8439, as used by TLS (RFC 7905).
+ * Poly1305 uses 26-bit limbs (as poly1305-donna-32), which is fast
+ * on 32-bit CPUs without AES instructions, where this cipher is most useful.
+ */
+#include "tls.h"
+
+static ALWAYS_INLINE uint32_t rotl32(uint32_t x, unsigned n)
+{
+	return (x << n) | (x >> (32 - n));
+}
+
+#define QUARTERROUND(a, b, c, d) \
+do { \
+	a += b; d = rotl32(d ^ a, 16); \
+	c += d; b = rotl32(b ^ c, 12); \
+	a += b; d = rotl32(d ^ a, 8); \
+	c += d; b = rotl32(b ^ c, 7); \
+} while (0)
+
+static void chacha20_block(const uint32_t state[16], uint8_t out[64])
+{
+	uint32_t x[16];
+	int i;
+
+	memcpy(x, state, sizeof(x));
+	for (i = 0; i < 10; i++) {
+		QUARTERROUND(x[0], x[4], x[ 8], x[12]);
+		QUARTERROUND(x[1], x[5], x[ 9], x[13]);
+		QUARTERROUND(x[2], x[6], x[10], x[14]);
+		QUARTERROUND(x[3], x[7], x[11], x[15]);
+		QUARTERROUND(x[0], x[5], x[10], x[15]);
+		QUARTERROUND(x[1], x[6], x[11], x[12]);
+		QUARTERROUND(x[2], x[7], x[ 8], x[13]);
+		QUARTERROUND(x[3], x[4], x[ 9], x[14]);
+	}
+	for (i = 0; i < 16; i++)
+		put_unaligned_le32(x[i] + state[i], out + i * 4);
+}
+
+static void chacha20_init(uint32_t state[16], const uint8_t *key, const uint8_t *nonce)
+{
+	int i;
+
+	state[0] = 0x61707865; /* "expand 32-byte k" */
+	state[1] = 0x3320646e;
+	state[2] = 0x79622d32;
+	state[3] = 0x6b206574;
+	for (i = 0; i < 8; i++)
+		state[4 + i] = get_unaligned_le32(key + i * 4);
+	state[12] = 0; /* block counter */
+	for (i = 0; i < 3; i++)
+		state[13 + i] = get_unaligned_le32(nonce + i * 4);
+}
+
+/* dst = src ^ keystream, starting from the block counter in state[12] */
+static void chacha20_xor(uint32_t state[16], uint8_t *dst, const uint8_t *src, unsigned len)
+{
+	uint8_t block[64];
+
+	while (len != 0) {
+		unsigned n = len > 64 ? 64 : len;
+
+		chacha20_block(state, block);
+		state[12]++;
+		xorbuf3(dst, src, block, n);
+		dst += n;
+		src += n;
+		len -= n;
+	}
+}
+
+struct poly1305 {
+	uint32_t r[5];
+	uint32_t h[5];
+	uint8_t s[16];
+};
+
+static void poly1305_init(struct poly1305 *p, const uint8_t key[32])
+{
+	/* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+	p->r[0] = (get_unaligned_le32(key +  0)     ) & 0x3ffffff;
+	p->r[1] = (get_unaligned_le32(key +  3) >> 2) & 0x3ffff03;
+	p->r[2] = (get_unaligned_le32(key +  6) >> 4) & 0x3ffc0ff;
+	p->r[3] = (get_unaligned_le32(key +  9) >> 6) & 0x3f03fff;
+	p->r[4] = (get_unaligned_le32(key + 12) >> 8) & 0x00fffff;
+	memset(p->h, 0, sizeof(p->h));
+	memcpy(p->s, key + 16, 16);
+}
+
+/* Process data zero-padded to a multiple of 16 bytes (RFC 8439 pad16) */
+static void poly1305_update_pad16(struct poly1305 *p, const uint8_t *m, unsigned len)
+{
+	const uint32_t r0 = p->r[0], r1 = p->r[1], r2 = p->r[2], r3 = p->r[3], r4 = p->r[4];
+	const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+	uint32_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2], h3 = p->h[3], h4 = p->h[4];
+	uint8_t last[16];
+
+	while (len != 0) {
+		uint64_t d0, d1, d2, d3, d4;
+		uint32_t c;
+
+		if (len < 16) {
+			memset(last, 0, 16);
+			memcpy(last, m, len);
+			m = last;
+			len = 16;
+		}
+		h0 += (get_unaligned_le32(m +  0)     ) & 0x3ffffff;
+		h1 += (get_unaligned_le32(m +  3) >> 2) & 0x3ffffff;
+		h2 += (get_unaligned_le32(m +  6) >> 4) & 0x3ffffff;
+		h3 += (get_unaligned_le32(m +  9) >> 6) & 0x3ffffff;
+		h4 += (get_unaligned_le32(m + 12) >> 8) | (1 << 24);
+
+		d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+		d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+		d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+		d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+		d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+		c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+		d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+		d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+		d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+		d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+		h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+		h1 += c;
+
+		m += 16;
+		len -= 16;
+	}
+	p->h[0] = h0; p->h[1] = h1; p->h[2] = h2; p->h[3] = h3; p->h[4] = h4;
+}
+
+static void poly1305_finish(struct poly1305 *p, uint8_t tag[16])
+{
+	uint32_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2], h3 = p->h[3], h4 = p->h[4];
+	uint32_t g0, g1, g2, g3, g4, c, mask;
+	uint64_t f;
+
+	/* fully carry h */
+	c = h1 >> 26; h1 &= 0x3ffffff;
+	h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+	h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+	h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+	h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+	h1 += c;
+
+	/* g = h + -p = h - (2^130 - 5) */
+	g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+	g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+	g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+	g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+	g4 = h4 + c - (1 << 26);
+
+	/* select h if h < p, or g otherwise (constant time) */
+	mask = (g4 >> 31) - 1;
+	h0 = (h0 & ~mask) | (g0 & mask);
+	h1 = (h1 & ~mask) | (g1 & mask);
+	h2 = (h2 & ~mask) | (g2 & mask);
+	h3 = (h3 & ~mask) | (g3 & mask);
+	h4 = (h4 & ~mask) | (g4 & mask);
+
+	/* h = (h + s) % 2^128 */
+	h0 = (h0      ) | (h1 << 26);
+	h1 = (h1 >>  6) | (h2 << 20);
+	h2 = (h2 >> 12) | (h3 << 14);
+	h3 = (h3 >> 18) | (h4 <<  8);
+	f = (uint64_t)h0 + get_unaligned_le32(p->s +  0);             put_unaligned_le32((uint32_t)f, tag +  0);
+	f = (uint64_t)h1 + get_unaligned_le32(p->s +  4) + (f >> 32); put_unaligned_le32((uint32_t)f, tag +  4);
+	f = (uint64_t)h2 + get_unaligned_le32(p->s +  8) + (f >> 32); put_unaligned_le32((uint32_t)f, tag +  8);
+	f = (uint64_t)h3 + get_unaligned_le32(p->s + 12) + (f >> 32); put_unaligned_le32((uint32_t)f, tag + 12);
+}
+
+/* RFC 8439 2.8: Poly1305 key is the first half of block 0, data is
+ * encrypted starting with block 1. Tag covers
+ * aad | pad16 | ciphertext | pad16 | le64(aad_len) | le64(ct_len)
+ */
+static void chacha20poly1305_tag(uint32_t state[16],
+		const uint8_t *aad, unsigned aad_len,
+		const uint8_t *ct, unsigned len,
+		uint8_t tag[16])
+{
+	struct poly1305 p;
+	uint8_t block[64];
+
+	state[12] = 0;
+	chacha20_block(state, block);
+	poly1305_init(&p, block);
+	poly1305_update_pad16(&p, aad, aad_len);
+	poly1305_update_pad16(&p, ct, len);
+	memset(block, 0, 16);
+	put_unaligned_le32(aad_len, block + 0);
+	put_unaligned_le32(len, block + 8);
+	poly1305_update_pad16(&p, block, 16);
+	poly1305_finish(&p, tag);
+}
+
+void FAST_FUNC chacha20poly1305_encrypt(const uint8_t *key, const uint8_t *nonce,
+		const uint8_t *aad, unsigned aad_len,
+		uint8_t *buf, unsigned len,
+		uint8_t *tag)
+{
+	uint32_t state[16];
+
+	chacha20_init(state, key, nonce);
+	state[12] = 1;
+	chacha20_xor(state, buf, buf, len);
+	chacha20poly1305_tag(state, aad, aad_len, buf, len, tag);
+}
+
+int FAST_FUNC chacha20poly1305_decrypt(const uint8_t *key, const uint8_t *nonce,
+		const uint8_t *aad, unsigned aad_len,
+		const uint8_t *src, uint8_t *dst, unsigned len,
+		const uint8_t *tag)
+{
+	uint32_t state[16];
+	uint8_t mytag[16];
+	unsigned diff;
+	int i;
+
+	chacha20_init(state, key, nonce);
+	chacha20poly1305_tag(state, aad, aad_len, src, len, mytag);
+	diff = 0;
+	for (i = 0; i < 16; i++)
+		diff |= mytag[i] ^ tag[i];
+	if (diff)
+		return -1;
+	state[12] = 1;
+	chacha20_xor(state, dst, src, len);
+	return 0;
+}
+
+#if ENABLE_UNIT_TEST
+
+/* RFC 8439 2.8.2 */
+BBUNIT_DEFINE_TEST(chacha20poly1305)
+{
+	static const char key_hex[] ALIGN1 =
+		"808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f";
+	static const char nonce_hex[] ALIGN1 = "070000004041424344454647";
+	static const char aad_hex[] ALIGN1 = "50515253c0c1c2c3c4c5c6c7";
+	static const char pt[] ALIGN1 =
+		"Ladies and Gentlemen of the class of '99: If I could offer you "
+		"only one tip for the future, sunscreen would be it.";
+	static const char ct_head[] ALIGN1 = "d31a8d34648e60db7b86afbc53ef7ec2";
+	static const char tag_hex[] ALIGN1 = "1ae10b594f09e26a7e902ecbd0600691";
+	uint8_t key[32], nonce[12], aad[12], tag[16];
+	uint8_t buf[sizeof(pt) - 1];
+	char hex[2 * 18 + 1];
+
+	hex2bin((char*)key, key_hex, 32);
+	hex2bin((char*)nonce, nonce_hex, 12);
+	hex2bin((char*)aad, aad_hex, 12);
+	memcpy(buf, pt, sizeof(buf));
+
+	chacha20poly1305_encrypt(key, nonce, aad, 12, buf, sizeof(buf), tag);
+	*bin2hex(hex, (char*)buf, 16) = '\0';
+	BBUNIT_ASSERT_STREQ(ct_head, hex);
+	*bin2hex(hex, (char*)buf + sizeof(buf) - 2, 2) = '\0';
+	BBUNIT_ASSERT_STREQ("6116", hex);
+	*bin2hex(hex, (char*)tag, 16) = '\0';
+	BBUNIT_ASSERT_STREQ(tag_hex, hex);
+
+	BBUNIT_ASSERT_EQ(0, chacha20poly1305_decrypt(key, nonce, aad, 12, buf, buf, sizeof(buf), tag));
+	BBUNIT_ASSERT_EQ(0, memcmp(buf, pt, sizeof(buf)));
+
+	tag[15] ^= 1;
+	BBUNIT_ASSERT_EQ(-1, chacha20poly1305_decrypt(key, nonce, aad, 12, buf, buf, sizeof(buf), tag));
+
+	BBUNIT_ENDTEST;
+}
+
+#endif /* ENABLE_UNIT_TEST */
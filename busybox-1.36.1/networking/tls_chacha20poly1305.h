@@ -0,0 +1,23 @@
+/*
+ * Copyright (C) 2018 Denys Vlasenko
+ *
+ * Licensed under GPLv2, see file LICENSE in this source tree.
+ */
+
+#define CHACHA20_KEYSIZE    32
+#define CHACHA20_NONCESIZE  12
+#define POLY1305_TAGSIZE    16
+
+/* Encrypts buf in place, writes 16-byte tag */
+void chacha20poly1305_encrypt(const uint8_t *key, const uint8_t *nonce,
+	const uint8_t *aad, unsigned aad_len,
+	uint8_t *buf, unsigned len,
+	uint8_t *tag
+) FAST_FUNC;
+
+/* Checks tag, then decrypts src to dst. Returns -1 on bad tag */
+int chacha20poly1305_decrypt(const uint8_t *key, const uint8_t *nonce,
+	const uint8_t *aad, unsigned aad_len,
+	const uint8_t *src, uint8_t *dst, unsigned len,
+	const uint8_t *tag
+) FAST_FUNC;
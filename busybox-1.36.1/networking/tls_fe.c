@@ -5,6 +5,17 @@
  */
 #include "tls.h"
 
+/* On 64-bit hosts with 64x64->128 multiply, field elements are kept
+ * in five 51-bit limbs. Otherwise, byte-oriented code is used:
+ * it is several times slower, but small and portable.
+ */
+#if ULONG_MAX > 0xffffffff && defined(__SIZEOF_INT128__)
+# define CURVE25519_RADIX51 1
+#else
+# define CURVE25519_RADIX51 0
+#endif
+
+#if !CURVE25519_RADIX51
 typedef uint8_t  byte;
 typedef uint16_t word16;
 typedef uint32_t word32;
@@ -607,6 +618,445 @@ static void curve25519(byte *result, const byte *e, const byte *q)
 	fe_normalize(result);
 }
 
+#else /* CURVE25519_RADIX51 */
+
+typedef unsigned __int128 uint128_t;
+typedef uint64_t fe51[5];
+
+#define MASK51 (((uint64_t)1 << 51) - 1)
+
+static uint64_t load_le64(const uint8_t *p)
+{
+	uint64_t v;
+	move_from_unaligned64(v, p);
+	return SWAP_LE64(v);
+}
+
+static void fe51_frombytes(fe51 h, const uint8_t *s)
+{
+	uint64_t w0 = load_le64(s +  0);
+	uint64_t w1 = load_le64(s +  8);
+	uint64_t w2 = load_le64(s + 16);
+	uint64_t w3 = load_le64(s + 24);
+
+	h[0] = w0 & MASK51;
+	h[1] = ((w0 >> 51) | (w1 << 13)) & MASK51;
+	h[2] = ((w1 >> 38) | (w2 << 26)) & MASK51;
+	h[3] = ((w2 >> 25) | (w3 << 39)) & MASK51;
+	h[4] = (w3 >> 12) & MASK51; /* top bit is ignored (RFC 7748 5) */
+}
+
+static void fe51_carry(fe51 h)
+{
+	h[1] += h[0] >> 51; h[0] &= MASK51;
+	h[2] += h[1] >> 51; h[1] &= MASK51;
+	h[3] += h[2] >> 51; h[2] &= MASK51;
+	h[4] += h[3] >> 51; h[3] &= MASK51;
+	h[0] += (h[4] >> 51) * 19; h[4] &= MASK51;
+	h[1] += h[0] >> 51; h[0] &= MASK51;
+}
+
+static void fe51_tobytes(uint8_t *s, const fe51 f)
+{
+	fe51 h;
+	uint64_t q;
+	int i;
+
+	memcpy(h, f, sizeof(h));
+	fe51_carry(h);
+	fe51_carry(h);
+	/* h < 2^255 + small. q = 1 if h >= p = 2^255-19 */
+	q = (h[0] + 19) >> 51;
+	q = (h[1] + q) >> 51;
+	q = (h[2] + q) >> 51;
+	q = (h[3] + q) >> 51;
+	q = (h[4] + q) >> 51;
+	h[0] += 19 * q;
+	h[1] += h[0] >> 51; h[0] &= MASK51;
+	h[2] += h[1] >> 51; h[1] &= MASK51;
+	h[3] += h[2] >> 51; h[2] &= MASK51;
+	h[4] += h[3] >> 51; h[3] &= MASK51;
+	h[4] &= MASK51; /* this drops 2^255 */
+
+	h[0] = h[0]         | (h[1] << 51);
+	h[1] = (h[1] >> 13) | (h[2] << 38);
+	h[2] = (h[2] >> 26) | (h[3] << 25);
+	h[3] = (h[3] >> 39) | (h[4] << 12);
+	for (i = 0; i < 4; i++)
+		move_to_unaligned64(s + i * 8, SWAP_LE64(h[i]));
+}
+
+static void fe51_add(fe51 h, const fe51 f, const fe51 g)
+{
+	h[0] = f[0] + g[0];
+	h[1] = f[1] + g[1];
+	h[2] = f[2] + g[2];
+	h[3] = f[3] + g[3];
+	h[4] = f[4] + g[4];
+}
+
+/* h = f - g. Adding 4*p keeps limbs positive for g limbs below 2^53 */
+static void fe51_sub(fe51 h, const fe51 f, const fe51 g)
+{
+	h[0] = (f[0] + 0x1fffffffffffb4) - g[0];
+	h[1] = (f[1] + 0x1ffffffffffffc) - g[1];
+	h[2] = (f[2] + 0x1ffffffffffffc) - g[2];
+	h[3] = (f[3] + 0x1ffffffffffffc) - g[3];
+	h[4] = (f[4] + 0x1ffffffffffffc) - g[4];
+	fe51_carry(h);
+}
+
+/* Limbs of the 320-bit product are folded using 2^255 = 19 (mod p) */
+static void fe51_reduce(fe51 h, uint128_t r0, uint128_t r1, uint128_t r2, uint128_t r3, uint128_t r4)
+{
+	uint128_t t;
+
+	r1 += r0 >> 51;
+	r2 += r1 >> 51;
+	r3 += r2 >> 51;
+	r4 += r3 >> 51;
+	t = (r4 >> 51) * 19 + ((uint64_t)r0 & MASK51);
+	h[0] = (uint64_t)t & MASK51;
+	h[1] = ((uint64_t)r1 & MASK51) + (uint64_t)(t >> 51);
+	h[2] = (uint64_t)r2 & MASK51;
+	h[3] = (uint64_t)r3 & MASK51;
+	h[4] = (uint64_t)r4 & MASK51;
+}
+
+static void fe51_mul(fe51 h, const fe51 f, const fe51 g)
+{
+	uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+	uint64_t g0 = g[0], g1 = g[1], g2 = g[2], g3 = g[3], g4 = g[4];
+	uint64_t g1_19 = g1 * 19, g2_19 = g2 * 19, g3_19 = g3 * 19, g4_19 = g4 * 19;
+#define M(a, b) ((uint128_t)(a) * (b))
+	fe51_reduce(h,
+		M(f0, g0) + M(f1, g4_19) + M(f2, g3_19) + M(f3, g2_19) + M(f4, g1_19),
+		M(f0, g1) + M(f1, g0)    + M(f2, g4_19) + M(f3, g3_19) + M(f4, g2_19),
+		M(f0, g2) + M(f1, g1)    + M(f2, g0)    + M(f3, g4_19) + M(f4, g3_19),
+		M(f0, g3) + M(f1, g2)    + M(f2, g1)    + M(f3, g0)    + M(f4, g4_19),
+		M(f0, g4) + M(f1, g3)    + M(f2, g2)    + M(f3, g1)    + M(f4, g0)
+	);
+}
+
+static void fe51_sq(fe51 h, const fe51 f)
+{
+	uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+	uint64_t f0_2 = f0 * 2, f1_2 = f1 * 2;
+	uint64_t f3_19 = f3 * 19, f4_19 = f4 * 19;
+
+	fe51_reduce(h,
+		M(f0, f0)   + M(f1_2, f4_19) + M(f2 * 2, f3_19),
+		M(f0_2, f1) + M(f2 * 2, f4_19) + M(f3, f3_19),
+		M(f0_2, f2) + M(f1, f1)        + M(f3 * 2, f4_19),
+		M(f0_2, f3) + M(f1_2, f2)      + M(f4, f4_19),
+		M(f0_2, f4) + M(f1_2, f3)      + M(f2, f2)
+	);
+#undef M
+}
+
+static void fe51_sqn(fe51 h, const fe51 f, int n)
+{
+	fe51_sq(h, f);
+	while (--n > 0)
+		fe51_sq(h, h);
+}
+
+/* h = f * 121665, that is, (486662 - 2) / 4 */
+static void fe51_mul_a24(fe51 h, const fe51 f)
+{
+	int i;
+	uint64_t c = 0;
+
+	for (i = 0; i < 5; i++) {
+		uint128_t t = (uint128_t)f[i] * 121665 + c;
+		h[i] = (uint64_t)t & MASK51;
+		c = (uint64_t)(t >> 51);
+	}
+	h[0] += c * 19;
+}
+
+/* h = f^(p-2) = 1/f */
+static void fe51_invert(fe51 h, const fe51 f)
+{
+	fe51 z2, z9, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+
+	fe51_sq(z2, f);               /* 2 */
+	fe51_sqn(t, z2, 2);           /* 8 */
+	fe51_mul(z9, t, f);           /* 9 */
+	fe51_mul(z11, z9, z2);        /* 11 */
+	fe51_sq(t, z11);              /* 22 */
+	fe51_mul(z2_5_0, t, z9);      /* 2^5 - 2^0 */
+	fe51_sqn(t, z2_5_0, 5);
+	fe51_mul(z2_10_0, t, z2_5_0); /* 2^10 - 2^0 */
+	fe51_sqn(t, z2_10_0, 10);
+	fe51_mul(z2_20_0, t, z2_10_0);
+	fe51_sqn(t, z2_20_0, 20);
+	fe51_mul(t, t, z2_20_0);      /* 2^40 - 2^0 */
+	fe51_sqn(t, t, 10);
+	fe51_mul(z2_50_0, t, z2_10_0);
+	fe51_sqn(t, z2_50_0, 50);
+	fe51_mul(z2_100_0, t, z2_50_0);
+	fe51_sqn(t, z2_100_0, 100);
+	fe51_mul(t, t, z2_100_0);     /* 2^200 - 2^0 */
+	fe51_sqn(t, t, 50);
+	fe51_mul(t, t, z2_50_0);      /* 2^250 - 2^0 */
+	fe51_sqn(t, t, 5);
+	fe51_mul(h, t, z11);          /* 2^255 - 2^5 + 11 = p - 2 */
+}
+
+/* Swap f and g if mask is all-ones, do nothing if it is zero */
+static void fe51_cswap(fe51 f, fe51 g, uint64_t mask)
+{
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		uint64_t x = mask & (f[i] ^ g[i]);
+		f[i] ^= x;
+		g[i] ^= x;
+	}
+}
+
+/* f = g if mask is all-ones */
+static void fe51_cmov(fe51 f, const fe51 g, uint64_t mask)
+{
+	int i;
+
+	for (i = 0; i < 5; i++)
+		f[i] ^= mask & (f[i] ^ g[i]);
+}
+
+/* Montgomery ladder, RFC 7748 5 */
+static void x25519_ladder(uint8_t *result, const uint8_t *e, const uint8_t *q)
+{
+	fe51 x1, x2, z2, x3, z3;
+	fe51 a, aa, b, bb, c, d, da, cb, ee;
+	uint64_t swap;
+	int i;
+
+	fe51_frombytes(x1, q);
+	memset(x2, 0, sizeof(x2));
+	x2[0] = 1;
+	memset(z2, 0, sizeof(z2));
+	memcpy(x3, x1, sizeof(x3));
+	memcpy(z3, x2, sizeof(z3));
+
+	swap = 0;
+	for (i = 254; i >= 0; i--) {
+		uint64_t bit = (e[i >> 3] >> (i & 7)) & 1;
+
+		swap ^= bit;
+		fe51_cswap(x2, x3, 0 - swap);
+		fe51_cswap(z2, z3, 0 - swap);
+		swap = bit;
+
+		fe51_add(a, x2, z2);
+		fe51_sq(aa, a);
+		fe51_sub(b, x2, z2);
+		fe51_sq(bb, b);
+		fe51_sub(ee, aa, bb);
+		fe51_add(c, x3, z3);
+		fe51_sub(d, x3, z3);
+		fe51_mul(da, d, a);
+		fe51_mul(cb, c, b);
+		fe51_add(a, da, cb);
+		fe51_sq(x3, a);
+		fe51_sub(b, da, cb);
+		fe51_sq(b, b);
+		fe51_mul(z3, x1, b);
+		fe51_mul(x2, aa, bb);
+		fe51_mul_a24(a, ee);
+		fe51_add(a, aa, a);
+		fe51_mul(z2, ee, a);
+	}
+	fe51_cswap(x2, x3, 0 - swap);
+	fe51_cswap(z2, z3, 0 - swap);
+
+	fe51_invert(z2, z2);
+	fe51_mul(x2, x2, z2);
+	fe51_tobytes(result, x2);
+}
+
+/* Fixed-base multiplication is done on the birationally equivalent
+ * twisted Edwards curve (Ed25519), where points can be added,
+ * using a comb with 4 teeth 64 bits apart:
+ * ed25519_comb[i-1] = sum of (2^(64*j) * B) for each bit j set in i,
+ * as affine (y+x, y-x, 2*d*x*y).
+ * This needs 64 doublings and 64 additions instead of a 255-step ladder.
+ * The result is converted to Montgomery u = (Z+Y)/(Z-Y).
+ */
+static const uint64_t ed25519_comb[15][3][5] ALIGNED(8) = {
+	{ /* 1 */
+		{ 0x493c6f58c3b85, 0x0df7181c325f7, 0x0f50b0b3e4cb7, 0x5329385a44c32, 0x07cf9d3a33d4b },
+		{ 0x03905d740913e, 0x0ba2817d673a2, 0x23e2827f4e67c, 0x133d2e0c21a34, 0x44fd2f9298f81 },
+		{ 0x11205877aaa68, 0x479955893d579, 0x50d66309b67a0, 0x2d42d0dbee5ee, 0x6f117b689f0c6 },
+	},
+	{ /* 2 */
+		{ 0x265e777d1f515, 0x0f1f54c1e39a5, 0x2f01b95522646, 0x4fdd8db9dde6d, 0x654878cba97cc },
+		{ 0x38ec78df6b0fe, 0x13caebea36a22, 0x5ebc6e54e5f6a, 0x32804903d0eb8, 0x2102fdba2b20d },
+		{ 0x6e405055ce6a1, 0x5024a35a532d3, 0x1f69054daf29d, 0x15d1d0d7a8bd5, 0x0ad725db29ecb },
+	},
+	{ /* 3 */
+		{ 0x5c585601e59e8, 0x56cc901cc000a, 0x11791321e4cd0, 0x7959f0a55687f, 0x26ead8e64813c },
+		{ 0x5b8b69c8462a4, 0x0acfa639af96e, 0x04d0bd8b761bf, 0x797e68cb97644, 0x0975b5970fc12 },
+		{ 0x72303da5ba743, 0x02a5e374dcc79, 0x1cd9f6812fe76, 0x2f5199bc86855, 0x534670479df6c },
+	},
+	{ /* 4 */
+		{ 0x304bfacad8ea2, 0x502917d108b07, 0x043176ca6dd0f, 0x5d5158f2c1d84, 0x2b5449e58eb3b },
+		{ 0x27562eb3dbe47, 0x291d7b4170be7, 0x5d1ca67dfa8e1, 0x2a88061f298a2, 0x1304e9e71627d },
+		{ 0x014d26adc9cfe, 0x7f1691ba16f13, 0x5e71828f06eac, 0x349ed07f0fffc, 0x4468de2d7c2dd },
+	},
+	{ /* 5 */
+		{ 0x0278de3bc6748, 0x41a1641dee423, 0x1eec6639c7ff5, 0x6a6faa8df28e3, 0x26a13664d0543 },
+		{ 0x22d3b13a339ee, 0x20d9b12a5252a, 0x3d3c3c6154895, 0x2176ff51d6a56, 0x49d76bba79427 },
+		{ 0x242338d56e61d, 0x0d86a2533429f, 0x6b6c6146474e5, 0x6e1123eabb6d3, 0x4e1fafe3a8fce },
+	},
+	{ /* 6 */
+		{ 0x7053d236a044c, 0x62771b0fc62bc, 0x486a0a0f376f2, 0x5d228ccb06969, 0x4e559a0f0fc5b },
+		{ 0x0e8769c12701c, 0x14073876bffc0, 0x00bac6e577370, 0x18660b4a2a586, 0x727021d35f875 },
+		{ 0x1040727df241e, 0x5565201a6d4ae, 0x29a6b7b7d17be, 0x00eff376dae30, 0x64fcb73007bbc },
+	},
+	{ /* 7 */
+		{ 0x758cc6fd390ca, 0x6a2e3531f871d, 0x10b597fbde195, 0x377c4285bc7e2, 0x6f34c66d6fd08 },
+		{ 0x3cbb43898dc04, 0x64860f6e4f27e, 0x0d260741e47fe, 0x7b6ebdec04b67, 0x0b598b8e8b849 },
+		{ 0x7c18a0cc2f689, 0x0f6a539c54239, 0x02d6502044518, 0x364054de02360, 0x412128b0b1ac6 },
+	},
+	{ /* 8 */
+		{ 0x5cc9dc80c1ac0, 0x683671486d4cd, 0x76f5f1a5e8173, 0x6d5d3f5f9df4a, 0x7da0b8f68d7e7 },
+		{ 0x02014385675a6, 0x6155fb53d1def, 0x37ea32e89927c, 0x059a668f5a82e, 0x46115aba1d4dc },
+		{ 0x71953c3b5da76, 0x6642233d37a81, 0x2c9658076b1bd, 0x5a581e63010ff, 0x5a5f887e83674 },
+	},
+	{ /* 9 */
+		{ 0x560180ca2c1f4, 0x3798d1be80151, 0x0bd3a66057ac3, 0x2e06bf33d23dc, 0x45a02890607f1 },
+		{ 0x366d1fd41f184, 0x22039fc23dfde, 0x5429d362da528, 0x0dd259cf0af00, 0x4013f03d6ad35 },
+		{ 0x282dc6ee065cc, 0x7a4495cc8d7a0, 0x2f3a1d0dae653, 0x727a9a74d6c7f, 0x482255c1d9f06 },
+	},
+	{ /* 10 */
+		{ 0x3eacf71cef800, 0x099515fd76780, 0x0a711de40d9d5, 0x2311c1ff51435, 0x4e8593b0bc655 },
+		{ 0x6114aa3e5638c, 0x525389e41a25b, 0x62c4e8ee8a92a, 0x4a22b58694ebd, 0x6bb91a497b9b7 },
+		{ 0x1e646c5e7d206, 0x1b24c7888a549, 0x6ad4a7ac4fbe7, 0x1cda855b67476, 0x20cf7d79b0ebe },
+	},
+	{ /* 11 */
+		{ 0x28f4e8ae75c48, 0x22880016c197a, 0x2f085c0f3780a, 0x4431b9ddce44c, 0x7c1188539f570 },
+		{ 0x4939df0fe7dca, 0x1f9752a39cfb6, 0x5f87477d43ae4, 0x34e84c5f30e1a, 0x0235623788994 },
+		{ 0x6effae15a4c03, 0x2878ef1c0a41e, 0x267799cbd1c2a, 0x241bcfa8501fe, 0x38d20188d1061 },
+	},
+	{ /* 12 */
+		{ 0x011ad0e6315df, 0x0bc55d652047d, 0x57561b02d9434, 0x6f75bdd07acd3, 0x043eedd45e1f4 },
+		{ 0x147f2c7073217, 0x33e75fa419ed8, 0x107e00b1946e4, 0x39f12c7edfeb8, 0x173c4fa94f450 },
+		{ 0x1ea60928df9c4, 0x0c66e6ac5a7ae, 0x2554ac96df9e0, 0x2396cd828a651, 0x1e2a7024993cc },
+	},
+	{ /* 13 */
+		{ 0x20fbcd45c811f, 0x7b25d81006c03, 0x74901fc92def1, 0x593506573158b, 0x5fcb43ee06225 },
+		{ 0x509b93509fba4, 0x6c0ac636ea620, 0x100721c3636cd, 0x3b9cbef665d29, 0x044649f411b2e },
+		{ 0x524ad9598215f, 0x4d986cc518181, 0x05b73a86dfe40, 0x2c799c717aab8, 0x0c8a1bfa5cc0e },
+	},
+	{ /* 14 */
+		{ 0x703b5681d104c, 0x3224c7968b1bc, 0x395b18cf4bde9, 0x3655738860b8e, 0x6b857c7efcc3e },
+		{ 0x256b48b2801c0, 0x5878801f88f3a, 0x4cee905fa7efa, 0x56553a8d58ea3, 0x09de2bf5dd418 },
+		{ 0x10ff3eff0687f, 0x69e3c6f74477e, 0x5980d357aeba8, 0x165724f30930e, 0x5b466e2ac3b24 },
+	},
+	{ /* 15 */
+		{ 0x6eb6747fbb842, 0x6ac102351626f, 0x7e32269e77d71, 0x7e12d15d3b7b8, 0x09952a563bc8f },
+		{ 0x0cb4bdc7ef83c, 0x74bf27844d455, 0x1938e965ad71b, 0x797ea75f58d83, 0x409b4adce5c6c },
+		{ 0x53db9834350c4, 0x0b4bea0b6889a, 0x527fcbe24a64c, 0x6b27d917d512c, 0x69b968a704657 },
+	},
+};
+
+typedef struct {
+	fe51 X, Y, Z, T; /* extended coordinates: x = X/Z, y = Y/Z, x*y = T/Z */
+} ge25519;
+
+static void ge25519_dbl(ge25519 *r)
+{
+	fe51 xx, yy, b, e, f, g, h;
+
+	fe51_sq(xx, r->X);
+	fe51_sq(yy, r->Y);
+	fe51_sq(b, r->Z);
+	fe51_add(b, b, b);
+	fe51_add(e, r->X, r->Y);
+	fe51_sq(e, e);
+	fe51_add(h, yy, xx);
+	fe51_sub(e, e, h);  /* 2*X*Y */
+	fe51_sub(g, yy, xx);
+	fe51_sub(f, b, g);
+	fe51_mul(r->X, e, f);
+	fe51_mul(r->Y, h, g);
+	fe51_mul(r->Z, g, f);
+	fe51_mul(r->T, e, h);
+}
+
+/* r += (y+x, y-x, 2*d*x*y) */
+static void ge25519_madd(ge25519 *r, const fe51 yplusx, const fe51 yminusx, const fe51 xy2d)
+{
+	fe51 a, b, c, d, e, f, g, h;
+
+	fe51_sub(a, r->Y, r->X);
+	fe51_mul(a, a, yminusx);
+	fe51_add(b, r->Y, r->X);
+	fe51_mul(b, b, yplusx);
+	fe51_mul(c, r->T, xy2d);
+	fe51_add(d, r->Z, r->Z);
+	fe51_sub(e, b, a);
+	fe51_sub(f, d, c);
+	fe51_add(g, d, c);
+	fe51_add(h, b, a);
+	fe51_mul(r->X, e, f);
+	fe51_mul(r->Y, g, h);
+	fe51_mul(r->Z, f, g);
+	fe51_mul(r->T, e, h);
+}
+
+static void x25519_base(uint8_t *result, const uint8_t *e)
+{
+	ge25519 r;
+	fe51 t[3];
+	int i, j;
+
+	memset(&r, 0, sizeof(r));
+	r.Y[0] = 1;
+	r.Z[0] = 1;
+	for (i = 63; i >= 0; i--) {
+		unsigned idx;
+
+		ge25519_dbl(&r);
+
+		idx = ((e[(i      ) >> 3] >> (i & 7)) & 1)
+		    | ((e[(i +  64) >> 3] >> (i & 7)) & 1) << 1
+		    | ((e[(i + 128) >> 3] >> (i & 7)) & 1) << 2
+		    | ((e[(i + 192) >> 3] >> (i & 7)) & 1) << 3;
+		/* Constant-time lookup, idx 0 is the neutral point (1, 1, 0) */
+		memset(t, 0, sizeof(t));
+		t[0][0] = 1;
+		t[1][0] = 1;
+		for (j = 1; j < 16; j++) {
+			uint64_t mask = ((uint64_t)(idx ^ j) - 1) >> 63;
+			mask = 0 - mask;
+			fe51_cmov(t[0], ed25519_comb[j - 1][0], mask);
+			fe51_cmov(t[1], ed25519_comb[j - 1][1], mask);
+			fe51_cmov(t[2], ed25519_comb[j - 1][2], mask);
+		}
+		ge25519_madd(&r, t[0], t[1], t[2]);
+	}
+
+	/* u = (1 + y) / (1 - y) = (Z + Y) / (Z - Y) */
+	fe51_sub(t[1], r.Z, r.Y);
+	fe51_invert(t[1], t[1]);
+	fe51_add(t[0], r.Z, r.Y);
+	fe51_mul(t[0], t[0], t[1]);
+	fe51_tobytes(result, t[0]);
+}
+
+static void curve25519(uint8_t *result, const uint8_t *e, const uint8_t *q)
+{
+	if (!q)
+		x25519_base(result, e);
+	else
+		x25519_ladder(result, e, q);
+}
+
+#endif /* CURVE25519_RADIX51 */
+
 /* interface to bbox's TLS code: */
 
 void FAST_FUNC curve_x25519_compute_pubkey_and_premaster(
@@ -626,3 +1076,51 @@ void FAST_FUNC curve_x25519_compute_pubkey_and_premaster(
 	/* Compute premaster using peer's public key */
 	curve25519(premaster, privkey, peerkey32);
 }
+
+#if ENABLE_UNIT_TEST
+
+/* RFC 7748 6.1 */
+BBUNIT_DEFINE_TEST(x25519)
+{
+	static const char alice_priv_hex[] ALIGN1 =
+		"77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a";
+	static const char alice_pub_hex[] ALIGN1 =
+		"8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a";
+	static const char bob_priv_hex[] ALIGN1 =
+		"5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb";
+	static const char bob_pub_hex[] ALIGN1 =
+		"de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f";
+	static const char shared_hex[] ALIGN1 =
+		"4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742";
+	uint8_t a[CURVE25519_KEYSIZE], b[CURVE25519_KEYSIZE];
+	uint8_t bpub[CURVE25519_KEYSIZE], out[CURVE25519_KEYSIZE];
+	uint8_t base9[CURVE25519_KEYSIZE];
+	char hex[2 * CURVE25519_KEYSIZE + 1];
+
+	hex2bin((char*)a, alice_priv_hex, CURVE25519_KEYSIZE);
+	a[0] &= 0xf8;
+	a[31] = (a[31] & 0x7f) | 0x40;
+	hex2bin((char*)b, bob_priv_hex, CURVE25519_KEYSIZE);
+	b[0] &= 0xf8;
+	b[31] = (b[31] & 0x7f) | 0x40;
+
+	curve25519(out, a, NULL);
+	*bin2hex(hex, (char*)out, CURVE25519_KEYSIZE) = '\0';
+	BBUNIT_ASSERT_STREQ(alice_pub_hex, hex);
+
+	/* Same result via the generic path with explicit base point */
+	memset(base9, 0, sizeof(base9));
+	base9[0] = 9;
+	curve25519(out, b, base9);
+	*bin2hex(hex, (char*)out, CURVE25519_KEYSIZE) = '\0';
+	BBUNIT_ASSERT_STREQ(bob_pub_hex, hex);
+	memcpy(bpub, out, sizeof(bpub));
+
+	curve25519(out, a, bpub);
+	*bin2hex(hex, (char*)out, CURVE25519_KEYSIZE) = '\0';
+	BBUNIT_ASSERT_STREQ(shared_hex, hex);
+
+	BBUNIT_ENDTEST;
+}
+
+#endif /* ENABLE_UNIT_TEST */
@@ -39,6 +39,8 @@ typedef int32_t signed_sp_digit;
  */
 #if defined(__GNUC__) && defined(__x86_64__)
 # define UNALIGNED_LE_64BIT 1
+#elif defined(__GNUC__) && defined(__aarch64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+# define UNALIGNED_LE_64BIT 1
 #else
 # define UNALIGNED_LE_64BIT 0
 #endif
@@ -78,7 +80,7 @@ static const sp_digit p256_mod[8] ALIGNED(8) = {
 static void sp_256_to_bin_8(const sp_digit* rr, uint8_t* a)
 {
 	int i;
-	const uint64_t* r = (void*)rr;
+	const bb__aliased_uint64_t* r = (void*)rr;
 
 	r += 4;
 	for (i = 0; i < 4; i++) {
@@ -111,7 +113,7 @@ static void sp_256_to_bin_8(const sp_digit* r, uint8_t* a)
 static void sp_256_from_bin_8(sp_digit* rr, const uint8_t* a)
 {
 	int i;
-	uint64_t* r = (void*)rr;
+	bb__aliased_uint64_t* r = (void*)rr;
 
 	r += 4;
 	for (i = 0; i < 4; i++) {
@@ -281,6 +283,25 @@ static int sp_256_add_8(sp_digit* r, const sp_digit* a, const sp_digit* b)
 		: "memory"
 	);
 	return reg;
+#elif UNALIGNED_LE_64BIT
+	const bb__aliased_uint64_t* aa = (const void*)a;
+	const bb__aliased_uint64_t* bb = (const void*)b;
+	bb__aliased_uint64_t* rr = (void*)r;
+	int i;
+	uint64_t carry;
+
+	carry = 0;
+	for (i = 0; i < 4; i++) {
+		uint64_t w, v;
+		w = bb[i] + carry;
+		v = aa[i];
+		if (w != 0) {
+			v = aa[i] + w;
+			carry = (v < aa[i]);
+		}
+		rr[i] = v;
+	}
+	return carry;
 #else
 	int i;
 	sp_digit carry;
@@ -377,6 +398,25 @@ static int sp_256_sub_8(sp_digit* r, const sp_digit* a, const sp_digit* b)
 		: "memory"
 	);
 	return reg;
+#elif UNALIGNED_LE_64BIT
+	const bb__aliased_uint64_t* aa = (const void*)a;
+	const bb__aliased_uint64_t* bb = (const void*)b;
+	bb__aliased_uint64_t* rr = (void*)r;
+	int i;
+	uint64_t borrow;
+
+	borrow = 0;
+	for (i = 0; i < 4; i++) {
+		uint64_t w, v;
+		w = bb[i] + borrow;
+		v = aa[i];
+		if (w != 0) {
+			v = aa[i] - w;
+			borrow = (v > aa[i]);
+		}
+		rr[i] = v;
+	}
+	return borrow;
 #else
 	int i;
 	sp_digit borrow;
@@ -442,7 +482,7 @@ static void sp_256_sub_8_p256_mod(sp_digit* r)
 "\n		movq	%2, 3*8(%0)"
 "\n"
 		: "=r" (r), "=r" (ooff), "=r" (reg)
-		: "0" (r), "1" (0x00000000ffffffff)
+		: "0" (r), "1" ((uint64_t)0x00000000ffffffff)
 		: "memory"
 	);
 }
@@ -473,17 +513,20 @@ static void sp_256to512_mul_8(sp_digit* r, const sp_digit* a, const sp_digit* b)
 		j = k - i;
 		acc_hi = 0;
 		do {
+			uint32_t ax = a[i];
 ////////////////////////
 //			uint64_t m = ((uint64_t)a[i]) * b[j];
 //			acc_hi:acch:accl += m;
 			asm volatile (
 			// a[i] is already loaded in %%eax
+			// (mull overwrites it: "+a", else gcc may reuse %%eax
+			// for one of the outputs, or assume it still holds a[i])
 "\n			mull	%7"
 "\n			addl	%%eax, %0"
 "\n			adcl	%%edx, %1"
 "\n			adcl	$0, %2"
-			: "=rm" (accl), "=rm" (acch), "=rm" (acc_hi)
-			: "0" (accl), "1" (acch), "2" (acc_hi), "a" (a[i]), "m" (b[j])
+			: "=rm" (accl), "=rm" (acch), "=rm" (acc_hi), "+a" (ax)
+			: "0" (accl), "1" (acch), "2" (acc_hi), "m" (b[j])
 			: "cc", "dx"
 			);
 ////////////////////////
@@ -513,17 +556,18 @@ static void sp_256to512_mul_8(sp_digit* r, const sp_digit* a, const sp_digit* b)
 		j = k - i;
 		acc_hi = 0;
 		do {
+			uint64_t ax = aa[i];
 ////////////////////////
 //			uint128_t m = ((uint128_t)a[i]) * b[j];
 //			acc_hi:acch:accl += m;
 			asm volatile (
-			// aa[i] is already loaded in %%rax
+			// aa[i] is already loaded in %%rax (see "+a" comment above)
 "\n			mulq	%7"
 "\n			addq	%%rax, %0"
 "\n			adcq	%%rdx, %1"
 "\n			adcq	$0, %2"
-			: "=rm" (accl), "=rm" (acch), "=rm" (acc_hi)
-			: "0" (accl), "1" (acch), "2" (acc_hi), "a" (aa[i]), "m" (bb[j])
+			: "=rm" (accl), "=rm" (acch), "=rm" (acc_hi), "+a" (ax)
+			: "0" (accl), "1" (acch), "2" (acc_hi), "m" (bb[j])
 			: "cc", "dx"
 			);
 ////////////////////////
@@ -535,6 +579,36 @@ static void sp_256to512_mul_8(sp_digit* r, const sp_digit* a, const sp_digit* b)
 		acch = acc_hi;
 	}
 	rr[7] = accl;
+#elif UNALIGNED_LE_64BIT && defined(__SIZEOF_INT128__)
+	/* Same as above, in C: compilers generate good code
+	 * for 64x64->128 multiplies on 64-bit arches */
+	const bb__aliased_uint64_t* aa = (const void*)a;
+	const bb__aliased_uint64_t* bb = (const void*)b;
+	bb__aliased_uint64_t* rr = (void*)r;
+	int k;
+	unsigned __int128 acc;
+
+	acc = 0;
+	for (k = 0; k < 7; k++) {
+		int i, j;
+		uint64_t acc_hi;
+		i = k - 3;
+		if (i < 0)
+			i = 0;
+		j = k - i;
+		acc_hi = 0;
+		do {
+			unsigned __int128 m = ((unsigned __int128)aa[i]) * bb[j];
+			acc += m;
+			if (acc < m)
+				acc_hi++;
+			j--;
+			i++;
+		} while (i != 4 && i <= k);
+		rr[k] = acc;
+		acc = (acc >> 64) | ((unsigned __int128)acc_hi << 64);
+	}
+	rr[7] = acc;
 #elif 0
 	//TODO: arm assembly (untested)
 	asm volatile (
@@ -1386,6 +1460,127 @@ static void sp_256_ecc_mulmod_8(sp_point* r, const sp_point* g, const sp_digit*
 	memset(t, 0, sizeof(t)); //paranoia
 }
 
+#if ULONG_MAX > 0xffffffff
+/* On 64-bit targets, the base point is multiplied using a comb
+ * with 4 teeth 64 bits apart:
+ * p256_comb[i-1] = sum of (2^(64*j) * G) for each bit j set in i,
+ * affine x,y in Montgomery form.
+ * This needs 64 doublings and 64 additions instead of 256 of each.
+ */
+static const sp_digit p256_comb[15][2][8] ALIGNED(8) = {
+	{ /* 1 */
+		{ 0x18a9143c,0x79e730d4,0x5fedb601,0x75ba95fc,0x77622510,0x79fb732b,0xa53755c6,0x18905f76 },
+		{ 0xce95560a,0xddf25357,0xba19e45c,0x8b4ab8e4,0xdd21f325,0xd2e88688,0x25885d85,0x8571ff18 },
+	},
+	{ /* 2 */
+		{ 0x16a0d2bb,0x4f922fc5,0x1a623499,0x0d5cc16c,0x57c62c8b,0x9241cf3a,0xfd1b667f,0x2f5e6961 },
+		{ 0xf5a01797,0x5c15c70b,0x60956192,0x3d20b44d,0x071fdb52,0x04911b37,0x8d6f0f7b,0xf648f916 },
+	},
+	{ /* 3 */
+		{ 0xe137bbbc,0x9e566847,0x8a6a0bec,0xe434469e,0x79d73463,0xb1c42761,0x133d0015,0x5abe0285 },
+		{ 0xc04c7dab,0x92aa837c,0x43260c07,0x573d9f4c,0x78e6cc37,0x0c931562,0x6b6f7383,0x94bb725b },
+	},
+	{ /* 4 */
+		{ 0xbfe20925,0x62a8c244,0x8fdce867,0x91c19ac3,0xdd387063,0x5a96a5d5,0x21d324f6,0x61d587d4 },
+		{ 0xa37173ea,0xe87673a2,0x53778b65,0x23848008,0x05bab43e,0x10f8441e,0x4621efbe,0xfa11fe12 },
+	},
+	{ /* 5 */
+		{ 0x2cb19ffd,0x1c891f2b,0xb1923c23,0x01ba8d5b,0x8ac5ca8e,0xb6d03d67,0x1f13bedc,0x586eb04c },
+		{ 0x27e8ed09,0x0c35c6e5,0x1819ede2,0x1e81a33c,0x56c652fa,0x278fd6c0,0x70864f11,0x19d5ac08 },
+	},
+	{ /* 6 */
+		{ 0xd2b533d5,0x62577734,0xa1bdddc0,0x673b8af6,0xa79ec293,0x577e7c9a,0xc3b266b1,0xbb6de651 },
+		{ 0xb65259b3,0xe7e9303a,0xd03a7480,0xd6a0afd3,0x9b3cfc27,0xc5ac83d1,0x5d18b99b,0x60b4619a },
+	},
+	{ /* 7 */
+		{ 0x1ae5aa1c,0xbd6a38e1,0x49e73658,0xb8b7652b,0xee5f87ed,0x0b130014,0xaeebffcd,0x9d0f27b2 },
+		{ 0x7a730a55,0xca924631,0xddbbc83a,0x9c955b2f,0xac019a71,0x07c1dfe0,0x356ec48d,0x244a566d },
+	},
+	{ /* 8 */
+		{ 0xf4f8b16a,0x56f8410e,0xc47b266a,0x97241afe,0x6d9c87c1,0x0a406b8e,0xcd42ab1b,0x803f3e02 },
+		{ 0x04dbec69,0x7f0309a8,0x3bbad05f,0xa83b85f7,0xad8e197f,0xc6097273,0x5067adc1,0xc097440e },
+	},
+	{ /* 9 */
+		{ 0xc379ab34,0x846a56f2,0x841df8d1,0xa8ee068b,0x176c68ef,0x20314459,0x915f1f30,0xf1af32d5 },
+		{ 0x5d75bd50,0x99c37531,0xf72f67bc,0x837cffba,0x48d7723f,0x0613a418,0xe2d41c8b,0x23d0f130 },
+	},
+	{ /* 10 */
+		{ 0xd5be5a2b,0xed93e225,0x5934f3c6,0x6fe79983,0x22626ffc,0x43140926,0x7990216a,0x50bbb4d9 },
+		{ 0xe57ec63e,0x378191c6,0x181dcdb2,0x65422c40,0x0236e0f6,0x41a8099b,0x01fe49c3,0x2b100118 },
+	},
+	{ /* 11 */
+		{ 0x9b391593,0xfc68b5c5,0x598270fc,0xc385f5a2,0xd19adcbb,0x7144f3aa,0x83fbae0c,0xdd558999 },
+		{ 0x74b82ff4,0x93b88b8e,0x71e734c9,0xd2e03c40,0x43c0322a,0x9a7a9eaf,0x149d6041,0xe6e4c551 },
+	},
+	{ /* 12 */
+		{ 0x80ec21fe,0x5fe14bfe,0xc255be82,0xf6ce116a,0x2f4a5d67,0x98bc5a07,0xdb7e63af,0xfad27148 },
+		{ 0x29ab05b3,0x90c0b6ac,0x4e251ae6,0x37a9a83c,0xc2aade7d,0x0a7dc875,0x9f0e1a84,0x77387de3 },
+	},
+	{ /* 13 */
+		{ 0xa56c0dd7,0x1e9ecc49,0x46086c74,0xa5cffcd8,0xf505aece,0x8f7a1408,0xbef0c47e,0xb37b85c0 },
+		{ 0xcc0e6a8f,0x3596b6e4,0x6b388f23,0xfd6d4bbf,0xc39cef4e,0xaba453fa,0xf9f628d5,0x9c135ac8 },
+	},
+	{ /* 14 */
+		{ 0x95c8f8be,0x0a1c7294,0x3bf362bf,0x2961c480,0xdf63d4ac,0x9e418403,0x91ece900,0xc109f9cb },
+		{ 0x58945705,0xc2d095d0,0xddeb85c0,0xb9083d96,0x7a40449b,0x84692b8d,0x2eee1ee1,0x9bc3344f },
+	},
+	{ /* 15 */
+		{ 0x42913074,0x0d5ae356,0x48a542b1,0x55491b27,0xb310732a,0x469ca665,0x5f1a4cc1,0x29591d52 },
+		{ 0xb84f983f,0xe76f5b6b,0x9f5f84e1,0xbe7eef41,0x80baa189,0x1200d496,0x18ef332c,0x6376551f },
+	},
+};
+
+/* 1 in Montgomery form (2^256 mod p) */
+static const sp_digit p256_mont_one[8] ALIGNED(8) = {
+	0x00000001,0x00000000,0x00000000,0xffffffff,
+	0xffffffff,0xffffffff,0xfffffffe,0x00000000,
+};
+
+/* Multiply the base point of P256 by the scalar and return the result.
+ * Result is in affine co-ordinates.
+ *
+ * r     Resulting point.
+ * k     Scalar to multiply by.
+ */
+static void sp_256_ecc_mulmod_base_8(sp_point* r, sp_digit* k /*, int map*/)
+{
+	sp_point t[2];
+	int i;
+
+	memset(t, 0, sizeof(t));
+	t[0].infinity = 1;
+	memcpy(t[1].z, p256_mont_one, sizeof(t[1].z));
+
+	for (i = 63; i >= 0; i--) {
+		unsigned idx;
+		int j, w;
+
+		sp_256_proj_point_dbl_8(&t[0], &t[0]);
+
+		idx = ((k[(i      ) >> 5] >> (i & 31)) & 1)
+		    | ((k[(i +  64) >> 5] >> (i & 31)) & 1) << 1
+		    | ((k[(i + 128) >> 5] >> (i & 31)) & 1) << 2
+		    | ((k[(i + 192) >> 5] >> (i & 31)) & 1) << 3;
+		/* Read all entries, so that memory access pattern
+		 * does not depend on the secret scalar */
+		memset(t[1].x, 0, sizeof(t[1].x));
+		memset(t[1].y, 0, sizeof(t[1].y));
+		for (j = 1; j < 16; j++) {
+			sp_digit mask = 0 - (sp_digit)(((unsigned)(idx ^ j) - 1) >> 31);
+			for (w = 0; w < 8; w++) {
+				t[1].x[w] |= mask & p256_comb[j - 1][0][w];
+				t[1].y[w] |= mask & p256_comb[j - 1][1][w];
+			}
+		}
+		t[1].infinity = (idx == 0);
+		sp_256_proj_point_add_8(&t[0], &t[0], &t[1]);
+	}
+
+	sp_256_map_8(r, &t[0]);
+
+	memset(t, 0, sizeof(t)); //paranoia
+}
+#else
 /* Multiply the base point of P256 by the scalar and return the result.
  * If map is true then convert result to affine co-ordinates.
  *
@@ -1413,6 +1608,7 @@ static void sp_256_ecc_mulmod_base_8(sp_point* r, sp_digit* k /*, int map*/)
 
 	sp_256_ecc_mulmod_8(r, &p256_base, k /*, map*/);
 }
+#endif
 
 /* Multiply the point by the scalar and serialize the X ordinate.
  * The number is 0 padded to maximum size on output.
@@ -1496,3 +1692,46 @@ void FAST_FUNC curve_P256_compute_pubkey_and_premaster(
 	sp_ecc_secret_gen_256(privkey, /*x,y:*/peerkey2x32, premaster32);
 	dump_hex("premaster: %s\n", premaster32, 32);
 }
+
+#if ENABLE_UNIT_TEST
+
+/* Key pair from RFC 6979 A.2.5 */
+BBUNIT_DEFINE_TEST(p256_base)
+{
+	static const char priv_hex[] ALIGN1 =
+		"c9afa9d845ba75166b5c215767b1d6934e50c3db36e89b127b8a622b120f6721";
+	static const char pub_hex[] ALIGN1 =
+		"60fed4ba255a9d31c961eb74c6356d68c049b8923b61fa6ce669622e60f29fb6"
+		"7903fe1008b8bc99a41ae9e95628bc64f2f1b20c2d7e9f5177a3c294d4462299";
+	static const uint8_t p256_base_bin[] = {
+		0x6b,0x17,0xd1,0xf2,0xe1,0x2c,0x42,0x47,0xf8,0xbc,0xe6,0xe5,0x63,0xa4,0x40,0xf2,
+		0x77,0x03,0x7d,0x81,0x2d,0xeb,0x33,0xa0,0xf4,0xa1,0x39,0x45,0xd8,0x98,0xc2,0x96,
+		0x4f,0xe3,0x42,0xe2,0xfe,0x1a,0x7f,0x9b,0x8e,0xe7,0xeb,0x4a,0x7c,0x0f,0x9e,0x16,
+		0x2b,0xce,0x33,0x57,0x6b,0x31,0x5e,0xce,0xcb,0xb6,0x40,0x68,0x37,0xbf,0x51,0xf5,
+	};
+	uint8_t bin[64];
+	sp_digit k[8] ALIGNED(8);
+	sp_point point[1];
+	char hex[2 * 64 + 1];
+
+	hex2bin((char*)bin, priv_hex, 32);
+	sp_256_from_bin_8(k, bin);
+
+	sp_256_ecc_mulmod_base_8(point, k);
+	sp_256_to_bin_8(point->x, bin);
+	sp_256_to_bin_8(point->y, bin + 32);
+	*bin2hex(hex, (char*)bin, 64) = '\0';
+	BBUNIT_ASSERT_STREQ(pub_hex, hex);
+
+	/* Generic point multiplication must agree */
+	sp_256_point_from_bin2x32(point, p256_base_bin);
+	sp_256_ecc_mulmod_8(point, point, k);
+	sp_256_to_bin_8(point->x, bin);
+	sp_256_to_bin_8(point->y, bin + 32);
+	*bin2hex(hex, (char*)bin, 64) = '\0';
+	BBUNIT_ASSERT_STREQ(pub_hex, hex);
+
+	BBUNIT_ENDTEST;
+}
+
+#endif /* ENABLE_UNIT_TEST */
@@ -53,6 +53,28 @@
 //config:	FEATURE_WGET_LONG_OPTIONS is also enabled, the --timeout option
 //config:	will work in addition to -T.
 //config:
+//config:config FEATURE_WGET_KEEP_ALIVE
+//config:	bool "Reuse connections for several URLs"
+//config:	default y
+//config:	depends on WGET
+//config:	help
+//config:	Keep HTTP/1.1 connections open after a download and send
+//config:	next request (the next URL, or a redirect) over the same
+//config:	connection if it goes to the same server. This saves
+//config:	a TCP and, for https, a TLS handshake per file.
+//config:
+//config:config FEATURE_WGET_SEGMENTS
+//config:	bool "Enable --segments=N (parallel download)"
+//config:	default y
+//config:	depends on FEATURE_WGET_LONG_OPTIONS && !NOMMU
+//config:	help
+//config:	With --segments=N, a file from a HTTP server which accepts
+//config:	byte ranges is fetched over N connections at once, each
+//config:	asking for its part of the file. This helps on links where
+//config:	a single TCP connection can't fill the bandwidth.
+//config:	If the server does not cooperate, the file is downloaded
+//config:	again over one connection.
+//config:
 //config:config FEATURE_WGET_HTTPS
 //config:	bool "Support HTTPS using internal TLS code"
 //config:	default y
@@ -136,14 +158,14 @@
 //usage:#define wget_trivial_usage
 //usage:	IF_FEATURE_WGET_LONG_OPTIONS(
 //usage:       "[-cqS] [--spider] [-O FILE] [-o LOGFILE] [--header STR]\n"
-//usage:       "	[--post-data STR | --post-file FILE] [-Y on/off]\n"
+//usage:       "	[--post-data STR | --post-file FILE] [-Y on/off]"IF_FEATURE_WGET_SEGMENTS(" [--segments N]")"\n"
 /* Since we ignore these opts, we don't show them in --help */
 /* //usage:    "	[--no-cache] [--passive-ftp] [-t TRIES]" */
 /* //usage:    "	[-nv] [-nc] [-nH] [-np]" */
-//usage:       "	"IF_FEATURE_WGET_OPENSSL("[--no-check-certificate] ")"[-P DIR] [-U AGENT]"IF_FEATURE_WGET_TIMEOUT(" [-T SEC]")" URL..."
+//usage:       "	"IF_FEATURE_WGET_OPENSSL("[--no-check-certificate] ")"[-P DIR] [-U AGENT]"IF_FEATURE_WGET_TIMEOUT(" [-T SEC]")" [-i FILE] [URL]..."
 //usage:	)
 //usage:	IF_NOT_FEATURE_WGET_LONG_OPTIONS(
-//usage:       "[-cqS] [-O FILE] [-o LOGFILE] [-Y on/off] [-P DIR] [-U AGENT]"IF_FEATURE_WGET_TIMEOUT(" [-T SEC]")" URL..."
+//usage:       "[-cqS] [-O FILE] [-o LOGFILE] [-Y on/off] [-P DIR] [-U AGENT]"IF_FEATURE_WGET_TIMEOUT(" [-T SEC]")" [-i FILE] [URL]..."
 //usage:	)
 //usage:#define wget_full_usage "\n\n"
 //usage:       "Retrieve files via HTTP or FTP\n"
@@ -152,6 +174,9 @@
 //usage:     "\n	--header STR	Add STR (of form 'header: value') to headers"
 //usage:     "\n	--post-data STR	Send STR using POST method"
 //usage:     "\n	--post-file FILE	Send FILE using POST method"
+//usage:	IF_FEATURE_WGET_SEGMENTS(
+//usage:     "\n	--segments N	Download using N connections in parallel"
+//usage:	)
 //usage:	IF_FEATURE_WGET_OPENSSL(
 //usage:     "\n	--no-check-certificate	Don't validate the server's certificate"
 //usage:	)
@@ -165,6 +190,7 @@
 //usage:	)
 //usage:     "\n	-O FILE		Save to FILE ('-' for stdout)"
 //usage:     "\n	-o LOGFILE	Log messages to FILE"
+//usage:     "\n	-i FILE		Download URLs listed in FILE ('-' for stdin)"
 //usage:     "\n	-U STR		Use STR for User-Agent header"
 //usage:     "\n	-Y on/off	Use proxy"
 
@@ -269,6 +295,21 @@ struct globals {
 #endif
 	smallint chunked;         /* chunked transfer encoding */
 	smallint got_clen;        /* got content-length: from server  */
+#if ENABLE_FEATURE_WGET_KEEP_ALIVE
+	smallint keep_alive;      /* server will keep connection open */
+	FILE *kept_sfp;           /* idle connection from previous request */
+	char *kept_key;           /* its "proto://host:port" */
+#endif
+#if ENABLE_FEATURE_WGET_SEGMENTS
+	smallint accept_ranges;   /* got "accept-ranges: bytes" from server */
+	unsigned segments;        /* --segments N */
+	unsigned seg_cnt;         /* segments of current download */
+	unsigned seg_child;       /* in a child: index of our segment, else 0 */
+	off_t end_range;          /* in a child: last byte of our segment */
+	off_t seg_total;
+	off_t *seg_done;          /* bytes done per segment, shared with children */
+	char *seg_validator;      /* ETag or Last-Modified, children send it in If-Range */
+#endif
 	/* Local downloads do benefit from big buffer.
 	 * With 512 byte buffer, it was measured to be
 	 * an order of magnitude slower than with big one.
@@ -297,11 +338,13 @@ enum {
 	WGET_OPT_NETWORK_READ_TIMEOUT = (1 << 8),
 	WGET_OPT_RETRIES    = (1 << 9),
 	WGET_OPT_nsomething = (1 << 10),
-	WGET_OPT_HEADER     = (1 << 11) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
-	WGET_OPT_POST_DATA  = (1 << 12) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
-	WGET_OPT_SPIDER     = (1 << 13) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
-	WGET_OPT_NO_CHECK_CERT = (1 << 14) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
-	WGET_OPT_POST_FILE  = (1 << 15) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
+	WGET_OPT_INPUT_FILE = (1 << 11),
+	WGET_OPT_HEADER     = (1 << 12) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
+	WGET_OPT_POST_DATA  = (1 << 13) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
+	WGET_OPT_SPIDER     = (1 << 14) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
+	WGET_OPT_NO_CHECK_CERT = (1 << 15) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
+	WGET_OPT_POST_FILE  = (1 << 16) * ENABLE_FEATURE_WGET_LONG_OPTIONS,
+	WGET_OPT_SEGMENTS   = (1 << 17) * ENABLE_FEATURE_WGET_SEGMENTS,
 	/* hijack this bit for other than opts purposes: */
 	WGET_NO_FTRUNCATE   = (1 << 31)
 };
@@ -1049,8 +1092,17 @@ static void NOINLINE retrieve_file_data(FILE *dfp)
 		 */
 		if (G.content_len < 0 || errno)
 			bb_error_msg_and_die("bad chunk length '%s'", G.wget_buf);
-		if (G.content_len == 0)
+		if (G.content_len == 0) {
+#if ENABLE_FEATURE_WGET_KEEP_ALIVE
+			/* Eat trailer, so that next response starts at its beginning */
+			if (G.keep_alive) {
+				do
+					fgets_trim_sanitize(dfp, NULL);
+				while (G.wget_buf[0] != '\0');
+			}
+#endif
 			break; /* all done! */
+		}
 		G.got_clen = 1;
 		/*
 		 * Note that fgets may result in some data being buffered in dfp.
@@ -1094,6 +1146,209 @@ static void NOINLINE retrieve_file_data(FILE *dfp)
 	}
 }
 
+#if ENABLE_FEATURE_WGET_SEGMENTS
+/* Don't bother opening connections for less than this */
+#define SEGMENT_MIN_SIZE (256 * 1024)
+
+static void segments_progress(void)
+{
+#if ENABLE_FEATURE_WGET_STATUSBAR
+	unsigned i;
+	off_t sum = 0;
+
+	for (i = 0; i < G.seg_cnt; i++)
+		sum += G.seg_done[i];
+	G.transferred = sum;
+	G.content_len = G.seg_total - sum;
+	progress_meter(PROGRESS_BUMP);
+#endif
+}
+
+/* Read len bytes from dfp into the output file at pos */
+static int retrieve_segment(FILE *dfp, unsigned idx, off_t pos, off_t len)
+{
+	while (len != 0) {
+		unsigned rdsz = sizeof(G.wget_buf);
+		int n;
+
+		if (len < (off_t)rdsz)
+			rdsz = (unsigned)len;
+		set_alarm();
+		n = fread(G.wget_buf, 1, rdsz, dfp);
+		clear_alarm();
+		if (n <= 0)
+			return -1;
+		if (pwrite(G.output_fd, G.wget_buf, n, pos) != n)
+			bb_simple_perror_msg_and_die(bb_msg_write_error);
+		pos += n;
+		len -= n;
+		G.seg_done[idx] += n;
+		if (idx == 0)
+			segments_progress();
+	}
+	return 0;
+}
+
+/*
+ * We got "200 OK" with Content-Length and "Accept-Ranges: bytes".
+ * Split the file into segments, fork a child per segment (except
+ * the first one, which we read from dfp ourselves), wait for them.
+ * Returns 0 if the file is not worth splitting (nothing was read),
+ * 1 when the file is complete, -1 if a new connection is to be
+ * established: either we are a child (G.seg_child is set),
+ * or a segment failed and we want to retry with a single stream.
+ */
+static int retrieve_file_segments(FILE *dfp)
+{
+	struct stat st;
+	off_t seg_len;
+	pid_t *pids;
+	unsigned n, i;
+	smallint failed;
+
+	n = G.segments;
+	if (G.content_len / n < SEGMENT_MIN_SIZE)
+		n = G.content_len / SEGMENT_MIN_SIZE;
+	/* Not for -O -, and not when appending to -O FILE (2nd URL) */
+	if (n < 2
+	 || (option_mask32 & WGET_NO_FTRUNCATE)
+	 || fstat(G.output_fd, &st) != 0
+	 || !S_ISREG(st.st_mode)
+	 || lseek(G.output_fd, 0, SEEK_CUR) != 0
+	 || ftruncate(G.output_fd, G.content_len) != 0
+	) {
+		return 0;
+	}
+	G.seg_done = mmap(NULL, n * sizeof(G.seg_done[0]),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (G.seg_done == MAP_FAILED)
+		return 0;
+	G.seg_cnt = n;
+	G.seg_total = G.content_len;
+	seg_len = G.content_len / n;
+
+	pids = xzalloc(n * sizeof(pids[0]));
+	for (i = 1; i < n; i++) {
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			free(pids);
+			G.seg_child = i;
+			G.beg_range = i * seg_len;
+			G.end_range = (i == n - 1) ? G.seg_total - 1 : (i + 1) * seg_len - 1;
+			/* parent shows the progress */
+			option_mask32 |= WGET_OPT_QUIET;
+			return -1;
+		}
+	}
+
+	if (!(option_mask32 & WGET_OPT_QUIET))
+		fprintf(stderr, "saving to '%s' using %u connections\n", G.fname_out, n);
+	progress_meter(PROGRESS_START);
+	failed = retrieve_segment(dfp, 0, 0, seg_len);
+
+	/* Wait for children, showing their progress */
+	for (;;) {
+		smallint running = 0;
+
+		for (i = 1; i < n; i++) {
+			int status;
+			pid_t pid;
+
+			if (pids[i] == 0)
+				continue;
+			if (failed && pids[i] > 0)
+				kill(pids[i], SIGTERM);
+			pid = pids[i] < 0 ? -1 : safe_waitpid(pids[i], &status, WNOHANG);
+			if (pid == 0) {
+				running = 1;
+				continue;
+			}
+			if (pid < 0 || status != 0)
+				failed = 1;
+			pids[i] = 0;
+		}
+		segments_progress();
+		if (!running)
+			break;
+		msleep(100);
+	}
+	free(pids);
+	munmap(G.seg_done, n * sizeof(G.seg_done[0]));
+
+	G.chunked = 0;
+	G.got_clen = 1;
+	progress_meter(PROGRESS_END);
+	if (failed) {
+		bb_simple_error_msg("segmented download failed, retrying with one connection");
+		G.segments = 1;
+		G.beg_range = 0;
+		xlseek(G.output_fd, 0, SEEK_SET);
+		return -1;
+	}
+	xlseek(G.output_fd, G.seg_total, SEEK_SET);
+	G.content_len = 0;
+	if (!(option_mask32 & WGET_OPT_QUIET))
+		fprintf(stderr, "'%s' saved\n", G.fname_out);
+	return 1;
+}
+#endif
+
+#if ENABLE_FEATURE_WGET_KEEP_ALIVE
+static char *connection_key(const struct host_info *server)
+{
+	return xasprintf("%s://%s:%u", server->protocol, server->host, server->port);
+}
+
+/* Response was read completely: keep the connection for the next one */
+static void keep_connection(FILE *sfp, const struct host_info *server)
+{
+	G.kept_sfp = sfp;
+	G.kept_key = connection_key(server);
+}
+
+/* Returns kept connection if it goes to server. Closes it otherwise */
+static FILE *reuse_connection(const struct host_info *server)
+{
+	FILE *sfp = G.kept_sfp;
+
+	if (sfp) {
+		struct pollfd pfd;
+		char *key = connection_key(server);
+
+		/* Idle connection has nothing to read, unless server closed it */
+		pfd.fd = fileno(sfp);
+		pfd.events = POLLIN;
+		if (strcmp(key, G.kept_key) != 0 || poll(&pfd, 1, 0) != 0) {
+			fclose(sfp);
+			sfp = NULL;
+		}
+		free(key);
+		free(G.kept_key);
+		G.kept_sfp = NULL;
+	}
+	return sfp;
+}
+
+/* Read and discard body of a redirect. Returns 0 if connection is reusable */
+static int skip_body(FILE *sfp)
+{
+	if (!G.keep_alive || G.chunked)
+		return -1;
+	while (G.content_len != 0) {
+		unsigned rdsz = sizeof(G.wget_buf);
+		int n;
+
+		if (G.content_len < (off_t)rdsz)
+			rdsz = (unsigned)G.content_len;
+		n = fread(G.wget_buf, 1, rdsz, sfp);
+		if (n <= 0)
+			return -1;
+		G.content_len -= n;
+	}
+	return 0;
+}
+#endif
+
 static void download_one_url(const char *url)
 {
 	bool use_proxy;                 /* Use proxies if env vars are set  */
@@ -1105,6 +1360,10 @@ static void download_one_url(const char *url)
 	char *redirected_path = NULL;
 	struct host_info server;
 	struct host_info target;
+	char *location = NULL;          /* redirect target               */
+	IF_FEATURE_WGET_KEEP_ALIVE(smallint reused;)
+	IF_FEATURE_WGET_SEGMENTS(smallint can_segment;)
+	IF_FEATURE_WGET_SEGMENTS(smallint range_ok;)
 
 	server.allocated = NULL;
 	target.allocated = NULL;
@@ -1178,6 +1437,16 @@ static void download_one_url(const char *url)
 	/*G.content_len = 0; - redundant, got_clen = 0 is enough */
 	G.got_clen = 0;
 	G.chunked = 0;
+	IF_FEATURE_WGET_KEEP_ALIVE(G.keep_alive = 0;)
+#if ENABLE_FEATURE_WGET_SEGMENTS
+	G.accept_ranges = 0;
+	can_segment = 0;
+	range_ok = 0;
+	if (!G.seg_child) {
+		free(G.seg_validator);
+		G.seg_validator = NULL;
+	}
+#endif
 	if (use_proxy || target.protocol[0] != 'f' /*not ftp[s]*/) {
 		/*
 		 *  HTTP session
@@ -1185,6 +1454,12 @@ static void download_one_url(const char *url)
 		char *str;
 		int status;
 
+#if ENABLE_FEATURE_WGET_KEEP_ALIVE
+		sfp = reuse_connection(&server);
+		reused = (sfp != NULL);
+		if (reused)
+			goto send_request;
+#endif
 		/* Open socket to http(s) server */
 #if ENABLE_FEATURE_WGET_OPENSSL
 		/* openssl (and maybe internal TLS) support is configured */
@@ -1218,6 +1493,7 @@ static void download_one_url(const char *url)
 		/* ssl (https) support is not configured */
 		sfp = open_socket(lsa);
 #endif
+ IF_FEATURE_WGET_KEEP_ALIVE(send_request:)
 		/* Send HTTP request */
 		if (use_proxy) {
 			SENDFMT(sfp, "GET %s://%s/%s HTTP/1.1\r\n",
@@ -1233,10 +1509,12 @@ static void download_one_url(const char *url)
 		if (!USR_HEADER_USER_AGENT)
 			SENDFMT(sfp, "User-Agent: %s\r\n", G.user_agent);
 
+#if !ENABLE_FEATURE_WGET_KEEP_ALIVE
 		/* Ask server to close the connection as soon as we are done
 		 * (IOW: we do not intend to send more requests)
 		 */
 		SENDFMT(sfp, "Connection: close\r\n");
+#endif
 
 #if ENABLE_FEATURE_WGET_AUTHENTICATION
 		if (target.user && !USR_HEADER_AUTH) {
@@ -1249,8 +1527,20 @@ static void download_one_url(const char *url)
 		}
 #endif
 
-		if (G.beg_range != 0 && !USR_HEADER_RANGE)
-			SENDFMT(sfp, "Range: bytes=%"OFF_FMT"u-\r\n", G.beg_range);
+		if (G.beg_range != 0 && !USR_HEADER_RANGE) {
+#if ENABLE_FEATURE_WGET_SEGMENTS
+			if (G.seg_child) {
+				/* If the file changed since parent got it,
+				 * server sends all of it with "200 OK" */
+				SENDFMT(sfp, "Range: bytes=%"OFF_FMT"u-%"OFF_FMT"u\r\n"
+					"If-Range: %s\r\n",
+					G.beg_range, G.end_range, G.seg_validator);
+			} else
+#endif
+			{
+				SENDFMT(sfp, "Range: bytes=%"OFF_FMT"u-\r\n", G.beg_range);
+			}
+		}
 
 #if ENABLE_FEATURE_WGET_LONG_OPTIONS
 		if (G.extra_headers) {
@@ -1287,8 +1577,9 @@ static void download_one_url(const char *url)
 
 /* Tried doing this unconditionally.
  * Cloudflare and nginx/1.11.5 are shocked to see SHUT_WR on non-HTTPS.
+ * With keep-alive, it is done after headers, if connection won't be reused.
  */
-#if SSL_SUPPORTED
+#if SSL_SUPPORTED && !ENABLE_FEATURE_WGET_KEEP_ALIVE
 		if (target.protocol == P_HTTPS) {
 			/* If we use SSL helper, keeping our end of the socket open for writing
 			 * makes our end (i.e. the same fd!) readable (EAGAIN instead of EOF)
@@ -1303,7 +1594,20 @@ static void download_one_url(const char *url)
 		 * Retrieve HTTP response line and check for "200" status code.
 		 */
  read_response:
+#if ENABLE_FEATURE_WGET_KEEP_ALIVE
+		if (reused) {
+			/* Server may have closed idle connection just now */
+			int c = getc(sfp);
+			if (c == EOF) {
+				fclose(sfp);
+				goto establish_session;
+			}
+			ungetc(c, sfp);
+			reused = 0;
+		}
+#endif
 		fgets_trim_sanitize(sfp, "  %s\n");
+		IF_FEATURE_WGET_KEEP_ALIVE(G.keep_alive = (strncmp(G.wget_buf, "HTTP/1.1 ", 9) == 0);)
 
 		str = G.wget_buf;
 		str = skip_non_whitespace(str);
@@ -1360,6 +1664,11 @@ However, in real world it was observed that some web servers
 				/* "Range:..." was not honored by the server.
 				 * Restart download from the beginning.
 				 */
+#if ENABLE_FEATURE_WGET_SEGMENTS
+				/* (a segment child just fails: parent will do that) */
+				if (G.seg_child)
+					xfunc_die();
+#endif
 				reset_beg_range_to_zero();
 			}
 			break;
@@ -1388,9 +1697,17 @@ However, in real world it was observed that some web servers
 		 */
 		while ((str = get_sanitized_hdr(sfp)) != NULL) {
 			static const char keywords[] ALIGN1 =
-				"content-length\0""transfer-encoding\0""location\0";
+				"content-length\0""transfer-encoding\0""location\0"
+				"accept-ranges\0"
+				IF_FEATURE_WGET_SEGMENTS("etag\0""last-modified\0""content-range\0")
+				IF_FEATURE_WGET_KEEP_ALIVE("connection\0");
 			enum {
-				KEY_content_length = 1, KEY_transfer_encoding, KEY_location
+				KEY_content_length = 1, KEY_transfer_encoding, KEY_location,
+				KEY_accept_ranges,
+#if ENABLE_FEATURE_WGET_SEGMENTS
+				KEY_etag, KEY_last_modified, KEY_content_range,
+#endif
+				KEY_connection
 			};
 			smalluint key;
 
@@ -1416,35 +1733,117 @@ However, in real world it was observed that some web servers
 					bb_error_msg_and_die("transfer encoding '%s' is not supported", str);
 				G.chunked = 1;
 			}
+#if ENABLE_FEATURE_WGET_SEGMENTS
+			if (key == KEY_accept_ranges) {
+				G.accept_ranges = (strcmp(str_tolower(str), "bytes") == 0);
+				continue;
+			}
+			/* If-Range needs a strong ETag, else Last-Modified date */
+			if (key == KEY_etag && !G.seg_child && !is_prefixed_with(str, "W/")) {
+				free(G.seg_validator);
+				G.seg_validator = xstrdup(str);
+				continue;
+			}
+			if (key == KEY_last_modified && !G.seg_child && !G.seg_validator) {
+				G.seg_validator = xstrdup(str);
+				continue;
+			}
+			if (key == KEY_content_range && G.seg_child) {
+				/* "bytes A-B/TOTAL": is it exactly the part we asked for? */
+				char *p = is_prefixed_with(str, "bytes ");
+				if (p && BB_STRTOOFF(p, &p, 10) == G.beg_range && *p == '-'
+				 && BB_STRTOOFF(p + 1, &p, 10) == G.end_range && *p == '/'
+				 && BB_STRTOOFF(p + 1, NULL, 10) == G.seg_total
+				) {
+					range_ok = 1;
+				}
+				continue;
+			}
+#endif
+#if ENABLE_FEATURE_WGET_KEEP_ALIVE
+			if (key == KEY_connection) {
+				str_tolower(str);
+				if (strstr(str, "close"))
+					G.keep_alive = 0;
+				else if (strstr(str, "keep-alive"))
+					G.keep_alive = 1;
+				continue;
+			}
+#endif
 			if (key == KEY_location && status >= 300) {
-				if (--redir_limit == 0)
-					bb_simple_error_msg_and_die("too many redirections");
+				/* acted upon after all headers are read */
+				free(location);
+				location = xstrdup(str);
+			}
+		}
+#if ENABLE_FEATURE_WGET_KEEP_ALIVE
+		/* 204 has no body. For others, we need to know where body
+		 * ends to send next request over this connection */
+		if (status == 204) {
+			G.content_len = 0;
+			G.got_clen = 1;
+		}
+		if (!G.got_clen && !G.chunked)
+			G.keep_alive = 0;
+#endif
+
+		if (location) {
+			if (--redir_limit == 0)
+				bb_simple_error_msg_and_die("too many redirections");
+#if ENABLE_FEATURE_WGET_KEEP_ALIVE
+			if (skip_body(sfp) == 0)
+				keep_connection(sfp, &server);
+			else
+#endif
 				fclose(sfp);
-				if (str[0] == '/') {
-					free(redirected_path);
-					target.path = redirected_path = xstrdup(str + 1);
-					/* lsa stays the same: it's on the same server */
-				} else {
-					parse_url(str, &target);
-					if (!use_proxy) {
-						/* server.user remains untouched */
-						free(server.allocated);
-						server.allocated = NULL;
-						server.protocol = target.protocol;
-						server.host = target.host;
-						/* strip_ipv6_scope_id(target.host); - no! */
-						/* we assume remote never gives us IPv6 addr with scope id */
-						server.port = target.port;
-						free(lsa);
-						goto resolve_lsa;
-					} /* else: lsa stays the same: we use proxy */
-				}
-				goto establish_session;
+			if (location[0] == '/') {
+				free(redirected_path);
+				target.path = redirected_path = xstrdup(location + 1);
+				/* lsa stays the same: it's on the same server */
+			} else {
+				parse_url(location, &target);
+				if (!use_proxy) {
+					/* server.user remains untouched */
+					free(server.allocated);
+					server.allocated = NULL;
+					server.protocol = target.protocol;
+					server.host = target.host;
+					/* strip_ipv6_scope_id(target.host); - no! */
+					/* we assume remote never gives us IPv6 addr with scope id */
+					server.port = target.port;
+					free(lsa);
+					free(location);
+					location = NULL;
+					goto resolve_lsa;
+				} /* else: lsa stays the same: we use proxy */
 			}
+			free(location);
+			location = NULL;
+			goto establish_session;
 		}
 //		if (status >= 300)
 //			bb_error_msg_and_die("bad redirection (no Location: header from server)");
 
+#if SSL_SUPPORTED && ENABLE_FEATURE_WGET_KEEP_ALIVE
+		if (target.protocol == P_HTTPS && !G.keep_alive) {
+			/* See above: SSL helper needs this to see EOF */
+			shutdown(fileno(sfp), SHUT_WR);
+		}
+#endif
+
+#if ENABLE_FEATURE_WGET_SEGMENTS
+		can_segment = (G.segments > 1
+			&& status == 200
+			&& G.accept_ranges
+			&& G.got_clen
+			&& !G.chunked
+			&& G.beg_range == 0
+			&& !(option_mask32 & WGET_OPT_POST)
+			&& !USR_HEADER_RANGE
+			&& G.seg_validator /* can't detect changes without it */
+		);
+#endif
+
 		/* For HTTP, data is pumped over the same connection */
 		dfp = sfp;
 	} else {
@@ -1456,12 +1855,35 @@ However, in real world it was observed that some web servers
 #endif
 	}
 
-	free(lsa);
-
 	if (!(option_mask32 & WGET_OPT_SPIDER)) {
 		if (G.output_fd < 0)
 			G.output_fd = xopen(G.fname_out, G.o_flags);
+#if ENABLE_FEATURE_WGET_SEGMENTS
+		if (G.seg_child) {
+			off_t len = G.end_range - G.beg_range + 1;
+			if (!range_ok || !G.got_clen || G.content_len != len
+			 || retrieve_segment(dfp, G.seg_child, G.beg_range, len) != 0
+			) {
+				xfunc_die();
+			}
+			exit(EXIT_SUCCESS);
+		}
+		if (can_segment) {
+			int r = retrieve_file_segments(dfp);
+			if (r < 0) {
+				/* we are a child, or need to retry */
+				fclose(sfp);
+				goto establish_session;
+			}
+			if (r > 0) {
+				/* rest of first segment is still unread */
+				IF_FEATURE_WGET_KEEP_ALIVE(G.keep_alive = 0;)
+				goto retrieved;
+			}
+		}
+#endif
 		retrieve_file_data(dfp);
+ IF_FEATURE_WGET_SEGMENTS(retrieved:)
 		if (!(option_mask32 & WGET_OPT_OUTNAME)) {
 			xclose(G.output_fd);
 			G.output_fd = -1;
@@ -1469,6 +1891,8 @@ However, in real world it was observed that some web servers
 	} else {
 		if (!(option_mask32 & WGET_OPT_QUIET))
 			fprintf(stderr, "remote file exists\n");
+		/* body was not read */
+		IF_FEATURE_WGET_KEEP_ALIVE(G.keep_alive = 0;)
 	}
 
 #if ENABLE_FEATURE_WGET_FTP
@@ -1480,8 +1904,14 @@ However, in real world it was observed that some web servers
 		/* ftpcmd("QUIT", NULL, sfp); - why bother? */
 	}
 #endif
-	fclose(sfp);
+#if ENABLE_FEATURE_WGET_KEEP_ALIVE
+	if (dfp == sfp && G.keep_alive)
+		keep_connection(sfp, &server);
+	else
+#endif
+		fclose(sfp);
 
+	free(lsa);
 	free(server.allocated);
 	free(target.allocated);
 	free(server.user);
@@ -1504,6 +1934,7 @@ int wget_main(int argc UNUSED_PARAM, char **argv)
 		"directory-prefix\0" Required_argument "P"
 		"proxy\0"            Required_argument "Y"
 		"user-agent\0"       Required_argument "U"
+		"input-file\0"       Required_argument "i"
 IF_FEATURE_WGET_TIMEOUT(
 		"timeout\0"          Required_argument "T")
 		/* Ignored: */
@@ -1513,6 +1944,8 @@ IF_DESKTOP(	"tries\0"            Required_argument "t")
 		"spider\0"           No_argument       "\xfd"
 		"no-check-certificate\0" No_argument   "\xfc"
 		"post-file\0"        Required_argument "\xfb"
+IF_FEATURE_WGET_SEGMENTS(
+		"segments\0"         Required_argument "\xfa")
 		/* Ignored (we always use PASV): */
 IF_DESKTOP(	"passive-ftp\0"      No_argument       "\xf0")
 		/* Ignored (we don't support caching) */
@@ -1532,6 +1965,8 @@ IF_DESKTOP(	"no-parent\0"        No_argument       "\xf0")
 #if ENABLE_FEATURE_WGET_LONG_OPTIONS
 	llist_t *headers_llist = NULL;
 #endif
+	IF_FEATURE_WGET_SEGMENTS(const char *segments_str;)
+	const char *input_file = NULL;
 
 	INIT_G();
 
@@ -1554,8 +1989,8 @@ IF_DESKTOP(	"no-parent\0"        No_argument       "\xf0")
 		 * "n::" above says that we accept -n[ARG].
 		 * Specifying "n:" would be a bug: "-n ARG" would eat ARG!
 		 */
+		"i:"
 		"\0"
-		"-1" /* at least one URL */
 		IF_FEATURE_WGET_LONG_OPTIONS(":\xfe--\xfb")
 		IF_FEATURE_WGET_LONG_OPTIONS(":\xfe--\xfe")
 		IF_FEATURE_WGET_LONG_OPTIONS(":\xfb--\xfb")
@@ -1565,10 +2000,12 @@ IF_DESKTOP(	"no-parent\0"        No_argument       "\xf0")
 		&G.proxy_flag, &G.user_agent,
 		IF_FEATURE_WGET_TIMEOUT(&G.timeout_seconds) IF_NOT_FEATURE_WGET_TIMEOUT(NULL),
 		NULL, /* -t RETRIES */
-		NULL  /* -n[ARG] */
+		NULL, /* -n[ARG] */
+		&input_file
 		IF_FEATURE_WGET_LONG_OPTIONS(, &headers_llist)
 		IF_FEATURE_WGET_LONG_OPTIONS(, &G.post_data)
 		IF_FEATURE_WGET_LONG_OPTIONS(, &G.post_file)
+		IF_FEATURE_WGET_SEGMENTS(, &segments_str)
 	);
 #if 0 /* option bits debug */
 	if (option_mask32 & WGET_OPT_RETRIES) bb_error_msg("-t NUM");
@@ -1581,6 +2018,14 @@ IF_DESKTOP(	"no-parent\0"        No_argument       "\xf0")
 	exit(0);
 #endif
 	argv += optind;
+	if (!argv[0] && !input_file)
+		bb_show_usage(); /* at least one URL */
+
+#if ENABLE_FEATURE_WGET_SEGMENTS
+	G.segments = 1;
+	if (option_mask32 & WGET_OPT_SEGMENTS)
+		G.segments = xatou_range(segments_str, 1, 64);
+#endif
 
 #if ENABLE_FEATURE_WGET_LONG_OPTIONS
 	if (headers_llist) {
@@ -1638,6 +2083,27 @@ IF_DESKTOP(	"no-parent\0"        No_argument       "\xf0")
 	while (*argv)
 		download_one_url(*argv++);
 
+	if (input_file) { /* -i FILE ? */
+		FILE *fp = xfopen_stdin(input_file);
+		char *line;
+
+		while ((line = xmalloc_fgetline(fp)) != NULL) {
+			char *url = skip_whitespace(line);
+			if (*url != '\0' && *url != '#') {
+				*skip_non_whitespace(url) = '\0';
+				download_one_url(url);
+			}
+			free(line);
+		}
+		fclose_if_not_stdin(fp);
+	}
+#if ENABLE_FEATURE_WGET_KEEP_ALIVE
+	if (G.kept_sfp) {
+		fclose(G.kept_sfp);
+		free(G.kept_key);
+	}
+#endif
+
 	if (G.output_fd >= 0)
 		xclose(G.output_fd);
 
@@ -51,6 +51,33 @@
 //config:	Note that as of now (2017-01), uclibc and musl glob() both have bugs
 //config:	which would break ash if you select N here.
 //config:
+//config:config ASH_HASH_NOT_FOUND
+//config:	bool "Remember commands not found in PATH"
+//config:	default n
+//config:	depends on SHELL_ASH
+//config:	help
+//config:	Keep failed PATH searches in the command hash table, so that
+//config:	looking for a missing command again does not stat() it
+//config:	in every PATH directory. The remembered failures are dropped
+//config:	when modification time of any PATH directory changes.
+//config:
+//config:	PATH directories are re-checked at most once a second
+//config:	(and after every child exit), so a command installed
+//config:	by another process may stay "not found" for up to
+//config:	a second. This is not POSIX compliant.
+//config:
+//config:config ASH_SOURCE_CACHE
+//config:	bool "Cache parsed scripts run by . and source"
+//config:	default n
+//config:	depends on SHELL_ASH
+//config:	help
+//config:	Keep parse trees of files run by "." (and "source") in memory,
+//config:	and execute them without re-parsing when the same file
+//config:	is sourced again. A cached tree is used only while
+//config:	the file's inode, size and modification time stay the same.
+//config:	Speeds up scripts which repeatedly source large function
+//config:	libraries, at the cost of memory for up to 16 files.
+//config:
 //config:config ASH_BASH_COMPAT
 //config:	bool "bash-compatible extensions"
 //config:	default y
@@ -310,10 +337,21 @@ typedef long arith_t;
 
 /* ============ Hash table sizes. Configurable. */
 
+/* Variable and command tables start with these sizes
+ * and grow when they hold twice as many entries as buckets */
 #define VTABSIZE 39
 #define ATABSIZE 39
 #define CMDTABLESIZE 31         /* should be prime */
 
+#if ENABLE_ASH_HASH_NOT_FOUND
+/* monotonic_sec() + 1 of last check of PATH dirs, or 0 if stale.
+ * See pathdirs_generation() */
+static unsigned pathdirs_checked;
+# define pathdirs_maybe_changed() ((void)(pathdirs_checked = 0))
+#else
+# define pathdirs_maybe_changed() ((void)0)
+#endif
+
 
 /* ============ Shell options */
 
@@ -612,6 +650,10 @@ struct parsefile {
 
 	/* Number of outstanding calls to pungetc. */
 	int unget;
+#if ENABLE_ASH_SOURCE_CACHE
+	/* Parse tree of ". FILE" being recorded for the cache */
+	struct dotcache *dotrec;
+#endif
 };
 
 static struct parsefile basepf;        /* top level input file */
@@ -2169,7 +2211,9 @@ struct globals_var {
 	struct shparam shellparam;      /* $@ current positional parameters */
 	struct redirtab *redirlist;
 	int preverrout_fd;   /* stderr fd: usually 2, unless redirect moved it */
-	struct var *vartab[VTABSIZE];
+	struct var **vartab;
+	unsigned vtabsize;
+	unsigned nvars;
 	struct var varinit[ARRAY_SIZE(varinit_data)];
 	int lineno;
 	char linenovar[sizeof("LINENO=") + sizeof(int)*3];
@@ -2184,6 +2228,8 @@ extern struct globals_var *BB_GLOBAL_CONST ash_ptr_to_globals_var;
 //#define redirlist     (G_var.redirlist    )
 #define preverrout_fd (G_var.preverrout_fd)
 #define vartab        (G_var.vartab       )
+#define vtabsize      (G_var.vtabsize     )
+#define nvars         (G_var.nvars        )
 #define varinit       (G_var.varinit      )
 #define lineno        (G_var.lineno       )
 #define linenovar     (G_var.linenovar    )
@@ -2218,6 +2264,8 @@ extern struct globals_var *BB_GLOBAL_CONST ash_ptr_to_globals_var;
 #define INIT_G_var() do { \
 	unsigned i; \
 	XZALLOC_CONST_PTR(&ash_ptr_to_globals_var, sizeof(G_var)); \
+	vtabsize = VTABSIZE; \
+	vartab = xzalloc(VTABSIZE * sizeof(vartab[0])); \
 	for (i = 0; i < ARRAY_SIZE(varinit_data); i++) { \
 		varinit[i].flags    = varinit_data[i].flags; \
 		varinit[i].var_text = varinit_data[i].var_text; \
@@ -2284,18 +2332,52 @@ varcmp(const char *p, const char *q)
 	return c - d;
 }
 
+/*
+ * Hash function for variable and command tables.
+ * Stops at '=' since variables are stored as "NAME=VALUE".
+ */
+static unsigned
+hashname(const char *p)
+{
+	unsigned hashval = 0;
+
+	while (*p && *p != '=')
+		hashval = hashval * 31 + (unsigned char) *p++;
+	return hashval;
+}
+
 /*
  * Find the appropriate entry in the hash table from the name.
  */
 static struct var **
 hashvar(const char *p)
 {
-	unsigned hashval;
+	return &vartab[hashname(p) % vtabsize];
+}
 
-	hashval = ((unsigned char) *p) << 4;
-	while (*p && *p != '=')
-		hashval += (unsigned char) *p++;
-	return &vartab[hashval % VTABSIZE];
+/*
+ * Rehash variables into a table about twice as big.
+ * Called with interrupts off, when nobody holds pointers into vartab[].
+ */
+static void
+growvartab(void)
+{
+	struct var **oldtab = vartab;
+	struct var **vpp = oldtab + vtabsize;
+
+	vtabsize = vtabsize * 2 + 1;
+	vartab = ckzalloc(vtabsize * sizeof(vartab[0]));
+	while (--vpp >= oldtab) {
+		struct var *vp = *vpp;
+		while (vp) {
+			struct var *next = vp->next;
+			struct var **newvpp = hashvar(vp->var_text);
+			vp->next = *newvpp;
+			*newvpp = vp;
+			vp = next;
+		}
+	}
+	free(oldtab);
 }
 
 static int
@@ -2330,6 +2412,7 @@ initvar(void)
 		vp->next = *vpp;
 		*vpp = vp;
 	} while (++vp < end);
+	nvars = ARRAY_SIZE(varinit);
 }
 
 static struct var **
@@ -2445,6 +2528,7 @@ setvareq(char *s, int flags)
 		if (((flags & (VEXPORT|VREADONLY|VSTRFIXED|VUNSET)) | (vp->flags & VSTRFIXED)) == VUNSET) {
 			*vpp = vp->next;
 			free(vp);
+			nvars--;
  out_free:
 			if ((flags & (VTEXTFIXED|VSTACK|VNOSAVE)) == VNOSAVE)
 				free(s);
@@ -2466,11 +2550,14 @@ setvareq(char *s, int flags)
 		vp->next = *vpp;
 		/*vp->func = NULL; - ckzalloc did it */
 		*vpp = vp;
+		nvars++;
 	}
 	if (!(flags & (VTEXTFIXED|VSTACK|VNOSAVE)))
 		s = ckstrdup(s);
 	vp->var_text = s;
 	vp->flags = flags;
+	if (nvars > vtabsize * 2)
+		growvartab();
 
  out:
 	return vp;
@@ -2573,7 +2660,7 @@ listvars(int on, int off, struct strlist *lp, char ***end)
 #endif
 			}
 		}
-	} while (++vpp < vartab + VTABSIZE);
+	} while (++vpp < vartab + vtabsize);
 
 #if ENABLE_FEATURE_SH_NOFORK
 	while (lp) {
@@ -4379,6 +4466,7 @@ waitone(int block, struct job *job)
 	TRACE(("wait returns pid %d, status=%d\n", pid, status));
 	if (pid <= 0)
 		goto out;
+	pathdirs_maybe_changed();
 
 	for (jp = curjob; jp; jp = jp->prev_job) {
 		int jobstate;
@@ -6560,6 +6648,7 @@ struct backcmd {                /* result of evalbackcmd */
 	int nleft;              /* number of chars in buffer */
 	char *buf;              /* buffer */
 	struct job *jp;         /* job structure for command */
+	int status;             /* exit status if run without fork (jp == NULL) */
 };
 
 /* These forward decls are needed to use "eval" code for backticks handling: */
@@ -6581,6 +6670,13 @@ evaltreenr(union node *n, int flags)
 	/* NOTREACHED */
 }
 
+#if ENABLE_FEATURE_SH_STANDALONE \
+ && ENABLE_FEATURE_SH_NOFORK \
+ && NUM_APPLETS > 1
+static int evalbackcmd_nofork(union node *n, struct backcmd *result);
+#endif
+
+
 static void FAST_FUNC
 evalbackcmd(union node *n, struct backcmd *result
 				IF_BASH_PROCESS_SUBST(, int ctl))
@@ -6601,9 +6697,16 @@ evalbackcmd(union node *n, struct backcmd *result
 	result->buf = NULL;
 	result->nleft = 0;
 	result->jp = NULL;
+	result->status = 0;
 	if (n == NULL) {
 		goto out;
 	}
+#if ENABLE_FEATURE_SH_STANDALONE \
+ && ENABLE_FEATURE_SH_NOFORK \
+ && NUM_APPLETS > 1
+	if (ctl == CTLBACKQ && evalbackcmd_nofork(n, result))
+		goto out;
+#endif
 
 	if (pipe(pip) < 0)
 		ash_msg_and_raise_perror("can't create pipe");
@@ -6703,7 +6806,7 @@ expbackq(union node *cmd, int flag IF_BASH_PROCESS_SUBST(, int ctl))
 	free(in.buf);
 	if (in.fd >= 0) {
 		close(in.fd);
-		back_exitstatus = waitforjob(in.jp);
+		back_exitstatus = in.jp ? waitforjob(in.jp) : in.status;
 	}
  done:
 	INT_ON;
@@ -8245,10 +8348,55 @@ struct tblentry {
 };
 
 static struct tblentry **cmdtable;
+static unsigned cmdtable_size;
+static unsigned cmdtable_count;
 #define INIT_G_cmdtable() do { \
+	cmdtable_size = CMDTABLESIZE; \
 	cmdtable = xzalloc(CMDTABLESIZE * sizeof(cmdtable[0])); \
 } while (0)
 
+#if ENABLE_ASH_HASH_NOT_FOUND
+/*
+ * Failed PATH searches are kept in cmdtable as CMDUNKNOWN entries,
+ * stamped with pathdirs_gen. It changes when mtime of any PATH
+ * directory changes. To not stat() them on every lookup, a check
+ * is trusted until we reap a child or run a NOFORK applet (they
+ * could have installed the command) or the next second starts.
+ */
+static unsigned pathdirs_gen;
+static unsigned pathdirs_sum;
+
+static unsigned
+pathdirs_generation(void)
+{
+	const char *path;
+	unsigned sum;
+	unsigned now;
+
+	now = monotonic_sec() + 1;
+	if (pathdirs_checked == now)
+		return pathdirs_gen;
+
+	path = pathval();
+	sum = 0;
+	while (padvance(&path, "") >= 0) {
+		struct stat statb;
+
+		sum *= 31;
+		if (stat(stackblock(), &statb) == 0)
+			sum += statb.st_ino
+				+ (unsigned)statb.st_mtime
+				+ (unsigned)statb.st_mtim.tv_nsec;
+	}
+	if (sum != pathdirs_sum) {
+		pathdirs_sum = sum;
+		pathdirs_gen++;
+	}
+	pathdirs_checked = now;
+	return pathdirs_gen;
+}
+#endif
+
 static int builtinloc = -1;     /* index in path of %builtin, or -1 */
 
 
@@ -8396,10 +8544,11 @@ clearcmdentry(void)
 	struct tblentry *cmdp;
 
 	INT_OFF;
-	for (tblp = cmdtable; tblp < &cmdtable[CMDTABLESIZE]; tblp++) {
+	for (tblp = cmdtable; tblp < &cmdtable[cmdtable_size]; tblp++) {
 		pp = tblp;
 		while ((cmdp = *pp) != NULL) {
 			if (cmdp->cmdtype == CMDNORMAL
+			 || cmdp->cmdtype == CMDUNKNOWN
 			 || (cmdp->cmdtype == CMDBUILTIN
 			    && !IS_BUILTIN_REGULAR(cmdp->param.cmd)
 			    && builtinloc > 0
@@ -8407,6 +8556,7 @@ clearcmdentry(void)
 			) {
 				*pp = cmdp->next;
 				free(cmdp);
+				cmdtable_count--;
 			} else {
 				pp = &cmdp->next;
 			}
@@ -8426,20 +8576,41 @@ clearcmdentry(void)
  */
 static struct tblentry **lastcmdentry;
 
+/*
+ * Rehash commands into a table about twice as big.
+ */
+static void
+growcmdtable(void)
+{
+	struct tblentry **oldtab = cmdtable;
+	struct tblentry **pp = oldtab + cmdtable_size;
+
+	cmdtable_size = cmdtable_size * 2 + 1;
+	cmdtable = ckzalloc(cmdtable_size * sizeof(cmdtable[0]));
+	while (--pp >= oldtab) {
+		struct tblentry *cmdp = *pp;
+		while (cmdp) {
+			struct tblentry *next = cmdp->next;
+			struct tblentry **newpp;
+
+			newpp = &cmdtable[hashname(cmdp->cmdname) % cmdtable_size];
+			cmdp->next = *newpp;
+			*newpp = cmdp;
+			cmdp = next;
+		}
+	}
+	free(oldtab);
+}
+
 static struct tblentry *
 cmdlookup(const char *name, int add)
 {
-	unsigned int hashval;
-	const char *p;
 	struct tblentry *cmdp;
 	struct tblentry **pp;
 
-	p = name;
-	hashval = (unsigned char)*p << 4;
-	while (*p)
-		hashval += (unsigned char)*p++;
-	hashval &= 0x7FFF;
-	pp = &cmdtable[hashval % CMDTABLESIZE];
+	if (add && cmdtable_count >= cmdtable_size * 2)
+		growcmdtable();
+	pp = &cmdtable[hashname(name) % cmdtable_size];
 	for (cmdp = *pp; cmdp; cmdp = cmdp->next) {
 		if (strcmp(cmdp->cmdname, name) == 0)
 			break;
@@ -8453,6 +8624,7 @@ cmdlookup(const char *name, int add)
 		/*cmdp->next = NULL; - ckzalloc did it */
 		cmdp->cmdtype = CMDUNKNOWN;
 		strcpy(cmdp->cmdname, name);
+		cmdtable_count++;
 	}
 	lastcmdentry = pp;
 	return cmdp;
@@ -8472,6 +8644,7 @@ delete_cmd_entry(void)
 	if (cmdp->cmdtype == CMDFUNCTION)
 		freefunc(cmdp->param.func);
 	free(cmdp);
+	cmdtable_count--;
 	INT_ON;
 }
 
@@ -8508,7 +8681,7 @@ hashcmd(int argc UNUSED_PARAM, char **argv UNUSED_PARAM)
 	}
 
 	if (*argptr == NULL) {
-		for (pp = cmdtable; pp < &cmdtable[CMDTABLESIZE]; pp++) {
+		for (pp = cmdtable; pp < &cmdtable[cmdtable_size]; pp++) {
 			for (cmdp = *pp; cmdp; cmdp = cmdp->next) {
 				if (cmdp->cmdtype == CMDNORMAL)
 					printentry(cmdp);
@@ -8522,6 +8695,7 @@ hashcmd(int argc UNUSED_PARAM, char **argv UNUSED_PARAM)
 		cmdp = cmdlookup(name, 0);
 		if (cmdp != NULL
 		 && (cmdp->cmdtype == CMDNORMAL
+		    || cmdp->cmdtype == CMDUNKNOWN
 		    || (cmdp->cmdtype == CMDBUILTIN
 			&& !IS_BUILTIN_REGULAR(cmdp->param.cmd)
 			&& builtinloc > 0
@@ -8548,9 +8722,10 @@ hashcd(void)
 	struct tblentry **pp;
 	struct tblentry *cmdp;
 
-	for (pp = cmdtable; pp < &cmdtable[CMDTABLESIZE]; pp++) {
+	for (pp = cmdtable; pp < &cmdtable[cmdtable_size]; pp++) {
 		for (cmdp = *pp; cmdp; cmdp = cmdp->next) {
 			if (cmdp->cmdtype == CMDNORMAL
+			 || cmdp->cmdtype == CMDUNKNOWN
 			 || (cmdp->cmdtype == CMDBUILTIN
 			     && !IS_BUILTIN_REGULAR(cmdp->param.cmd)
 			     && builtinloc > 0)
@@ -9200,6 +9375,91 @@ copyfunc(union node *n)
 	return f;
 }
 
+#if ENABLE_ASH_SOURCE_CACHE
+/*
+ * Parse trees of files run by ".": every top-level command
+ * is copied like a function body. Only files which were
+ * read to EOF are cached.
+ */
+#define DOTCACHE_MAX 16
+
+struct dotcache {
+	struct dotcache *next;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	long mtime_nsec;
+	int refcnt;             /* 1 for being in dotcache_list, +1 while run */
+	int ncmds;
+	struct funcnode **cmds; /* NULL for empty commands */
+};
+
+static struct dotcache *dotcache_list;
+
+static void
+dotcache_unref(struct dotcache *dc)
+{
+	if (--dc->refcnt == 0) {
+		while (dc->ncmds)
+			freefunc(dc->cmds[--dc->ncmds]);
+		free(dc->cmds);
+		free(dc);
+	}
+}
+
+static int
+have_aliases(void)
+{
+# if ENABLE_ASH_ALIAS
+	int i;
+	for (i = 0; i < ATABSIZE; i++)
+		if (atab[i])
+			return 1;
+# endif
+	return 0;
+}
+
+/* cmdloop() passes us every command parsed from the file being recorded */
+static void
+dotcache_record(union node *n)
+{
+	struct dotcache *dc = g_parsefile->dotrec;
+	struct dotcache **pp;
+	int cnt;
+
+	INT_OFF;
+	if (n == NODE_EOF) {
+		g_parsefile->dotrec = NULL;
+		/* Replace older version of this file, limit cache size */
+		cnt = 1;
+		pp = &dotcache_list;
+		while (*pp) {
+			struct dotcache *p = *pp;
+			if ((p->dev == dc->dev && p->ino == dc->ino)
+			 || ++cnt > DOTCACHE_MAX
+			) {
+				*pp = p->next;
+				dotcache_unref(p);
+				continue;
+			}
+			pp = &p->next;
+		}
+		dc->next = dotcache_list;
+		dotcache_list = dc;
+	} else if (have_aliases()) {
+		/* an alias defined by the file may change parsing of the rest */
+		g_parsefile->dotrec = NULL;
+		dotcache_unref(dc);
+	} else {
+		if ((dc->ncmds & 0xf) == 0)
+			dc->cmds = ckrealloc(dc->cmds, (dc->ncmds + 0x10) * sizeof(dc->cmds[0]));
+		dc->cmds[dc->ncmds++] = n ? copyfunc(n) : NULL;
+	}
+	INT_ON;
+}
+#endif
+
 /*
  * Define a shell function.
  */
@@ -10550,6 +10810,7 @@ evalcommand(union node *cmd, int flags)
 			 */
 			exitstatus = run_nofork_applet(applet_no, argv);
 			environ = sv_environ;
+			pathdirs_maybe_changed();
 			/*
 			 * Try enabling NOFORK for "yes" applet.
 			 * ^C _will_ stop it (write returns EINTR),
@@ -11152,6 +11413,11 @@ popfile(void)
 		popstring();
 		freestrings(g_parsefile->spfree);
 	}
+#if ENABLE_ASH_SOURCE_CACHE
+	/* file was not read to EOF */
+	if (pf->dotrec)
+		dotcache_unref(pf->dotrec);
+#endif
 	g_parsefile = pf->prev;
 	free(pf);
 	INT_ON;
@@ -13577,6 +13843,10 @@ cmdloop(int top)
 #if DEBUG
 		if (DEBUG > 2 && debug && (n != NODE_EOF))
 			showtree(n);
+#endif
+#if ENABLE_ASH_SOURCE_CACHE
+		if (g_parsefile->dotrec)
+			dotcache_record(n);
 #endif
 		if (n == NODE_EOF) {
 			if (!top || numeof >= 50)
@@ -13613,6 +13883,98 @@ cmdloop(int top)
 	return status;
 }
 
+#if ENABLE_ASH_SOURCE_CACHE
+/*
+ * When file run by "." is sourced again, reuse its parse tree
+ * recorded last time, unless the file has changed.
+ */
+static struct dotcache *
+dotcache_lookup(void)
+{
+	struct stat st;
+	struct dotcache *dc;
+
+	/* Aliases affect parsing: neither use nor record a cached tree
+	 * while they exist. With -v, reading the file has a visible effect.
+	 */
+	if (vflag || have_aliases())
+		return NULL;
+	if (fstat(g_parsefile->pf_fd, &st) != 0 || !S_ISREG(st.st_mode))
+		return NULL;
+	for (dc = dotcache_list; dc; dc = dc->next) {
+		if (dc->dev == st.st_dev && dc->ino == st.st_ino) {
+			if (dc->size == st.st_size
+			 && dc->mtime == st.st_mtime
+			 && dc->mtime_nsec == st.st_mtim.tv_nsec
+			) {
+				return dc;
+			}
+			break;
+		}
+	}
+	INT_OFF;
+	dc = ckzalloc(sizeof(*dc));
+	dc->refcnt = 1;
+	dc->dev = st.st_dev;
+	dc->ino = st.st_ino;
+	dc->size = st.st_size;
+	dc->mtime = st.st_mtime;
+	dc->mtime_nsec = st.st_mtim.tv_nsec;
+	g_parsefile->dotrec = dc;
+	INT_ON;
+	return NULL;
+}
+
+/* Same as cmdloop(0), but commands come from the cache */
+static int
+dotcache_eval(struct dotcache *dc)
+{
+	struct jmploc *volatile savehandler;
+	struct jmploc jmploc;
+	struct stackmark smark;
+	int status = 0;
+	int e;
+	int i;
+
+	savehandler = exception_handler;
+	e = setjmp(jmploc.loc);
+	if (e)
+		goto done;
+	INT_OFF;
+	exception_handler = &jmploc;
+	dc->refcnt++;
+	INT_ON;
+	for (i = 0; i < dc->ncmds; i++) {
+		struct funcnode *f = dc->cmds[i];
+		int st;
+
+		setstackmark(&smark);
+#if JOBS
+		if (doing_jobctl)
+			showjobs(SHOW_CHANGED|SHOW_STDERR);
+#endif
+		job_warning >>= 1;
+		st = evaltree(f ? &f->n : NULL, 0);
+		if (f)
+			status = st;
+		popstackmark(&smark);
+
+		if (evalskip) {
+			evalskip &= ~(SKIPFUNC | SKIPFUNCDEF);
+			break;
+		}
+	}
+ done:
+	INT_OFF;
+	exception_handler = savehandler;
+	dotcache_unref(dc);
+	INT_ON;
+	if (e)
+		longjmp(exception_handler->loc, e);
+	return status;
+}
+#endif
+
 /*
  * Take commands from a file.  To be compatible we should do a path
  * search for the file, which is necessary to find sub-commands.
@@ -13693,7 +14055,17 @@ dotcmd(int argc_ UNUSED_PARAM, char **argv_ UNUSED_PARAM)
 	 */
 	setinputfile(fullname, INPUT_PUSH_FILE);
 	commandname = fullname;
+#if ENABLE_ASH_SOURCE_CACHE
+	{
+		struct dotcache *dc = dotcache_lookup();
+		if (dc)
+			status = dotcache_eval(dc);
+		else
+			status = cmdloop(0);
+	}
+#else
 	status = cmdloop(0);
+#endif
 	popfile();
 
 	if (args_need_save) {
@@ -13753,6 +14125,7 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 	int updatetbl;
 	struct builtincmd *bcmd;
 	int len;
+	IF_ASH_HASH_NOT_FOUND(unsigned gen;)
 
 	/* If name contains a slash, don't use PATH or hash table */
 	if (strchr(name, '/') != NULL) {
@@ -13788,6 +14161,9 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 			abort();
 #endif
 		case CMDNORMAL:
+#if ENABLE_ASH_HASH_NOT_FOUND
+		case CMDUNKNOWN:
+#endif
 			bit = DO_ALTPATH | DO_REGBLTIN;
 			break;
 		case CMDFUNCTION:
@@ -13803,7 +14179,21 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 
 			updatetbl = 0;
 			cmdp = NULL;
-		} else if (cmdp->rehash == 0)
+		}
+#if ENABLE_ASH_HASH_NOT_FOUND
+		else if (cmdp->cmdtype == CMDUNKNOWN) {
+			/* We already failed to find it in PATH */
+			if (cmdp->rehash == 0
+			 && cmdp->param.index == (int)pathdirs_generation()
+			) {
+				e = ENOENT;
+				goto not_found;
+			}
+			/* PATH dirs changed, or cd was done: search again */
+			cmdp->rehash = 0;
+		}
+#endif
+		else if (cmdp->rehash == 0)
 			/* if not invalidated by cd, we're done */
 			goto success;
 	}
@@ -13842,6 +14232,11 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 			prev = cmdp->param.index;
 	}
 
+#if ENABLE_ASH_HASH_NOT_FOUND
+	/* Must be taken before the search, not after:
+	 * PATH dirs can change while we are searching them */
+	gen = updatetbl ? pathdirs_generation() : 0;
+#endif
 	e = ENOENT;
 	idx = -1;
  loop:
@@ -13876,6 +14271,12 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 #endif
 			if (errno != ENOENT && errno != ENOTDIR)
 				e = errno;
+#if ENABLE_ASH_HASH_NOT_FOUND
+			/* Dangling symlink: its target may appear
+			 * without PATH dir mtime change */
+			else if (updatetbl && lstat(fullname, &statb) == 0)
+				updatetbl = 0;
+#endif
 			goto loop;
 		}
 		e = EACCES;     /* if we fail, this will be the error */
@@ -13907,9 +14308,20 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 		goto success;
 	}
 
+#if ENABLE_ASH_HASH_NOT_FOUND
+	if (updatetbl && e == ENOENT) {
+		/* Remember that it's not in PATH */
+		INT_OFF;
+		cmdp = cmdlookup(name, 1);
+		cmdp->cmdtype = CMDUNKNOWN;
+		cmdp->param.index = gen;
+		INT_ON;
+	} else
+#endif
 	/* We failed.  If there was an entry for this command, delete it */
 	if (cmdp && updatetbl)
 		delete_cmd_entry();
+ IF_ASH_HASH_NOT_FOUND(not_found:)
 	if (act & DO_ERR) {
 #if ENABLE_ASH_BASH_NOT_FOUND_HOOK
 		struct tblentry *hookp = cmdlookup("command_not_found_handle", 0);
@@ -13946,6 +14358,128 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 	entry->u = cmdp->param;
 }
 
+#if ENABLE_FEATURE_SH_STANDALONE \
+ && ENABLE_FEATURE_SH_NOFORK \
+ && NUM_APPLETS > 1
+/*
+ * $(nofork_applet ARGS) needs no subshell: run the applet in-process,
+ * capturing its output in a temporary file. This is only done
+ * if expanding ARGS can't have side effects which the subshell
+ * would have discarded: ${v=x}, ${v?msg}, $((i++)), set -u errors.
+ * Returns 0 if the command has to be forked as usual.
+ */
+static int
+evalbackcmd_nofork(union node *n, struct backcmd *result)
+{
+	/* builtins which are also NOFORK applets */
+	static const char nofork_bltins[] ALIGN1 =
+		"echo\0""printf\0""test\0""[\0""[[\0""true\0""false\0";
+	struct arglist arglist;
+	struct cmdentry entry;
+	union node *argp;
+	struct strlist *sp;
+	struct ifsregion sv_ifsfirst;
+	struct ifsregion *sv_ifslastp;
+	struct nodelist *sv_argbackq;
+	char *sv_expdest;
+	char **sv_environ;
+	char **argv;
+	char *name;
+	const char *p;
+	int applet_no;
+	int argc;
+	int fd;
+
+	if (n->type != NCMD || n->ncmd.assign || n->ncmd.redirect
+	 || !n->ncmd.args || uflag || xflag
+	) {
+		return 0;
+	}
+	for (argp = n->ncmd.args; argp; argp = argp->narg.next) {
+		for (p = argp->narg.text; *p; p++) {
+			unsigned char c = *p;
+			if (c == CTLESC) {
+				p++;
+				continue;
+			}
+			if (c == CTLARI)
+				return 0;
+			if (c == CTLVAR) {
+				c = *++p & VSTYPE;
+				if (c == VSQUESTION || c == VSASSIGN
+				 IF_BASH_SUBSTR(|| c == VSSUBSTR)
+				) {
+					return 0;
+				}
+			}
+		}
+	}
+	/* Command name must be a plain word */
+	name = n->ncmd.args->narg.text;
+	for (p = name; *p; p++) {
+		if ((unsigned char)*p >= (unsigned char)CTL_FIRST
+		 && (unsigned char)*p <= (unsigned char)CTL_LAST
+		) {
+			return 0;
+		}
+	}
+	find_command(name, &entry, 0, pathval());
+	if (entry.cmdtype == CMDBUILTIN) {
+		if (index_in_strings(nofork_bltins, name) < 0)
+			return 0;
+		applet_no = find_applet_by_name(name);
+	} else if (entry.cmdtype == CMDNORMAL) {
+		/* find_command() encodes applet_no as (-2 - applet_no) */
+		applet_no = (- entry.u.index - 2);
+	} else
+		return 0;
+	if (applet_no < 0 || !APPLET_IS_NOFORK(applet_no))
+		return 0;
+
+	sv_environ = environ;
+	environ = listvars(VEXPORT, VUNSET, /*lp:*/ NULL, /*end:*/ NULL);
+	fd = shell_open_capture_file();
+	if (fd < 0) {
+		environ = sv_environ;
+		return 0;
+	}
+
+	/* We are in the middle of expanding another word: save its state */
+	sv_ifsfirst = ifsfirst;
+	sv_ifslastp = ifslastp;
+	sv_argbackq = argbackq;
+	sv_expdest = expdest;
+	ifsfirst.next = NULL;
+	ifslastp = NULL;
+
+	arglist.lastp = &arglist.list;
+	for (argp = n->ncmd.args; argp; argp = argp->narg.next)
+		expandarg(argp, &arglist, EXP_FULL | EXP_TILDE);
+	*arglist.lastp = NULL;
+
+	ifsfirst = sv_ifsfirst;
+	ifslastp = sv_ifslastp;
+	argbackq = sv_argbackq;
+	expdest = sv_expdest;
+
+	argc = 0;
+	for (sp = arglist.list; sp; sp = sp->next)
+		argc++;
+	argv = stalloc(sizeof(argv[0]) * (argc + 1));
+	argc = 0;
+	for (sp = arglist.list; sp; sp = sp->next)
+		argv[argc++] = sp->text;
+	argv[argc] = NULL;
+
+	flush_stdout_stderr();
+	result->status = shell_run_nofork_captured(fd, applet_no, argv);
+	environ = sv_environ;
+	pathdirs_maybe_changed();
+	result->fd = fd;
+	return 1;
+}
+#endif
+
 
 /*
  * The trap builtin.
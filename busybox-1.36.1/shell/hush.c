@@ -774,6 +774,11 @@ enum {
 #define setenv(...) setenv_is_leaky_dont_use()
 struct variable {
 	struct variable *next;
+	struct variable **pprev; /* &prev->next, or &G.top_var */
+	struct variable *hnext;  /* next in G.var_hash[] bucket */
+	/* list of variables with var_nest_level > 0, highest level first */
+	struct variable *lnext;
+	struct variable **lpprev;
 	char *varstr;        /* points to "name=" portion */
 	int max_len;         /* if > 0, name is part of initial env; else name is malloced */
 	uint16_t var_nest_level;
@@ -964,7 +969,15 @@ struct globals {
 	const char *ifs;
 	char *ifs_whitespace; /* = G.ifs or malloced */
 	const char *cwd;
+	/* All variables, in the order of creation */
 	struct variable *top_var;
+	struct variable **last_var_pp;
+	/* Same variables hashed by name */
+	struct variable **var_hash;
+	unsigned var_hash_size; /* power of 2 */
+	unsigned var_cnt;
+	/* Variables which have to go away when a function returns */
+	struct variable *nested_vars;
 	char **expanded_assignments;
 	struct variable **shadowed_vars_pp;
 	unsigned var_nest_level;
@@ -2104,6 +2117,7 @@ static void hush_exit(int exitcode)
 			cur_var = cur_var->next;
 			free(tmp);
 		}
+		free(G.var_hash);
 	}
 #endif
 
@@ -2234,23 +2248,114 @@ static const char *get_cwd(int force)
 /*
  * Shell and environment variable support
  */
-static struct variable **get_ptr_to_local_var(const char *name, unsigned len)
+static struct variable **var_bucket(const char *name, unsigned len)
+{
+	unsigned hash = 0;
+
+	while (len--)
+		hash = hash * 31 + (unsigned char)*name++;
+	return &G.var_hash[hash & (G.var_hash_size - 1)];
+}
+
+static void grow_var_hash(void)
+{
+	struct variable **old_hash = G.var_hash;
+	unsigned old_size = G.var_hash_size;
+	unsigned i;
+
+	G.var_hash_size = old_size ? old_size * 2 : 64;
+	G.var_hash = xzalloc(G.var_hash_size * sizeof(G.var_hash[0]));
+	for (i = 0; i < old_size; i++) {
+		struct variable *cur = old_hash[i];
+		while (cur) {
+			struct variable *next = cur->hnext;
+			struct variable **bucket;
+
+			bucket = var_bucket(cur->varstr, strchr(cur->varstr, '=') - cur->varstr);
+			cur->hnext = *bucket;
+			*bucket = cur;
+			cur = next;
+		}
+	}
+	free(old_hash);
+}
+
+/* Add variable (with varstr and var_nest_level already set)
+ * to G.top_var list before "before" (to the end if it is NULL),
+ * and to the hash */
+static void link_var(struct variable *var, struct variable *before)
+{
+	struct variable **bucket;
+
+	if (G.var_cnt >= G.var_hash_size)
+		grow_var_hash();
+	G.var_cnt++;
+	bucket = var_bucket(var->varstr, strchr(var->varstr, '=') - var->varstr);
+	var->hnext = *bucket;
+	*bucket = var;
+
+	if (before) {
+		var->next = before;
+		var->pprev = before->pprev;
+		*before->pprev = var;
+		before->pprev = &var->next;
+	} else {
+		var->next = NULL;
+		var->pprev = G.last_var_pp;
+		*G.last_var_pp = var;
+		G.last_var_pp = &var->next;
+	}
+
+	if (var->var_nest_level) {
+		/* Keep G.nested_vars sorted, highest level first */
+		struct variable **pp = &G.nested_vars;
+		while (*pp && (*pp)->var_nest_level > var->var_nest_level)
+			pp = &(*pp)->lnext;
+		var->lnext = *pp;
+		var->lpprev = pp;
+		if (*pp)
+			(*pp)->lpprev = &var->lnext;
+		*pp = var;
+	}
+}
+
+static void unlink_var(struct variable *var)
 {
 	struct variable **pp;
+
+	pp = var_bucket(var->varstr, strchr(var->varstr, '=') - var->varstr);
+	while (*pp != var)
+		pp = &(*pp)->hnext;
+	*pp = var->hnext;
+	G.var_cnt--;
+
+	*var->pprev = var->next;
+	if (var->next)
+		var->next->pprev = var->pprev;
+	else
+		G.last_var_pp = var->pprev;
+
+	if (var->var_nest_level) {
+		*var->lpprev = var->lnext;
+		if (var->lnext)
+			var->lnext->lpprev = var->lpprev;
+	}
+}
+
+static struct variable *get_local_var(const char *name, unsigned len)
+{
 	struct variable *cur;
 
-	pp = &G.top_var;
-	while ((cur = *pp) != NULL) {
+	for (cur = *var_bucket(name, len); cur; cur = cur->hnext) {
 		if (strncmp(cur->varstr, name, len) == 0 && cur->varstr[len] == '=')
-			return pp;
-		pp = &cur->next;
+			return cur;
 	}
 	return NULL;
 }
 
 static const char* FAST_FUNC get_local_var_value(const char *name)
 {
-	struct variable **vpp;
+	struct variable *var;
 	unsigned len = strlen(name);
 
 	if (G.expanded_assignments) {
@@ -2263,9 +2368,9 @@ static const char* FAST_FUNC get_local_var_value(const char *name)
 		}
 	}
 
-	vpp = get_ptr_to_local_var(name, len);
-	if (vpp)
-		return (*vpp)->varstr + len + 1;
+	var = get_local_var(name, len);
+	if (var)
+		return var->varstr + len + 1;
 
 	if (strcmp(name, "PPID") == 0)
 		return utoa(G.root_ppid);
@@ -2321,8 +2426,8 @@ static void handle_changed_special_names(const char *name, unsigned name_len)
 #define SETFLAG_VARLVL_SHIFT   3
 static int set_local_var(char *str, unsigned flags)
 {
-	struct variable **cur_pp;
 	struct variable *cur;
+	struct variable *before = NULL;
 	char *free_me = NULL;
 	char *eq_sign;
 	int name_len;
@@ -2334,13 +2439,8 @@ static int set_local_var(char *str, unsigned flags)
 		bb_simple_error_msg_and_die("BUG in setvar");
 
 	name_len = eq_sign - str + 1; /* including '=' */
-	cur_pp = &G.top_var;
-	while ((cur = *cur_pp) != NULL) {
-		if (strncmp(cur->varstr, str, name_len) != 0) {
-			cur_pp = &cur->next;
-			continue;
-		}
-
+	cur = get_local_var(str, name_len - 1);
+	if (cur) {
 		/* We found an existing var with this name */
 		if (cur->flg_read_only) {
 			bb_error_msg("%s: readonly variable", str);
@@ -2370,9 +2470,11 @@ static int set_local_var(char *str, unsigned flags)
 			 * "VAR=VAL cmd")
 			 * and existing one is global, or local
 			 * on a lower level that new one.
-			 * Remove it from global variable list:
+			 * Remove it from global variable list,
+			 * new one takes its place in it:
 			 */
-			*cur_pp = cur->next;
+			before = cur->next;
+			unlink_var(cur);
 			if (G.shadowed_vars_pp) {
 				/* Save in "shadowed" list */
 				debug_printf_env("shadowing %s'%s'/%u by '%s'/%u\n",
@@ -2391,7 +2493,7 @@ static int set_local_var(char *str, unsigned flags)
 					free_me = cur->varstr; /* then free it later */
 				free(cur);
 			}
-			break;
+			goto new_var;
 		}
 
 		if (strcmp(cur->varstr + name_len, eq_sign + 1) == 0) {
@@ -2424,11 +2526,13 @@ static int set_local_var(char *str, unsigned flags)
 	}
 
 	/* Not found or shadowed - create new variable struct */
+ new_var:
 	debug_printf_env("%s: alloc new var '%s'/%u\n", __func__, str, local_lvl);
 	cur = xzalloc(sizeof(*cur));
 	cur->var_nest_level = local_lvl;
-	cur->next = *cur_pp;
-	*cur_pp = cur;
+	cur->varstr = str;
+	link_var(cur, before);
+	goto exp;
 
  set_str_and_exp:
 	cur->varstr = str;
@@ -2481,28 +2585,20 @@ static void set_pwd_var(unsigned flag)
 static int unset_local_var_len(const char *name, int name_len)
 {
 	struct variable *cur;
-	struct variable **cur_pp;
-
-	cur_pp = &G.top_var;
-	while ((cur = *cur_pp) != NULL) {
-		if (strncmp(cur->varstr, name, name_len) == 0
-		 && cur->varstr[name_len] == '='
-		) {
-			if (cur->flg_read_only) {
-				bb_error_msg("%s: readonly variable", name);
-				return EXIT_FAILURE;
-			}
-
-			*cur_pp = cur->next;
-			debug_printf_env("%s: unsetenv '%s'\n", __func__, cur->varstr);
-			bb_unsetenv(cur->varstr);
-			if (!cur->max_len)
-				free(cur->varstr);
-			free(cur);
 
-			break;
+	cur = get_local_var(name, name_len);
+	if (cur) {
+		if (cur->flg_read_only) {
+			bb_error_msg("%s: readonly variable", name);
+			return EXIT_FAILURE;
 		}
-		cur_pp = &cur->next;
+
+		unlink_var(cur);
+		debug_printf_env("%s: unsetenv '%s'\n", __func__, cur->varstr);
+		bb_unsetenv(cur->varstr);
+		if (!cur->max_len)
+			free(cur->varstr);
+		free(cur);
 	}
 
 	/* Handle "unset LINENO" et al even if did not find the variable to unset */
@@ -2527,8 +2623,7 @@ static void add_vars(struct variable *var)
 
 	while (var) {
 		next = var->next;
-		var->next = G.top_var;
-		G.top_var = var;
+		link_var(var, G.top_var);
 		if (var->flg_export) {
 			debug_printf_env("%s: restoring exported '%s'/%u\n", __func__, var->varstr, var->var_nest_level);
 			putenv(var->varstr);
@@ -2554,15 +2649,13 @@ static void set_vars_and_save_old(char **strings)
 	s = strings;
 	while (*s) {
 		struct variable *var_p;
-		struct variable **var_pp;
 		char *eq;
 
 		eq = strchr(*s, '=');
 		if (HUSH_DEBUG && !eq)
 			bb_simple_error_msg_and_die("BUG in varexp4");
-		var_pp = get_ptr_to_local_var(*s, eq - *s);
-		if (var_pp) {
-			var_p = *var_pp;
+		var_p = get_local_var(*s, eq - *s);
+		if (var_p) {
 			if (var_p->flg_read_only) {
 				char **p;
 				bb_error_msg("%s: readonly variable", *s);
@@ -7710,13 +7803,24 @@ static int generate_stream_from_string(const char *s, pid_t *pid_p)
 }
 
 /* Return code is exit status of the process that is run. */
+#if ENABLE_FEATURE_SH_NOFORK && NUM_APPLETS > 1
+static int generate_stream_nofork(const char *s, int *status_p);
+#endif
 static int process_command_subs(o_string *dest, const char *s)
 {
 	FILE *fp;
 	pid_t pid;
 	int status, ch, eol_cnt;
 
+#if ENABLE_FEATURE_SH_NOFORK && NUM_APPLETS > 1
+	pid = 0;
+	ch = generate_stream_nofork(s, &status);
+	if (ch < 0)
+		ch = generate_stream_from_string(s, &pid);
+	fp = xfdopen_for_read(ch);
+#else
 	fp = xfdopen_for_read(generate_stream_from_string(s, &pid));
+#endif
 
 	/* Now send results of command back into original context */
 	eol_cnt = 0;
@@ -7736,6 +7840,10 @@ static int process_command_subs(o_string *dest, const char *s)
 
 	debug_printf("done reading from `cmd` pipe, closing it\n");
 	fclose(fp);
+#if ENABLE_FEATURE_SH_NOFORK && NUM_APPLETS > 1
+	if (pid == 0) /* was run in-process */
+		return status;
+#endif
 	/* We need to extract exitcode. Test case
 	 * "true; echo `sleep 1; false` $?"
 	 * should print 1 */
@@ -8210,21 +8318,18 @@ static const char * FAST_FUNC get_builtin_name(int i)
 static void remove_nested_vars(void)
 {
 	struct variable *cur;
-	struct variable **cur_pp;
 
-	cur_pp = &G.top_var;
-	while ((cur = *cur_pp) != NULL) {
-		if (cur->var_nest_level <= G.var_nest_level) {
-			cur_pp = &cur->next;
-			continue;
-		}
+	/* G.nested_vars is sorted by var_nest_level, highest first */
+	while ((cur = G.nested_vars) != NULL) {
+		if (cur->var_nest_level <= G.var_nest_level)
+			break;
 		/* Unexport */
 		if (cur->flg_export) {
 			debug_printf_env("unexporting nested '%s'/%u\n", cur->varstr, cur->var_nest_level);
 			bb_unsetenv(cur->varstr);
 		}
 		/* Remove from global list */
-		*cur_pp = cur->next;
+		unlink_var(cur);
 		/* Free */
 		if (!cur->max_len) {
 			debug_printf_env("freeing nested '%s'/%u\n", cur->varstr, cur->var_nest_level);
@@ -8441,6 +8546,124 @@ static int run_function(const struct function *funcp, char **argv)
 }
 #endif /* ENABLE_HUSH_FUNCTIONS */
 
+#if ENABLE_HUSH_TICK && ENABLE_FEATURE_SH_NOFORK && NUM_APPLETS > 1
+/* Is `cmd` text simple enough to be parsed in the parent
+ * without side effects or syntax errors?
+ * No lists, pipes, redirections, groups, nested `cmd`,
+ * $((arith)), ${var=word}, ${var?word}, ${var:n}.
+ */
+static int is_simple_cmdsubst(const char *s)
+{
+	char quote = 0;
+
+	for (; *s; s++) {
+		char c = *s;
+
+		if (quote == '\'') {
+			if (c == '\'')
+				quote = 0;
+			continue;
+		}
+		if (c == '\\') {
+			if (!*++s)
+				return 0;
+			continue;
+		}
+		if (c == '`')
+			return 0;
+		if (c == '"') {
+			quote ^= '"';
+			continue;
+		}
+		if (c == '$') {
+			c = s[1];
+			if (c == '(' || c == '[' || c == '\'')
+				return 0;
+			if (c == '{') {
+				for (s += 2; *s != '}'; s++) {
+					if (!*s || strchr("=?:$`\\\"'", *s))
+						return 0;
+				}
+			}
+			continue;
+		}
+		if (quote)
+			continue;
+		if (c == '\'') {
+			quote = c;
+			continue;
+		}
+		if (strchr(";&|<>(){}!\n", c))
+			return 0;
+	}
+	return !quote;
+}
+
+/* $(nofork_applet ARGS) needs no subshell: run the applet in-process,
+ * capturing its output in a temporary file.
+ * Returns fd to read the output from, or -1 if "s" has to be run
+ * in a child as usual.
+ */
+static int generate_stream_nofork(const char *s, int *status_p)
+{
+	/* builtins which are also NOFORK applets */
+	static const char nofork_bltins[] ALIGN1 =
+		"echo\0""printf\0""test\0""[\0""true\0""false\0";
+	static const char reserved_words[] ALIGN1 =
+		"if\0""then\0""elif\0""else\0""fi\0""for\0""while\0""until\0"
+		"do\0""done\0""case\0""esac\0""in\0""function\0";
+	struct in_str input;
+	struct pipe *pi;
+	struct command *cmd;
+	char **argv;
+	char *word;
+	int n, fd;
+
+	if (G_x_mode || G.o_opt[OPT_O_NOEXEC] || !is_simple_cmdsubst(s))
+		return -1;
+	s = skip_whitespace(s);
+	word = xstrndup(s, skip_non_whitespace(s) - s);
+	n = index_in_strings(reserved_words, word);
+	free(word);
+	if (n >= 0)
+		return -1;
+
+	setup_string_in_str(&input, s);
+	pi = parse_stream(NULL, NULL, &input, '\0');
+	if (!pi || pi == ERR_PTR)
+		return -1;
+	fd = -1;
+	argv = NULL;
+	cmd = pi->cmds;
+	/* (parser leaves an empty pipe at the end of the list) */
+	if ((pi->next && (!IS_NULL_PIPE(pi->next) || pi->next->next))
+	 || pi->num_cmds != 1
+	 IF_HAS_KEYWORDS(|| pi->pi_inverted || pi->res_word != RES_NONE)
+	 || cmd->cmd_type != CMD_NORMAL || cmd->group || cmd->redirects
+	 || cmd->assignment_cnt || !cmd->argv
+	) {
+		goto out;
+	}
+	argv = expand_strvec_to_strvec(cmd->argv);
+	if (!argv[0] IF_HUSH_FUNCTIONS(|| find_function(argv[0])))
+		goto out;
+	if (find_builtin(argv[0]) && index_in_strings(nofork_bltins, argv[0]) < 0)
+		goto out;
+	n = find_applet_by_name(argv[0]);
+	if (n < 0 || !APPLET_IS_NOFORK(n))
+		goto out;
+	fd = shell_open_capture_file();
+	if (fd >= 0) {
+		debug_printf_exec(": nofork `%s' '%s'...\n", argv[0], argv[1]);
+		*status_p = shell_run_nofork_captured(fd, n, argv);
+	}
+ out:
+	free(argv);
+	free_pipe_list(pi);
+	return fd;
+}
+#endif
+
 
 #if BB_MMU
 #define exec_builtin(to_free, x, argv) \
@@ -10271,17 +10494,20 @@ int hush_main(int argc, char **argv)
 
 	/* Create shell local variables from the values
 	 * currently living in the environment */
-	G.top_var = shell_ver;
-	cur_var = G.top_var;
+	G.last_var_pp = &G.top_var;
+	grow_var_hash();
+	link_var(shell_ver, NULL);
 	e = environ;
 	if (e) while (*e) {
 		char *value = strchr(*e, '=');
-		if (value) { /* paranoia */
-			cur_var->next = xzalloc(sizeof(*cur_var));
-			cur_var = cur_var->next;
+		if (value /* paranoia */
+		 && !get_local_var(*e, value - *e) /* first one wins */
+		) {
+			cur_var = xzalloc(sizeof(*cur_var));
 			cur_var->varstr = *e;
 			cur_var->max_len = strlen(*e);
 			cur_var->flg_export = 1;
+			link_var(cur_var, NULL);
 		}
 		e++;
 	}
@@ -11131,10 +11357,9 @@ static int helper_export_local(char **argv, unsigned flags)
 		const char *name_end = endofname(name);
 
 		if (*name_end == '\0') {
-			struct variable *var, **vpp;
+			struct variable *var;
 
-			vpp = get_ptr_to_local_var(name, name_end - name);
-			var = vpp ? *vpp : NULL;
+			var = get_local_var(name, name_end - name);
 
 			if (flags & SETFLAG_UNEXPORT) {
 				/* export -n NAME (without =VALUE) */
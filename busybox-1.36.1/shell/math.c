@@ -246,9 +246,70 @@ typedef struct remembered_name {
 	const char *var;
 } remembered_name;
 
+#if ENABLE_FEATURE_SH_MATH_CACHE
+/* Parsing decisions in evaluate_string() never depend on values
+ * of variables (even "a ? b : c" evaluates both b and c),
+ * so the sequence of number pushes, name pushes and arith_apply()'s
+ * it performs for a given string is always the same.
+ * We record it for frequently evaluated strings, such as $((i+1))
+ * in a loop, and next time just replay it.
+ */
+enum {
+	AI_NUM,   /* push val */
+	AI_VAR,   /* push variable names[name] */
+	AI_APPLY, /* arith_apply(op) */
+	AI_PAREN, /* "(var)": resolve var on top of stack to number */
+};
+typedef struct arith_insn {
+	arith_t val;
+	unsigned short name;
+	unsigned char code;
+	operator op;
+} arith_insn;
+
+typedef struct arith_compiled {
+	unsigned hash;
+	unsigned ninsns;
+	unsigned nnums;
+	char *text;
+	char *names;
+	arith_insn insn[];
+} arith_compiled;
+
+typedef struct arith_rec {
+	arith_insn *insn;
+	unsigned ninsns;
+	unsigned nnums;
+	unsigned names_len;
+	char *names;
+} arith_rec;
+
+/* Longer strings are not cached */
+# define ARITH_CACHE_MAXLEN 250
+/* Must be a power of 2 */
+# define ARITH_CACHE_SIZE   64
+static arith_compiled *arith_cache[ARITH_CACHE_SIZE];
+/* Hash of last string seen in the slot. We compile a string
+ * only when it is seen twice: $(($i+1)) is expanded to
+ * "1+1", "2+1"... and there is no point in caching those.
+ */
+static unsigned arith_cache_seen[ARITH_CACHE_SIZE];
+
+static void
+arith_rec_insn(arith_rec *rec, unsigned code, operator op, arith_t val)
+{
+	arith_insn *in = &rec->insn[rec->ninsns++];
+	in->code = code;
+	in->op = op;
+	in->val = val;
+}
+#else
+typedef struct arith_rec arith_rec;
+# define arith_rec_insn(rec, code, op, val) ((void)0)
+#endif
 
 static arith_t
-evaluate_string(arith_state_t *math_state, const char *expr);
+evaluate_string(arith_state_t *math_state, const char *expr, arith_rec *rec);
 
 static const char*
 arith_lookup_val(arith_state_t *math_state, var_or_num_t *t)
@@ -258,6 +319,24 @@ arith_lookup_val(arith_state_t *math_state, var_or_num_t *t)
 		if (p) {
 			remembered_name *cur;
 			remembered_name cur_save;
+#if ENABLE_FEATURE_SH_MATH_CACHE
+			/* Most variables used in arithmetic contain plain
+			 * decimal numbers, skip the parser for them.
+			 * Up to 9 digits fit in 32-bit arith_t, 18 in 64-bit;
+			 * longer numbers go to the parser which handles overflow */
+			const char *q = p + (*p == '-');
+			if (*q >= '1' && *q <= '9') {
+				arith_t n = 0;
+				const char *d = q;
+				do
+					n = n * 10 + (*d++ - '0');
+				while (isdigit(*d) && d - q < (int)sizeof(arith_t) * 9 / 4);
+				if (*d == '\0') {
+					t->val = (p == q) ? n : -n;
+					return NULL;
+				}
+			}
+#endif
 
 			/* did we already see this name?
 			 * testcase: a=b; b=a; echo $((a))
@@ -276,7 +355,7 @@ arith_lookup_val(arith_state_t *math_state, var_or_num_t *t)
 			math_state->list_of_recursed_names = &cur_save;
 
 			/* recursively evaluate p as expression */
-			t->val = evaluate_string(math_state, p);
+			t->val = evaluate_string(math_state, p, NULL);
 
 			/* pop current var name */
 			math_state->list_of_recursed_names = cur;
@@ -578,7 +657,7 @@ static arith_t strto_arith_t(const char *nptr, char **endptr)
 #endif
 
 static arith_t
-evaluate_string(arith_state_t *math_state, const char *expr)
+evaluate_string(arith_state_t *math_state, const char *expr, arith_rec *rec)
 {
 	operator lasttok;
 	const char *errmsg;
@@ -640,6 +719,15 @@ evaluate_string(arith_state_t *math_state, const char *expr)
 			safe_strncpy(numstackptr->var, expr, var_name_size);
 //bb_error_msg("var:'%s'", numstackptr->var);
 			expr = p;
+#if ENABLE_FEATURE_SH_MATH_CACHE
+			if (rec) {
+				arith_rec_insn(rec, AI_VAR, 0, 0);
+				rec->insn[rec->ninsns - 1].name = rec->names_len;
+				strcpy(rec->names + rec->names_len, numstackptr->var);
+				rec->names_len += var_name_size;
+				rec->nnums++;
+			}
+#endif
  num:
 			numstackptr->second_val_present = 0;
 			numstackptr++;
@@ -655,6 +743,12 @@ evaluate_string(arith_state_t *math_state, const char *expr)
 //bb_error_msg("val:%lld", numstackptr->val);
 			if (errno)
 				numstackptr->val = 0; /* bash compat */
+#if ENABLE_FEATURE_SH_MATH_CACHE
+			if (rec) {
+				arith_rec_insn(rec, AI_NUM, 0, numstackptr->val);
+				rec->nnums++;
+			}
+#endif
 			goto num;
 		}
 
@@ -766,6 +860,8 @@ evaluate_string(arith_state_t *math_state, const char *expr)
 //bb_error_msg("prev_op == TOK_LPAREN");
 //bb_error_msg("  %p %p numstackptr[-1].var:'%s'", numstack, numstackptr-1, numstackptr[-1].var);
 						if (numstackptr[-1].var) {
+							if (rec)
+								arith_rec_insn(rec, AI_PAREN, 0, 0);
 							/* Expression is (var), lookup now */
 							errmsg = arith_lookup_val(math_state, &numstackptr[-1]);
 							if (errmsg)
@@ -792,6 +888,8 @@ evaluate_string(arith_state_t *math_state, const char *expr)
 					}
 				}
 //bb_error_msg("arith_apply(prev_op:%02x)", prev_op);
+				if (rec)
+					arith_rec_insn(rec, AI_APPLY, prev_op, 0);
 				errmsg = arith_apply(math_state, prev_op, numstack, &numstackptr);
 				if (errmsg)
 					goto err_with_custom_msg;
@@ -815,12 +913,100 @@ evaluate_string(arith_state_t *math_state, const char *expr)
 	return numstack->val;
 }
 
+#if ENABLE_FEATURE_SH_MATH_CACHE
+static arith_t
+evaluate_compiled(arith_state_t *math_state, const arith_compiled *c)
+{
+	var_or_num_t *const numstack = alloca(c->nnums * sizeof(numstack[0]));
+	var_or_num_t *numstackptr = numstack;
+	const arith_insn *in = c->insn;
+	const arith_insn *end = in + c->ninsns;
+	const char *errmsg = NULL;
+
+	for (; in < end; in++) {
+		if (in->code == AI_NUM || in->code == AI_VAR) {
+			numstackptr->var = NULL;
+			if (in->code == AI_VAR)
+				numstackptr->var = c->names + in->name;
+			numstackptr->val = in->val;
+			numstackptr->second_val_present = 0;
+			numstackptr++;
+			continue;
+		}
+		if (in->code == AI_PAREN) {
+			errmsg = arith_lookup_val(math_state, &numstackptr[-1]);
+			numstackptr[-1].var = NULL;
+		} else {
+			errmsg = arith_apply(math_state, in->op, numstack, &numstackptr);
+		}
+		if (errmsg) {
+			numstack->val = -1;
+			break;
+		}
+	}
+	math_state->errmsg = errmsg;
+	return numstack->val;
+}
+
+static arith_t
+evaluate_and_cache(arith_state_t *math_state, const char *expr)
+{
+	arith_compiled *c;
+	arith_rec rec;
+	arith_t res;
+	unsigned hash, len, slot;
+
+	hash = 0;
+	for (len = 0; expr[len]; len++) {
+		if (len > ARITH_CACHE_MAXLEN)
+			return evaluate_string(math_state, expr, NULL);
+		hash = hash * 31 + (unsigned char)expr[len];
+	}
+	slot = hash & (ARITH_CACHE_SIZE - 1);
+	c = arith_cache[slot];
+	if (c && c->hash == hash && strcmp(c->text, expr) == 0)
+		return evaluate_compiled(math_state, c);
+
+	if (arith_cache_seen[slot] != hash) {
+		arith_cache_seen[slot] = hash;
+		return evaluate_string(math_state, expr, NULL);
+	}
+
+	/* Every token produces at most one push and one apply,
+	 * plus the final ')' we add */
+	rec.insn = alloca((2 * len + 4) * sizeof(rec.insn[0]));
+	rec.names = alloca(len + 1);
+	rec.ninsns = rec.nnums = rec.names_len = 0;
+	res = evaluate_string(math_state, expr, &rec);
+	if (math_state->errmsg || rec.nnums == 0)
+		return res;
+
+	free(c);
+	c = xmalloc(sizeof(*c) + rec.ninsns * sizeof(c->insn[0])
+			+ rec.names_len + len + 1);
+	c->hash = hash;
+	c->ninsns = rec.ninsns;
+	c->nnums = rec.nnums;
+	memcpy(c->insn, rec.insn, rec.ninsns * sizeof(c->insn[0]));
+	c->names = (char*)&c->insn[rec.ninsns];
+	memcpy(c->names, rec.names, rec.names_len);
+	c->text = c->names + rec.names_len;
+	strcpy(c->text, expr);
+	arith_cache[slot] = c;
+	return res;
+}
+#endif
+
 arith_t FAST_FUNC
 arith(arith_state_t *math_state, const char *expr)
 {
 	math_state->errmsg = NULL;
 	math_state->list_of_recursed_names = NULL;
-	return evaluate_string(math_state, expr);
+#if ENABLE_FEATURE_SH_MATH_CACHE
+	return evaluate_and_cache(math_state, expr);
+#else
+	return evaluate_string(math_state, expr, NULL);
+#endif
 }
 
 /*
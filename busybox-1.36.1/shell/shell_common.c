@@ -688,3 +688,51 @@ shell_builtin_ulimit(char **argv)
 
 	return EXIT_SUCCESS;
 }
+
+#if ENABLE_FEATURE_SH_NOFORK
+/* Command substitution of a NOFORK applet does not need a subshell:
+ * the applet runs in the shell process with stdout redirected
+ * to an (already unlinked) temporary file, which is then read back
+ * by the usual command substitution code.
+ * Returns -1 if temporary file can't be created - caller forks then.
+ */
+int FAST_FUNC
+shell_open_capture_file(void)
+{
+	const char *tmpdir;
+	char *name;
+	int fd;
+
+	tmpdir = getenv("TMPDIR");
+	name = concat_path_file(tmpdir ? tmpdir : "/tmp", "sh-XXXXXX");
+	fd = mkstemp(name);
+	if (fd >= 0) {
+		unlink(name);
+		close_on_exec_on(fd);
+	}
+	free(name);
+	return fd;
+}
+
+int FAST_FUNC
+shell_run_nofork_captured(int fd, int applet_no, char **argv)
+{
+	int saved_stdout;
+	int rc;
+
+	fflush_all();
+	/* Above 9: user redirections use fds 0..9 */
+	saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD, 10);
+	xdup2(fd, STDOUT_FILENO);
+	rc = run_nofork_applet(applet_no, argv);
+	if (saved_stdout >= 0) {
+		xdup2(saved_stdout, STDOUT_FILENO);
+		close(saved_stdout);
+	} else {
+		/* stdout was closed */
+		close(STDOUT_FILENO);
+	}
+	xlseek(fd, 0, SEEK_SET);
+	return rc;
+}
+#endif
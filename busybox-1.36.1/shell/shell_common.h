@@ -54,6 +54,14 @@ shell_builtin_read(struct builtin_read_params *params);
 int FAST_FUNC
 shell_builtin_ulimit(char **argv);
 
+#if ENABLE_FEATURE_SH_NOFORK
+/* $(applet ARGS) run in-process: temporary file to capture the output */
+int FAST_FUNC
+shell_open_capture_file(void);
+int FAST_FUNC
+shell_run_nofork_captured(int fd, int applet_no, char **argv);
+#endif
+
 POP_SAVED_FUNCTION_VISIBILITY
 
 #endif